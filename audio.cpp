@@ -0,0 +1,268 @@
+#include <iostream>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#include <ao/ao.h>
+#include <mpg123.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "audio.h"
+
+using namespace std;
+
+static const char *sfx_files[SFX_COUNT] = {
+    "./audio_move.mp3",
+    "./audio_fall.mp3",
+    "./audio_bridge.mp3",
+    "./audio_win.mp3",
+};
+
+#define MIX_FRAMES 256      // frames per ao_play call, ~6ms at 44.1kHz
+#define MAX_VOICES 16
+#define QUEUE_SIZE 64       // must be a power of two
+
+struct Clip {
+    vector<short> samples;  // interleaved, already in the output format
+};
+
+struct Voice {
+    const Clip *clip;
+    size_t pos;
+    long long trigger_time;
+};
+
+struct SfxCommand {
+    int sfx;
+    long long trigger_time;
+};
+
+static mpg123_handle *mh;
+static int music_ok;
+static int err;
+
+static int driver;
+static ao_device *dev;
+
+static ao_sample_format format;
+static int channels, encoding;
+static long rate;
+
+static Clip clips[SFX_COUNT];
+static Voice voices[MAX_VOICES];
+static int num_voices;
+
+// Single producer (game thread), single consumer (audio thread)
+static SfxCommand sfx_queue[QUEUE_SIZE];
+static atomic<unsigned> queue_head(0), queue_tail(0);
+
+static atomic<bool> running(false);
+static thread mixer;
+
+static long long latency_count, latency_sum, latency_max;
+
+static long long now_ns()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Decode a whole clip into memory so the audio thread never touches the decoder for effects
+static void load_clip(Clip *clip, const char *path)
+{
+    mpg123_handle *h = mpg123_new(NULL, &err);
+    if(h == NULL)
+    {
+        fprintf(stderr, "audio: cannot open %s, effect disabled\n", path);
+        return;
+    }
+    mpg123_format_none(h);
+    mpg123_format(h, rate, channels, MPG123_ENC_SIGNED_16);
+
+    if(mpg123_open(h, path) != MPG123_OK)
+    {
+        fprintf(stderr, "audio: cannot open %s, effect disabled\n", path);
+        mpg123_delete(h);
+        return;
+    }
+
+    unsigned char chunk[4096];
+    size_t got;
+    int ret;
+    do
+    {
+        got = 0;
+        ret = mpg123_read(h, chunk, sizeof(chunk), &got);
+        clip->samples.insert(clip->samples.end(), (short*) chunk, (short*) (chunk + got));
+    } while(ret == MPG123_OK || ret == MPG123_NEW_FORMAT);
+
+    mpg123_close(h);
+    mpg123_delete(h);
+}
+
+// dst += src with saturation, 8 samples per step
+static void mix_add(short *dst, const short *src, size_t n)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    for(; i + 8 <= n; i += 8)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i*) (dst + i));
+        __m128i b = _mm_loadu_si128((const __m128i*) (src + i));
+        _mm_storeu_si128((__m128i*) (dst + i), _mm_adds_epi16(a, b));
+    }
+#endif
+    for(; i < n; i++)
+    {
+        int s = dst[i] + src[i];
+        dst[i] = s > 32767 ? 32767 : (s < -32768 ? -32768 : s);
+    }
+}
+
+static void read_music(short *out, size_t n)
+{
+    unsigned char *dst = (unsigned char*) out;
+    size_t want = n * sizeof(short), have = 0;
+    int rewinds = 0;
+
+    while(music_ok && have < want)
+    {
+        size_t got = 0;
+        int ret = mpg123_read(mh, dst + have, want - have, &got);
+        have += got;
+        if(ret != MPG123_OK && ret != MPG123_NEW_FORMAT)
+        {
+            // Loop the track; give up if it keeps producing nothing
+            if(mpg123_seek(mh, 0, SEEK_SET) < 0 || ++rewinds > 1)
+                music_ok = 0;
+        }
+        else if(got > 0)
+            rewinds = 0;
+    }
+    memset(dst + have, 0, want - have);
+}
+
+static void mixer_loop()
+{
+    vector<short> block(MIX_FRAMES * channels);
+    long long started[MAX_VOICES];
+
+    // Keep going after audio_close() until the last effects have played out
+    while(running.load(memory_order_acquire) || num_voices > 0)
+    {
+        read_music(&block[0], block.size());
+
+        int new_voices = 0;
+        unsigned head = queue_head.load(memory_order_relaxed);
+        unsigned tail = queue_tail.load(memory_order_acquire);
+        for(; head != tail; head++)
+        {
+            const SfxCommand &cmd = sfx_queue[head & (QUEUE_SIZE - 1)];
+            if(clips[cmd.sfx].samples.empty() || num_voices == MAX_VOICES)
+                continue;
+            Voice &v = voices[num_voices++];
+            v.clip = &clips[cmd.sfx];
+            v.pos = 0;
+            v.trigger_time = cmd.trigger_time;
+            started[new_voices++] = cmd.trigger_time;
+        }
+        queue_head.store(head, memory_order_release);
+
+        for(int i = 0; i < num_voices; )
+        {
+            Voice &v = voices[i];
+            size_t n = min(block.size(), v.clip->samples.size() - v.pos);
+            mix_add(&block[0], &v.clip->samples[v.pos], n);
+            v.pos += n;
+            if(v.pos == v.clip->samples.size())
+                voices[i] = voices[--num_voices];
+            else
+                i++;
+        }
+
+        ao_play(dev, (char*) &block[0], block.size() * sizeof(short));
+
+        // ao_play returns once the block is queued on the device
+        long long t = now_ns();
+        for(int i = 0; i < new_voices; i++)
+        {
+            long long latency = t - started[i];
+            latency_count++;
+            latency_sum += latency;
+            latency_max = max(latency_max, latency);
+        }
+    }
+}
+
+void audio_init() {
+
+    ao_initialize();
+    driver = ao_default_driver_id();
+    mpg123_init();
+    mh = mpg123_new(NULL, &err);
+
+    music_ok = mpg123_open(mh, "./audio_background.mp3") == MPG123_OK;
+    if(music_ok)
+        mpg123_getformat(mh, &rate, &channels, &encoding);
+    else
+    {
+        fprintf(stderr, "audio: cannot open ./audio_background.mp3\n");
+        rate = 44100;
+        channels = 2;
+    }
+
+    // Everything is mixed as signed 16 bit in the music's rate and layout
+    mpg123_format_none(mh);
+    mpg123_format(mh, rate, channels, MPG123_ENC_SIGNED_16);
+
+    for(int i = 0; i < SFX_COUNT; i++)
+        load_clip(&clips[i], sfx_files[i]);
+
+    format.bits = 16;
+    format.rate = rate;
+    format.channels = channels;
+    format.byte_format = AO_FMT_NATIVE;
+    format.matrix = 0;
+    dev = ao_open_live(driver, &format, NULL);
+    if(dev == NULL)
+    {
+        fprintf(stderr, "audio: cannot open output device\n");
+        return;
+    }
+
+    running.store(true, memory_order_release);
+    mixer = thread(mixer_loop);
+}
+
+void audio_trigger(int sfx) {
+
+    unsigned tail = queue_tail.load(memory_order_relaxed);
+    if(tail - queue_head.load(memory_order_acquire) == QUEUE_SIZE)
+        return;  // queue full, drop the effect rather than wait
+    sfx_queue[tail & (QUEUE_SIZE - 1)].sfx = sfx;
+    sfx_queue[tail & (QUEUE_SIZE - 1)].trigger_time = now_ns();
+    queue_tail.store(tail + 1, memory_order_release);
+}
+
+void audio_close() {
+
+    running.store(false, memory_order_release);
+    if(mixer.joinable())
+        mixer.join();
+
+    if(latency_count > 0)
+        printf("audio: %lld effects, trigger-to-output latency avg %.2f ms, max %.2f ms\n",
+               latency_count, latency_sum / 1e6 / latency_count, latency_max / 1e6);
+
+    if(dev)
+        ao_close(dev);
+    mpg123_close(mh);
+    mpg123_delete(mh);
+    mpg123_exit();
+    ao_shutdown();
+}
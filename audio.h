@@ -0,0 +1,17 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+// Sound effects, mixed on top of the background music on the audio thread
+enum {
+    SFX_MOVE,
+    SFX_FALL,
+    SFX_BRIDGE,
+    SFX_WIN,
+    SFX_COUNT
+};
+
+void audio_init();
+void audio_trigger(int sfx);   // wait-free, safe to call from draw()
+void audio_close();
+
+#endif
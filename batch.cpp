@@ -0,0 +1,388 @@
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BATCH_X86 1
+#endif
+
+#include "batch.h"
+
+using namespace std;
+
+void sim_batch_resize(SimBatch *b, int n)
+{
+    b->n = n;
+    b->x.resize(n);
+    b->z.resize(n);
+    b->orient.resize(n);
+    b->moves.resize(n);
+    b->switches.resize(n);
+    b->crumbled.resize(n);
+    b->timers.resize((size_t) n * SIM_MAX_TIMERS);
+}
+
+void sim_batch_set(SimBatch *b, int i, const SimState *s)
+{
+    b->x[i] = s->x;
+    b->z[i] = s->z;
+    b->orient[i] = s->orient;
+    b->moves[i] = s->moves;
+    b->switches[i] = s->switches;
+    b->crumbled[i] = s->crumbled;
+    memcpy(&b->timers[(size_t) i * SIM_MAX_TIMERS], s->timers, SIM_MAX_TIMERS);
+}
+
+void sim_batch_get(const SimBatch *b, int i, SimState *s)
+{
+    s->x = b->x[i];
+    s->z = b->z[i];
+    s->orient = b->orient[i];
+    s->moves = b->moves[i];
+    s->switches = b->switches[i];
+    s->crumbled = b->crumbled[i];
+    memcpy(s->timers, &b->timers[(size_t) i * SIM_MAX_TIMERS], SIM_MAX_TIMERS);
+}
+
+void sim_batch_copy(SimBatch *dst, int i, const SimBatch *src, int j)
+{
+    dst->x[i] = src->x[j];
+    dst->z[i] = src->z[j];
+    dst->orient[i] = src->orient[j];
+    dst->moves[i] = src->moves[j];
+    dst->switches[i] = src->switches[j];
+    dst->crumbled[i] = src->crumbled[j];
+    memcpy(&dst->timers[(size_t) i * SIM_MAX_TIMERS], &src->timers[(size_t) j * SIM_MAX_TIMERS], SIM_MAX_TIMERS);
+}
+
+// One state through sim_step()
+static int step_lane(const SimLevel *sl, SimBatch *b, int i, int move)
+{
+    SimState s;
+    sim_batch_get(b, i, &s);
+    int flags = sim_step(sl, &s, move, &s);
+    sim_batch_set(b, i, &s);
+    return flags;
+}
+
+// Lane i fell in the vector code, which only moved x, z, orient and moves back
+static void reset_lane(SimBatch *b, int i)
+{
+    b->switches[i] = 0;
+    b->crumbled[i] = 0;
+    memset(&b->timers[(size_t) i * SIM_MAX_TIMERS], 0, SIM_MAX_TIMERS);
+}
+
+/* The shape as lookup tables, indexed by orientation * MOVE_COUNT + move and
+   by orientation, padded to whole AVX2 registers, and the plane layout as byte offsets from planes.data():
+   level row x starts at (x + SIM_BORDER) * row_stride and its plane p at
+   p * row_bytes from there (see sim_plane_row()). */
+struct StepTables {
+    int32_t next[SIM_MAX_ORIENTS * MOVE_COUNT], dx[SIM_MAX_ORIENTS * MOVE_COUNT], dz[SIM_MAX_ORIENTS * MOVE_COUNT];
+    int32_t rows[8];        // footprint rows along x
+    int32_t mask[8];        // one footprint row, as in SimShape
+    int32_t plane[8];       // offset of the plane the block needs: heavy or light
+    int32_t single[8];      // all ones if it can finish on the goal
+    int max_rows;
+    int32_t row_stride, dynamic, goal;  // the last two are plane offsets
+};
+
+static void tables_init(const SimLevel *sl, StepTables *t)
+{
+    const SimShape *shape = sl->shape;
+    memset(t, 0, sizeof(*t));
+    for(int o = 0; o < shape->num_orients; o++)
+    {
+        for(int m = 0; m < MOVE_COUNT; m++)
+        {
+            t->next[o * MOVE_COUNT + m] = shape->transitions[o][m][0];
+            t->dx[o * MOVE_COUNT + m] = shape->transitions[o][m][1];
+            t->dz[o * MOVE_COUNT + m] = shape->transitions[o][m][2];
+        }
+        t->rows[o] = shape->extent[o][0];
+        t->mask[o] = shape->footprint[o];
+        t->plane[o] = (shape->heavy[o] ? PLANE_HEAVY : PLANE_LIGHT) * sl->row_bytes;
+        t->single[o] = shape->single[o] ? -1 : 0;
+        if(t->rows[o] > t->max_rows)
+            t->max_rows = t->rows[o];
+    }
+    t->row_stride = PLANE_COUNT * sl->row_bytes;
+    t->dynamic = PLANE_DYNAMIC * sl->row_bytes;
+    t->goal = PLANE_GOAL * sl->row_bytes;
+}
+
+#ifdef BATCH_X86
+
+// Entry index of a 24-entry table held in three registers of 8
+__attribute__((target("avx2")))
+static inline __m256i lookup24(const __m256i *table, __m256i index)
+{
+    __m256i high = _mm256_srli_epi32(index, 3);
+    __m256i a = _mm256_permutevar8x32_epi32(table[0], index), b = _mm256_permutevar8x32_epi32(table[1], index);
+    __m256i c = _mm256_permutevar8x32_epi32(table[2], index);
+    __m256i v = _mm256_blendv_epi8(a, b, _mm256_cmpeq_epi32(high, _mm256_set1_epi32(1)));
+    return _mm256_blendv_epi8(v, c, _mm256_cmpeq_epi32(high, _mm256_set1_epi32(2)));
+}
+
+/* Eight states at a time. The shape tables are small enough for register
+   permutes; the plane words are gathered. Each lane's footprint row is a
+   32-bit load at the byte of its first column (the 8 bytes of row slack keep
+   it inside the row), shifted by its own amount. Lanes with fewer footprint
+   rows than the widest orientation leave the extra rows out of the gather. */
+__attribute__((target("avx2")))
+static void step_avx2(const SimLevel *sl, const StepTables *t, SimBatch *b, const unsigned char *moves,
+                      unsigned char *flags, int n)
+{
+    const int *planes = (const int*) sl->planes.data();
+    const __m256i border = _mm256_set1_epi32(SIM_BORDER), ones = _mm256_set1_epi32(-1), zero = _mm256_setzero_si256();
+    const __m256i stride = _mm256_set1_epi32(t->row_stride);
+    const __m256i moved = _mm256_set1_epi32(SIM_MOVED), won = _mm256_set1_epi32(SIM_WON), fell = _mm256_set1_epi32(SIM_FELL);
+    const __m256i start_x = _mm256_set1_epi32(sl->level->start_x), start_z = _mm256_set1_epi32(sl->level->start_z);
+    const __m256i flag_bytes = _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                                0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    __m256i next[3], dx[3], dz[3];
+    for(int q = 0; q < 3; q++)
+    {
+        next[q] = _mm256_loadu_si256((const __m256i*) (t->next + 8*q));
+        dx[q] = _mm256_loadu_si256((const __m256i*) (t->dx + 8*q));
+        dz[q] = _mm256_loadu_si256((const __m256i*) (t->dz + 8*q));
+    }
+    const __m256i rows_of = _mm256_loadu_si256((const __m256i*) t->rows), mask_of = _mm256_loadu_si256((const __m256i*) t->mask);
+    const __m256i plane_of = _mm256_loadu_si256((const __m256i*) t->plane);
+    const __m256i single_of = _mm256_loadu_si256((const __m256i*) t->single);
+    for(int i = 0; i + 8 <= n; i += 8)
+    {
+        __m256i o = _mm256_loadu_si256((const __m256i*) &b->orient[i]);
+        __m256i x = _mm256_loadu_si256((const __m256i*) &b->x[i]);
+        __m256i z = _mm256_loadu_si256((const __m256i*) &b->z[i]);
+        __m256i count = _mm256_loadu_si256((const __m256i*) &b->moves[i]);
+        __m256i m = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) (moves + i)));
+
+        __m256i k = _mm256_add_epi32(_mm256_slli_epi32(o, 2), m);
+        __m256i no = lookup24(next, k);
+        __m256i nx = _mm256_add_epi32(x, lookup24(dx, k));
+        __m256i nz = _mm256_add_epi32(z, lookup24(dz, k));
+        __m256i rows = _mm256_permutevar8x32_epi32(rows_of, no);
+        __m256i mask = _mm256_permutevar8x32_epi32(mask_of, no);
+        __m256i plane = _mm256_permutevar8x32_epi32(plane_of, no);
+        __m256i single = _mm256_permutevar8x32_epi32(single_of, no);
+
+        __m256i c = _mm256_add_epi32(nz, border);
+        __m256i shift = _mm256_and_si256(c, _mm256_set1_epi32(7));
+        __m256i row = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_add_epi32(nx, border), stride), _mm256_srli_epi32(c, 3));
+        __m256i goal = _mm256_i32gather_epi32(planes, _mm256_add_epi32(row, _mm256_set1_epi32(t->goal)), 1);
+        __m256i solid = mask, dynamic = zero;
+        for(int r = 0; r < t->max_rows; r++)
+        {
+            __m256i active = _mm256_cmpgt_epi32(rows, _mm256_set1_epi32(r));
+            __m256i w = _mm256_mask_i32gather_epi32(ones, planes, _mm256_add_epi32(row, plane), active, 1);
+            __m256i d = _mm256_mask_i32gather_epi32(zero, planes, _mm256_add_epi32(row, _mm256_set1_epi32(t->dynamic)),
+                                                    active, 1);
+            solid = _mm256_and_si256(solid, _mm256_srlv_epi32(w, shift));
+            dynamic = _mm256_or_si256(dynamic, _mm256_srlv_epi32(d, shift));
+            row = _mm256_add_epi32(row, stride);
+        }
+        __m256i ok = _mm256_cmpeq_epi32(solid, mask);
+        __m256i fast = _mm256_cmpeq_epi32(_mm256_and_si256(dynamic, mask), zero);
+        int slow = ~_mm256_movemask_ps(_mm256_castsi256_ps(fast)) & 0xff;
+        goal = _mm256_and_si256(_mm256_and_si256(_mm256_srlv_epi32(goal, shift), single), _mm256_set1_epi32(1));
+        __m256i at_goal = _mm256_cmpeq_epi32(goal, _mm256_set1_epi32(1));
+
+        // A fall puts the block back at the start, as sim_start()
+        __m256i f = _mm256_or_si256(moved, _mm256_blendv_epi8(fell, _mm256_and_si256(at_goal, won), ok));
+        int32_t old_x[8], old_z[8], old_o[8], old_moves[8];
+        if(slow)
+        {
+            _mm256_storeu_si256((__m256i*) old_x, x);
+            _mm256_storeu_si256((__m256i*) old_z, z);
+            _mm256_storeu_si256((__m256i*) old_o, o);
+            _mm256_storeu_si256((__m256i*) old_moves, count);
+        }
+        _mm256_storeu_si256((__m256i*) &b->x[i], _mm256_blendv_epi8(start_x, nx, ok));
+        _mm256_storeu_si256((__m256i*) &b->z[i], _mm256_blendv_epi8(start_z, nz, ok));
+        _mm256_storeu_si256((__m256i*) &b->orient[i], _mm256_and_si256(no, ok));
+        _mm256_storeu_si256((__m256i*) &b->moves[i], _mm256_and_si256(_mm256_sub_epi32(count, ones), ok));
+        __m256i bytes = _mm256_shuffle_epi8(f, flag_bytes);
+        int32_t lo = _mm256_extract_epi32(bytes, 0), hi = _mm256_extract_epi32(bytes, 4);
+        memcpy(flags + i, &lo, 4);
+        memcpy(flags + i + 4, &hi, 4);
+
+        // What a fall clears besides, the timers being 8 bytes a lane; slow
+        // lanes keep theirs for sim_step()
+        __m256i keep = _mm256_or_si256(ok, _mm256_xor_si256(fast, ones));
+        if(!_mm256_testc_si256(keep, ones))
+        {
+            __m256i *sw = (__m256i*) &b->switches[i], *cr = (__m256i*) &b->crumbled[i];
+            _mm256_storeu_si256(sw, _mm256_and_si256(_mm256_loadu_si256(sw), keep));
+            _mm256_storeu_si256(cr, _mm256_and_si256(_mm256_loadu_si256(cr), keep));
+            __m256i *tm = (__m256i*) &b->timers[(size_t) i * SIM_MAX_TIMERS];
+            for(int q = 0; q < 2; q++)
+            {
+                __m128i half = q ? _mm256_extracti128_si256(keep, 1) : _mm256_castsi256_si128(keep);
+                _mm256_storeu_si256(tm + q, _mm256_and_si256(_mm256_loadu_si256(tm + q), _mm256_cvtepi32_epi64(half)));
+            }
+        }
+        // sim_step() is SSE code, which runs slowly with the upper halves of
+        // the AVX registers in use
+        if(slow)
+            _mm256_zeroupper();
+        for(; slow; slow &= slow - 1)
+        {
+            int j = __builtin_ctz(slow);
+            b->x[i + j] = old_x[j];
+            b->z[i + j] = old_z[j];
+            b->orient[i + j] = old_o[j];
+            b->moves[i + j] = old_moves[j];
+            flags[i + j] = step_lane(sl, b, i + j, moves[i + j]);
+        }
+    }
+}
+
+// 4 lanes by index, no gather instruction before AVX2
+__attribute__((target("sse4.1")))
+static inline __m128i lookup4(const int32_t *table, __m128i index)
+{
+    return _mm_setr_epi32(table[_mm_extract_epi32(index, 0)], table[_mm_extract_epi32(index, 1)],
+                          table[_mm_extract_epi32(index, 2)], table[_mm_extract_epi32(index, 3)]);
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128i load4(const unsigned char *base, __m128i offset)
+{
+    int32_t off[4], w[4];
+    _mm_storeu_si128((__m128i*) off, offset);
+    for(int j = 0; j < 4; j++)
+        memcpy(&w[j], base + off[j], 4);
+    return _mm_loadu_si128((const __m128i*) w);
+}
+
+/* Four states at a time with the loads done lane by lane. SSE4.1 has no
+   per-lane shift, so the footprint mask moves up to the plane bits instead:
+   times 2^shift, the power of two made as a float exponent. */
+__attribute__((target("sse4.1")))
+static void step_sse4(const SimLevel *sl, const StepTables *t, SimBatch *b, const unsigned char *moves,
+                      unsigned char *flags, int n)
+{
+    const unsigned char *planes = sl->planes.data();
+    const __m128i border = _mm_set1_epi32(SIM_BORDER), ones = _mm_set1_epi32(-1), zero = _mm_setzero_si128();
+    const __m128i stride = _mm_set1_epi32(t->row_stride);
+    const __m128i moved = _mm_set1_epi32(SIM_MOVED), won = _mm_set1_epi32(SIM_WON), fell = _mm_set1_epi32(SIM_FELL);
+    const __m128i start_x = _mm_set1_epi32(sl->level->start_x), start_z = _mm_set1_epi32(sl->level->start_z);
+    const __m128i flag_bytes = _mm_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    for(int i = 0; i + 4 <= n; i += 4)
+    {
+        __m128i o = _mm_loadu_si128((const __m128i*) &b->orient[i]);
+        __m128i x = _mm_loadu_si128((const __m128i*) &b->x[i]);
+        __m128i z = _mm_loadu_si128((const __m128i*) &b->z[i]);
+        __m128i count = _mm_loadu_si128((const __m128i*) &b->moves[i]);
+        int32_t m4;
+        memcpy(&m4, moves + i, 4);
+        __m128i m = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(m4));
+
+        __m128i k = _mm_add_epi32(_mm_slli_epi32(o, 2), m);
+        __m128i no = lookup4(t->next, k);
+        __m128i nx = _mm_add_epi32(x, lookup4(t->dx, k));
+        __m128i nz = _mm_add_epi32(z, lookup4(t->dz, k));
+        __m128i rows = lookup4(t->rows, no);
+        __m128i plane = lookup4(t->plane, no);
+        __m128i single = lookup4(t->single, no);
+
+        __m128i c = _mm_add_epi32(nz, border);
+        __m128i shift = _mm_and_si128(c, _mm_set1_epi32(7));
+        __m128i bit = _mm_cvttps_epi32(_mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(shift, _mm_set1_epi32(127)), 23)));
+        __m128i mask = _mm_mullo_epi32(lookup4(t->mask, no), bit);
+        __m128i row = _mm_add_epi32(_mm_mullo_epi32(_mm_add_epi32(nx, border), stride), _mm_srli_epi32(c, 3));
+        __m128i goal = load4(planes, _mm_add_epi32(row, _mm_set1_epi32(t->goal)));
+        __m128i solid = mask, dynamic = zero;
+        for(int r = 0; r < t->max_rows; r++)
+        {
+            // Rows a lane does not have read its first row again, which is in the planes
+            __m128i active = _mm_cmpgt_epi32(rows, _mm_set1_epi32(r));
+            __m128i at = _mm_add_epi32(row, _mm_and_si128(_mm_set1_epi32(r * t->row_stride), active));
+            __m128i w = _mm_or_si128(load4(planes, _mm_add_epi32(at, plane)), _mm_andnot_si128(active, ones));
+            __m128i d = _mm_and_si128(load4(planes, _mm_add_epi32(at, _mm_set1_epi32(t->dynamic))), active);
+            solid = _mm_and_si128(solid, w);
+            dynamic = _mm_or_si128(dynamic, d);
+        }
+        __m128i ok = _mm_cmpeq_epi32(solid, mask);
+        int slow = ~_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(dynamic, mask), zero))) & 0xf;
+        __m128i at_goal = _mm_and_si128(_mm_cmpeq_epi32(_mm_and_si128(goal, bit), bit), single);
+
+        __m128i f = _mm_or_si128(moved, _mm_blendv_epi8(fell, _mm_and_si128(at_goal, won), ok));
+        int32_t old_x[4], old_z[4], old_o[4], old_moves[4];
+        if(slow)
+        {
+            _mm_storeu_si128((__m128i*) old_x, x);
+            _mm_storeu_si128((__m128i*) old_z, z);
+            _mm_storeu_si128((__m128i*) old_o, o);
+            _mm_storeu_si128((__m128i*) old_moves, count);
+        }
+        _mm_storeu_si128((__m128i*) &b->x[i], _mm_blendv_epi8(start_x, nx, ok));
+        _mm_storeu_si128((__m128i*) &b->z[i], _mm_blendv_epi8(start_z, nz, ok));
+        _mm_storeu_si128((__m128i*) &b->orient[i], _mm_and_si128(no, ok));
+        _mm_storeu_si128((__m128i*) &b->moves[i], _mm_and_si128(_mm_sub_epi32(count, ones), ok));
+        int32_t out = _mm_cvtsi128_si32(_mm_shuffle_epi8(f, flag_bytes));
+        memcpy(flags + i, &out, 4);
+
+        int falls = ~_mm_movemask_ps(_mm_castsi128_ps(ok)) & ~slow & 0xf;
+        for(; falls; falls &= falls - 1)
+            reset_lane(b, i + __builtin_ctz(falls));
+        for(; slow; slow &= slow - 1)
+        {
+            int j = __builtin_ctz(slow);
+            b->x[i + j] = old_x[j];
+            b->z[i + j] = old_z[j];
+            b->orient[i + j] = old_o[j];
+            b->moves[i + j] = old_moves[j];
+            flags[i + j] = step_lane(sl, b, i + j, moves[i + j]);
+        }
+    }
+}
+
+#endif
+
+int sim_batch_isa()
+{
+#ifdef BATCH_X86
+    static const int isa = __builtin_cpu_supports("avx2") ? SIM_BATCH_AVX2 :
+                           __builtin_cpu_supports("sse4.1") ? SIM_BATCH_SSE4 : SIM_BATCH_SCALAR;
+    return isa;
+#else
+    return SIM_BATCH_SCALAR;
+#endif
+}
+
+const char *sim_batch_isa_name(int isa)
+{
+    return isa == SIM_BATCH_AVX2 ? "avx2" : isa == SIM_BATCH_SSE4 ? "sse4.1" : "scalar";
+}
+
+void sim_step_batch_isa(int isa, const SimLevel *sl, SimBatch *b, const unsigned char *moves, unsigned char *flags)
+{
+    // Crumbling tiles and timers change with every move, wherever the block is
+    int done = 0;
+    if(sl->crumble_tiles.empty() && sl->num_timers == 0)
+    {
+        StepTables t;
+#ifdef BATCH_X86
+        if(isa == SIM_BATCH_AVX2)
+        {
+            tables_init(sl, &t);
+            step_avx2(sl, &t, b, moves, flags, b->n);
+            done = b->n & ~7;
+        }
+        else if(isa == SIM_BATCH_SSE4)
+        {
+            tables_init(sl, &t);
+            step_sse4(sl, &t, b, moves, flags, b->n);
+            done = b->n & ~3;
+        }
+#endif
+    }
+    for(int i = done; i < b->n; i++)
+        flags[i] = step_lane(sl, b, i, moves[i]);
+}
+
+void sim_step_batch(const SimLevel *sl, SimBatch *b, const unsigned char *moves, unsigned char *flags)
+{
+    sim_step_batch_isa(sim_batch_isa(), sl, b, moves, flags);
+}
@@ -0,0 +1,45 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "sim.h"
+
+/* Many block states stepped at once, stored as structure of arrays so a vector
+   register holds the same field of 8 (AVX2) or 4 (SSE4.1) states. Each state
+   takes its own move. A lane whose block lands on a tile of PLANE_DYNAMIC, and
+   every lane on a level with crumbling tiles or timed buttons, goes through
+   sim_step() instead; the results are the same as sim_step() on each state. */
+struct SimBatch {
+    int n;
+    std::vector<int32_t> x, z, orient, moves;
+    std::vector<uint32_t> switches, crumbled;
+    std::vector<unsigned char> timers;  // SIM_MAX_TIMERS per state
+};
+
+enum {
+    SIM_BATCH_SCALAR,
+    SIM_BATCH_SSE4,
+    SIM_BATCH_AVX2,
+};
+
+void sim_batch_resize(SimBatch *b, int n);
+void sim_batch_set(SimBatch *b, int i, const SimState *s);
+void sim_batch_get(const SimBatch *b, int i, SimState *s);
+
+// State j of src into state i of dst, field by field
+void sim_batch_copy(SimBatch *dst, int i, const SimBatch *src, int j);
+
+// The best of SIM_BATCH_* this CPU runs, checked once
+int sim_batch_isa();
+const char *sim_batch_isa_name(int isa);
+
+// Apply moves[i] to state i, which sim_supported() accepts, and set flags[i]
+// to the sim_step() flags
+void sim_step_batch(const SimLevel *sl, SimBatch *b, const unsigned char *moves, unsigned char *flags);
+
+// The same with a given code path, which must not be better than sim_batch_isa()
+void sim_step_batch_isa(int isa, const SimLevel *sl, SimBatch *b, const unsigned char *moves, unsigned char *flags);
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef BOTPROTO_H
+#define BOTPROTO_H
+
+#include <stdint.h>
+
+/* Wire format between `server --listen` and bots on the same machine, over a
+   Unix stream socket. Every message is a BotHeader followed by count items of
+   the type's payload; every request gets exactly one reply, in order. Native
+   byte order and layout, as both ends run on the same host.
+
+   BOT_OPEN     count x uint32 level         -> BOT_OPENED, count x int32 session (-1 if no such level)
+   BOT_CLOSE    count x uint32 session       -> BOT_CLOSED, count 0
+   BOT_MOVES    count x BotMove              -> BOT_STATES, count x BotState, in the order of the moves
+   BOT_SHM      count = bytes, one fd passed -> BOT_SHM_OK, count 0 (at most BOT_MAX_SHM bytes)
+   anything bad                              -> BOT_ERROR, count 0, and the connection is closed
+
+   Moves of one batch are applied in order; a session may appear more than
+   once and then takes its moves one tick after the other. Batches of all
+   connected bots share ticks. After BOT_SHM, the fd being a memfd_create()
+   file of at least count bytes sealed with F_SEAL_SHRINK, BOT_STATES keeps
+   its count but carries no items: the states are written at the start of
+   that mapping before the reply is sent, and the bot reads them there. A bot
+   with replies of more than a few MB unread gets no more requests handled
+   until it reads them. */
+#define BOT_MAX_ITEMS (1 << 20)
+
+enum {
+    BOT_OPEN = 1,
+    BOT_CLOSE,
+    BOT_MOVES,
+    BOT_SHM,
+
+    BOT_OPENED = 0x81,
+    BOT_CLOSED,
+    BOT_STATES,
+    BOT_SHM_OK,
+    BOT_ERROR = 0xff,
+};
+
+struct BotHeader {
+    uint32_t type;
+    uint32_t count;
+};
+
+struct BotMove {
+    uint32_t session;
+    uint32_t move;          // MOVE_*
+};
+
+struct BotState {
+    int32_t session;        // -1 if the session was not open
+    int32_t x, z, orient;   // after the move, as SimState
+    uint32_t flags;         // sim_step() flags of the move; a won session is back at the start
+    uint32_t moves;         // since the level started, the game's score for it
+    uint32_t falls, wins;   // since the session opened
+};
+
+// Largest BOT_SHM count: room for the states of the largest batch
+#define BOT_MAX_SHM (BOT_MAX_ITEMS * sizeof(BotState))
+
+#endif
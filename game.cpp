@@ -1,74 +1,38 @@
 #include <iostream>
 #include <cmath>
 #include <fstream>
-#include <map>
 #include <vector>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+#include <atomic>
 #include <unistd.h>
+#include <poll.h>
+#include <sys/inotify.h>
 
 #include <GL/glew.h>
 #include <GL/gl.h>
 #include <GLFW/glfw3.h>
 
-#include <ao/ao.h>
-#include <mpg123.h>
-
 #define GLM_FORCE_RADIANS
 #include <glm/glm.hpp>
 #include <glm/gtx/transform.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
-using namespace std;
-
-mpg123_handle *mh;
-unsigned char *buffer;
-size_t buffer_size;
-size_t done;
-int err;
-
-int driver;
-ao_device *dev;
-
-ao_sample_format format;
-int channels, encoding;
-long rate;
-
-void audio_init() {
-
-    ao_initialize();
-    driver = ao_default_driver_id();
-    mpg123_init();
-    mh = mpg123_new(NULL, &err);
-    buffer_size= 3000;
-    buffer = (unsigned char*) malloc(buffer_size * sizeof(unsigned char));
-
-    mpg123_open(mh, "./audio_background.mp3");
-    mpg123_getformat(mh, &rate, &channels, &encoding);
-
-    format.bits = mpg123_encsize(encoding) * 8;
-    format.rate = rate;
-    format.channels = channels;
-    format.byte_format = AO_FMT_NATIVE;
-    format.matrix = 0;
-    dev = ao_open_live(driver, &format, NULL);
-}
-
-void audio_play() {
-    
-    if (mpg123_read(mh, buffer, buffer_size, &done) == MPG123_OK)
-        ao_play(dev, (char*) buffer, done);
-    else mpg123_seek(mh, 0, SEEK_SET);
-}
-
-void audio_close() {
-    
-    free(buffer);
-    ao_close(dev);
-    mpg123_close(mh);
-    mpg123_delete(mh);
-    mpg123_exit();
-    ao_shutdown();
-}
+#include "audio.h"
+#include "level.h"
+#include "level_static.h"
+#include "sim.h"
+#include "pack.h"
+#include "journal.h"
+#include "session.h"
+#include "solcache.h"
 
+using namespace std;
 
 struct VAO {
     GLuint VertexArrayID;
@@ -88,41 +52,163 @@ struct GLMatrices {
     GLuint MatrixID;
 } Matrices;
 
-int do_rot, top;
 GLuint programID;
 double last_update_time, current_time;
-glm::vec3 rect_pos, floor_pos;
 float rectangle_rotation = 0;
 
 /* Special thanks for that guiline to help us solve a huge problem
     https://badvertex.com/2012/11/20/how-to-load-a-glsl-shader-in-opengl-using-c.html */
 
+int use_shader_cache = 1, shader_from_cache = 0;
+const char *shader_cache_file = "shader_cache.bin";
+
+// Level, block, score and views, mapped from session_file and updated in place
+Session *session;
+Session session_memory;  // when the file cannot be mapped
+const char *session_file = "session.bin";
+
+// Par and solution of every level played before, keyed by the level's content
+SolCache *solutions;  // NULL when the file cannot be mapped
+const char *solutions_file = "solutions.cache";
+
+struct ShaderCacheHeader {
+    char magic[4];          // "BLXS"
+    unsigned int version;
+    unsigned long long key; // hash of both sources and the driver strings
+    unsigned int format;    // binaryFormat from glGetProgramBinary
+    unsigned int length;
+};
+
+// Read a whole file with a single read
+string ReadFile(const char *path)
+{
+    ifstream in(path, ios::in | ios::binary);
+    if(!in.is_open())
+        return "";
+    in.seekg(0, ios::end);
+    string data((size_t) in.tellg(), '\0');
+    in.seekg(0, ios::beg);
+    in.read(&data[0], data.size());
+    return data;
+}
+
+// FNV-1a, good enough to tell shader sources and drivers apart
+unsigned long long HashString(unsigned long long h, const char *s, size_t len)
+{
+    for(size_t i = 0; i < len; i++)
+    {
+        h ^= (unsigned char) s[i];
+        h *= 1099511628211ULL;
+    }
+    return h ^ 0xff;  // separator so "ab"+"c" != "a"+"bc"
+}
+
+unsigned long long ShaderCacheKey(const string &vertex_code, const string &fragment_code)
+{
+    const char *driver[] = {
+        (const char*) glGetString(GL_VENDOR),
+        (const char*) glGetString(GL_RENDERER),
+        (const char*) glGetString(GL_VERSION),
+    };
+    unsigned long long h = 14695981039346656037ULL;
+    h = HashString(h, vertex_code.data(), vertex_code.size());
+    h = HashString(h, fragment_code.data(), fragment_code.size());
+    for(int i = 0; i < 3; i++)
+        if(driver[i])
+            h = HashString(h, driver[i], strlen(driver[i]));
+    return h;
+}
+
+// Returns 0 when there is no usable binary for this key
+GLuint LoadProgramBinary(unsigned long long key)
+{
+    ifstream in(shader_cache_file, ios::in | ios::binary | ios::ate);
+    streamoff file_size = in.tellg();
+    ShaderCacheHeader header;
+    if(!in.seekg(0) || !in.read((char*) &header, sizeof(header)))
+        return 0;
+    if(memcmp(header.magic, "BLXS", 4) != 0 || header.version != 1 || header.key != key)
+        return 0;
+    // A damaged file must not cost more than compiling
+    if(header.length == 0 || header.length > file_size - (streamoff) sizeof(header))
+    {
+        fprintf(stderr, "Shader cache is damaged, compiling from source\n");
+        return 0;
+    }
+
+    vector<char> binary(header.length);
+    if(!in.read(&binary[0], binary.size()))
+        return 0;
+
+    GLuint ProgramID = glCreateProgram();
+    glProgramBinary(ProgramID, header.format, &binary[0], header.length);
+
+    // The driver may reject a binary even with a matching key (e.g. after an update)
+    GLint Result = GL_FALSE;
+    glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
+    if(Result != GL_TRUE)
+    {
+        fprintf(stderr, "Shader cache rejected by the driver, compiling from source\n");
+        glDeleteProgram(ProgramID);
+        return 0;
+    }
+    return ProgramID;
+}
+
+void SaveProgramBinary(GLuint ProgramID, unsigned long long key)
+{
+    GLint length = 0;
+    glGetProgramiv(ProgramID, GL_PROGRAM_BINARY_LENGTH, &length);
+    if(length <= 0)
+        return;
+
+    vector<char> binary(length);
+    GLenum binary_format;
+    glGetProgramBinary(ProgramID, length, NULL, &binary_format, &binary[0]);
+
+    ShaderCacheHeader header;
+    memcpy(header.magic, "BLXS", 4);
+    header.version = 1;
+    header.key = key;
+    header.format = binary_format;
+    header.length = length;
+
+    // Written next to the cache and renamed over it, so a failed write leaves the old one
+    string tmp = string(shader_cache_file) + ".tmp";
+    ofstream out(tmp.c_str(), ios::out | ios::binary | ios::trunc);
+    out.write((const char*) &header, sizeof(header));
+    out.write(&binary[0], length);
+    out.close();
+    if(!out || rename(tmp.c_str(), shader_cache_file) != 0)
+    {
+        fprintf(stderr, "Cannot write the shader cache %s\n", shader_cache_file);
+        unlink(tmp.c_str());
+    }
+}
+
 GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path) {
 
-    GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-    GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+    // Read the shader code from the files
+    string VertexShaderCode = ReadFile(vertex_file_path);
+    string FragmentShaderCode = ReadFile(fragment_file_path);
 
-    // Read the vertex shader code from the file
-    string VertexShaderCode;
-    ifstream VertexShaderStream(vertex_file_path, ios::in);
-    if(VertexShaderStream.is_open())
-	{
-	    string Line = "";
-	    while(getline(VertexShaderStream, Line))
-		VertexShaderCode += "\n" + Line;
-	    VertexShaderStream.close();
-	}
-
-    // Read the fragment shader code from the file
-    string FragmentShaderCode;
-    ifstream FragmentShaderStream(fragment_file_path, ios::in);
-    if(FragmentShaderStream.is_open()){
-	string Line = "";
-	while(getline(FragmentShaderStream, Line))
-	    FragmentShaderCode += "\n" + Line;
-	FragmentShaderStream.close();
+    int cache = use_shader_cache && GLEW_ARB_get_program_binary;
+    unsigned long long key = 0;
+    shader_from_cache = 0;
+    if(cache)
+    {
+        key = ShaderCacheKey(VertexShaderCode, FragmentShaderCode);
+        GLuint ProgramID = LoadProgramBinary(key);
+        if(ProgramID)
+        {
+            shader_from_cache = 1;
+            return ProgramID;
+        }
     }
 
+    GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
+    GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+
     GLint Result = GL_FALSE;
     int InfoLogLength;
 
@@ -134,7 +220,7 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
     // Check Vertex Shader
     glGetShaderiv(VertexShaderID, GL_COMPILE_STATUS, &Result);
     glGetShaderiv(VertexShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-    vector<char> VertexShaderErrorMessage(InfoLogLength);
+    vector<char> VertexShaderErrorMessage( max(InfoLogLength, int(1)) );
     glGetShaderInfoLog(VertexShaderID, InfoLogLength, NULL, &VertexShaderErrorMessage[0]);
 
     // Compile Fragment Shader
@@ -145,13 +231,15 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
     // Check Fragment Shader
     glGetShaderiv(FragmentShaderID, GL_COMPILE_STATUS, &Result);
     glGetShaderiv(FragmentShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-    vector<char> FragmentShaderErrorMessage(InfoLogLength);
+    vector<char> FragmentShaderErrorMessage( max(InfoLogLength, int(1)) );
     glGetShaderInfoLog(FragmentShaderID, InfoLogLength, NULL, &FragmentShaderErrorMessage[0]);
 
     // Link the program
     GLuint ProgramID = glCreateProgram();
     glAttachShader(ProgramID, VertexShaderID);
     glAttachShader(ProgramID, FragmentShaderID);
+    if(cache)
+        glProgramParameteri(ProgramID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     glLinkProgram(ProgramID);
 
     // Check the program
@@ -160,6 +248,9 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
     vector<char> ProgramErrorMessage( max(InfoLogLength, int(1)) );
     glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
 
+    if(cache && Result == GL_TRUE)
+        SaveProgramBinary(ProgramID, key);
+
     glDeleteShader(VertexShaderID);
     glDeleteShader(FragmentShaderID);
 
@@ -167,8 +258,25 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 }
 
 
+thread audio_loader, level_loader, level_watcher;
+atomic<bool> watching_levels(false);
+void stopLevelThreads();
+void reportJournal();
+
+// Audio is opened on a worker thread during startup
+void shutdownAudio()
+{
+    if(audio_loader.joinable())
+        audio_loader.join();
+    audio_close();
+}
+
 void quit(GLFWwindow *window)
 {
+    stopLevelThreads();
+    reportJournal();
+    session_seal(session);
+    shutdownAudio();
     glfwDestroyWindow(window);
     glfwTerminate();
     exit(EXIT_SUCCESS);
@@ -222,6 +330,14 @@ struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloa
     return vao;
 }
 
+void delete3DObject (struct VAO* vao)
+{
+    glDeleteBuffers(1, &vao->VertexBuffer);
+    glDeleteBuffers(1, &vao->ColorBuffer);
+    glDeleteVertexArrays(1, &vao->VertexArrayID);
+    delete vao;
+}
+
 /* Render the VBOs handled by VAO */
 void draw3DObject (struct VAO* vao)
 {
@@ -251,20 +367,40 @@ void draw3DObject (struct VAO* vao)
 float rectangle_rot_dir = 1;
 bool rectangle_rot_status = true;
 int roll_back=0, win=0;
-float rect_posx, rect_posy, rect_posz;
 
 typedef struct Sprite
 {
-    string name;
-    float x,y,z;
+    float x,y;
     VAO* object;
     int status;
-    int angle;
 }Sprite;
 
-map <string,Sprite> normals;
-map <string, Sprite> cube;
-map <string,Sprite> scoreboard;
+// Seven segments per scoreboard digit, 1 is the ones digit and 2 the tens
+enum {
+    SEG_UP1, SEG_UL1, SEG_UR1, SEG_CN1, SEG_BL1, SEG_BR1, SEG_BT1,
+    SEG_UP2, SEG_UL2, SEG_UR2, SEG_CN2, SEG_BL2, SEG_BR2, SEG_BT2,
+    SEG_COUNT
+};
+#define SEGS_PER_DIGIT 7
+
+// Names are only used when creating sprites and in error messages
+const char *segment_names[SEG_COUNT] = {
+    "up1", "ul1", "ur1", "cn1", "bl1", "br1", "bt1",
+    "up2", "ul2", "ur2", "cn2", "bl2", "br2", "bt2",
+};
+
+SimShape block_shape;  // --block, 1x2x1 unless given
+Sprite cube[SIM_MAX_ORIENTS];  // block mesh of each orientation of block_shape
+Sprite scoreboard[SEG_COUNT];
+
+int spriteIndex(const char **names, int count, const string &name)
+{
+    for(int i=0;i<count;i++)
+        if(name == names[i])
+            return i;
+    fprintf(stderr, "sprite: unknown name %s\n", name.c_str());
+    exit(EXIT_FAILURE);
+}
 
 // Prefered for Keyboard events 
 void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
@@ -280,8 +416,8 @@ void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
     }
 }
 int side_rotation=0;
-int front=0,level=1;
 int w_pressed,a_pressed,d_pressed,s_pressed;
+int u_pressed,r_pressed,h_pressed;
 
 void keyboardChar (GLFWwindow* window, unsigned int key)
 {
@@ -301,12 +437,21 @@ void keyboardChar (GLFWwindow* window, unsigned int key)
         case 's':
             s_pressed=1;
             break;
+        case 'u':
+            u_pressed=1;
+            break;
+        case 'r':
+            r_pressed=1;
+            break;
+        case 'h':
+            h_pressed=1;
+            break;
         case 't':
-            top ^= 1;
-            front=0;
+            session->top ^= 1;
+            session->front=0;
         break;
         case ' ':
-        do_rot ^= 1;
+        session->do_rot ^= 1;
         break;
         default:
         break;
@@ -326,537 +471,621 @@ void reshapeWindow (GLFWwindow* window, int width, int height)
     
 }
 
-VAO *scorerectangle, *line, *rectangle, *rectangle2, *rectangle3, *floor_vao;
 
-void createRectangle (string name) 
+// One cuboid mesh per orientation of the block shape, standing on the anchor tile.
+// The faces across the block's original height are light, the others gray.
+void createBlockMeshes(const SimShape *shape)
 {
-    static const GLfloat vertex_buffer_data [] = {
-	-0.5, 1.0, 0.5,
-	0.5, 1.0, 0.5, 
-	0.5, -1.0, 0.5,
-	-0.5, 1.0, 0.5, 
-	-0.5, -1.0, 0.5,
-	0.5, -1.0, 0.5,
-	0.5, 1.0, 0.5,
-	0.5, 1.0, -0.5,
-	0.5, -1.0, -0.5,
-	0.5, 1.0, 0.5,
-	0.5, -1.0, 0.5,
-	0.5, -1.0, -0.5,
-	-0.5, 1.0, -0.5,
-	0.5, 1.0, -0.5,
-	0.5, -1.0, -0.5,
-	-0.5, 1.0, -0.5,
-	-0.5, -1.0, -0.5,
-	0.5, -1.0, -0.5,
-	-0.5, 1.0, 0.5,
-	-0.5, 1.0, -0.5,
-	-0.5, -1.0, -0.5, 
-	-0.5, 1.0, 0.5,
-	-0.5, -1.0, 0.5, 
-	-0.5, -1.0, -0.5, 
-	-0.5, 1.0, 0.5,
-	-0.5, 1.0, -0.5, 
-	0.5, 1.0, -0.5,
-	-0.5, 1.0, 0.5,
-	0.5, 1.0, 0.5,
-	0.5, 1.0, -0.5,
-	-0.5, -1.0, 0.5,
-	0.5, -1.0, 0.5,
-	0.5, -1.0, -0.5,
-	-0.5, -1.0, 0.5, 
-	-0.5, -1.0, -0.5,
-	0.5, -1.0, -0.5,
-    };
+    for(int o = 0; o < shape->num_orients; o++)
+    {
+        const int *extent = shape->extent[o];
+        float lo[3] = { -0.5f, -1.0f, -0.5f };
+        float hi[3] = { extent[0] - 0.5f, extent[1] - 1.0f, extent[2] - 0.5f };
+        GLfloat vertex_buffer_data[6*6*3], color_buffer_data[6*6*3];
+        GLfloat *v = vertex_buffer_data, *c = color_buffer_data;
+        for(int axis = 0; axis < 3; axis++)
+        {
+            int u = (axis + 1) % 3, w = (axis + 2) % 3;
+            float shade = shape->axis[o][axis] == 1 ? 211.0f/255 : 105.0f/255;
+            for(int side = 0; side < 2; side++)
+            {
+                // Two triangles spanning the face in its u and w directions
+                static const int corners[6][2] = { {0,0}, {1,0}, {1,1}, {0,0}, {1,1}, {0,1} };
+                for(int k = 0; k < 6; k++)
+                {
+                    v[axis] = side ? hi[axis] : lo[axis];
+                    v[u] = corners[k][0] ? hi[u] : lo[u];
+                    v[w] = corners[k][1] ? hi[w] : lo[w];
+                    c[0] = c[1] = c[2] = shade;
+                    v += 3;
+                    c += 3;
+                }
+            }
+        }
+        cube[o].status = o == 0;
+        cube[o].object = create3DObject(GL_TRIANGLES, 6*6, vertex_buffer_data, color_buffer_data, GL_FILL);
+    }
+}
+
+enum { FLOOR_NORMAL, FLOOR_FRAG, FLOOR_BRIDGE, FLOOR_BRIDGEBUTTON, FLOOR_GOAL, FLOOR_CRUMBLE, FLOOR_TELEPORT, FLOOR_COUNT };
+
+// Two triangles per tile, the second one slightly darker
+const GLfloat floor_colors[FLOOR_COUNT][2][3] = {
+    { {0.65, 0.165, 0.165}, {0.55, 0.165, 0.165} },  // normal
+    { {1, 1, 0},            {1, 0.8, 0} },           // frag
+    { {0, 1, 1},            {0, 1, 0.7} },           // bridge
+    { {0, 0, 1},            {0, 0, 0.8} },           // bridgebutton
+    { {0, 1, 0.5},          {0, 1, 0.3} },           // goal
+    { {0.5, 0.45, 0.4},     {0.4, 0.35, 0.3} },      // crumble
+    { {0.8, 0, 0.8},        {0.6, 0, 0.6} },         // teleport
+};
+
+// Vertex data for one level, built on a worker thread and uploaded on the GL thread.
+// Every tile owns 6 vertices so a single tile can be rewritten in place; tiles
+// that are void in the shown state (bridges down, crumbled) stay degenerate.
+struct LevelMesh {
+    vector<GLfloat> floor_vertices, floor_colors;
+};
+
+#define TILE_FLOATS 18  // 6 vertices * xyz
 
-    GLfloat color_buffer_data [] = {
-	1.0f, 1.0f, 0.0f,//yellow
-	1.0f, 1.0f, 0.0f,
-	1.0f, 1.0f, 0.0f,
-	1.0f, 1.0f, 0.0f,
-	1.0f, 1.0f, 0.0f,
-	1.0f, 1.0f, 0.0f,
-	1.0f, 0.0f, 1.0f,//pink
-	1.0f, 0.0f, 1.0f,
-	1.0f, 0.0f, 1.0f,
-	1.0f, 0.0f, 1.0f,
-	1.0f, 0.0f, 1.0f,
-	1.0f, 0.0f, 1.0f,
-	0.0f, 1.0f, 1.0f,
-	0.0f, 1.0f, 1.0f,
-	0.0f, 1.0f, 1.0f,
-	0.0f, 1.0f, 1.0f,
-	0.0f, 1.0f, 1.0f,
-	0.0f, 1.0f, 1.0f,
-	1.0f, 0.0f, 0.0f,
-	1.0f, 0.0f, 0.0f,
-	1.0f, 0.0f, 0.0f,
-	1.0f, 0.0f, 0.0f,
-	1.0f, 0.0f, 0.0f,
-	1.0f, 0.0f, 0.0f,
-	0.0f, 1.0f, 0.0f,	
-	0.0f, 1.0f, 0.0f,	
-	0.0f, 1.0f, 0.0f,	
-	0.0f, 1.0f, 0.0f,	
-	0.0f, 1.0f, 0.0f,	
-	0.0f, 1.0f, 0.0f,	
-	0.0f, 0.0f, 1.0f,
-	0.0f, 0.0f, 1.0f,
-	0.0f, 0.0f, 1.0f,
-	0.0f, 0.0f, 1.0f,
-	0.0f, 0.0f, 1.0f,
-	0.0f, 0.0f, 1.0f,
+void createFloor(GLfloat *vertices, GLfloat *colors, int type, float x, float y, float z)
+{
+    const GLfloat vertex_buffer_data [] = {
+        (float)(x-0.5),y,(float)(z+0.5),
+        (float)(x+0.5),y,(float)(z+0.5),
+        (float)(x+0.5),y,(float)(z-0.5),
+        (float)(x-0.5),y,(float)(z+0.5),
+        (float)(x-0.5),y,(float)(z-0.5),
+        (float)(x+0.5),y,(float)(z-0.5),
     };
+    memcpy(vertices, vertex_buffer_data, sizeof(vertex_buffer_data));
+    for(int i = 0; i < 6; i++)
+        memcpy(colors + 3*i, floor_colors[type][i / 3], 3*sizeof(GLfloat));
+}
 
-    int i;
-    for(i=0;i<72;i++)
+// Tile (i,j) as it looks in state s
+void buildTile(const SimLevel *sim, const SimState *s, int i, int j, LevelMesh *mesh)
+{
+    const Level *lvl = sim->level;
+    int offset = (i*lvl->size_z + j) * TILE_FLOATS;
+    GLfloat *floor_v = &mesh->floor_vertices[offset], *floor_c = &mesh->floor_colors[offset];
+    memset(floor_v, 0, TILE_FLOATS*sizeof(GLfloat));
+
+    // The level is centered on the origin
+    float x = i - lvl->size_x/2, z = j - lvl->size_z/2;
+    switch(sim_tile(sim, s, i, j))
     {
-        color_buffer_data[i]=(float)105/255;
+    case TILE_FLOOR:
+        createFloor(floor_v, floor_c, FLOOR_NORMAL, x, -1.0, z);
+        break;
+    case TILE_FRAGILE:
+        createFloor(floor_v, floor_c, FLOOR_FRAG, x, -1.0, z);
+        break;
+    case TILE_BUTTON:
+        createFloor(floor_v, floor_c, FLOOR_BRIDGEBUTTON, x, -1.0, z);
+        break;
+    case TILE_BRIDGE:
+        createFloor(floor_v, floor_c, FLOOR_BRIDGE, x, -1.0, z);
+        break;
+    case TILE_FRAGILE_BRIDGE:
+        createFloor(floor_v, floor_c, FLOOR_FRAG, x, -1.0, z);
+        break;
+    case TILE_GOAL:
+        createFloor(floor_v, floor_c, FLOOR_GOAL, x, -1.0, z);
+        break;
+    case TILE_CRUMBLE:
+        createFloor(floor_v, floor_c, FLOOR_CRUMBLE, x, -1.0, z);
+        break;
+    case TILE_TELEPORT:
+        createFloor(floor_v, floor_c, FLOOR_TELEPORT, x, -1.0, z);
+        break;
     }
-    for(i=72;i<108;i++)
+}
+
+void buildLevelMesh(const SimLevel *sim, const SimState *s, LevelMesh *mesh)
+{
+    const Level *lvl = sim->level;
+    size_t floats = (size_t) lvl->size_x*lvl->size_z*TILE_FLOATS;
+    mesh->floor_vertices.assign(floats, 0);
+    mesh->floor_colors.assign(floats, 0);
+
+    int i,j;
+    for(i=0;i<lvl->size_x;i++)
+        for(j=0;j<lvl->size_z;j++)
+            buildTile(sim, s, i, j, mesh);
+}
+
+// Levels built into the game, used when their files are missing (format in level.h).
+// They are compiled to the packed layout and checked by the compiler.
+constexpr char builtin_level1_rows[][11] = {
+    "S.........",
+    "o.........",
+    "o.........",
+    "ofob==oooG",
+    "..........",
+    "..........",
+    "..........",
+    "..........",
+    "..........",
+    "..........",
+};
+constexpr auto builtin_level1 = STATIC_LEVEL(builtin_level1_rows);
+CHECK_STATIC_LEVEL(builtin_level1_rows, builtin_level1);
+
+constexpr char builtin_level2_rows[][11] = {
+    "Soooo.....",
+    "oooooo....",
+    "offoo.....",
+    "oooooobo..",
+    "....===o..",
+    "..oooooo..",
+    "...ooooooo",
+    "..oooooooo",
+    ".....oxxGo",
+    ".....ooooo",
+};
+constexpr auto builtin_level2 = STATIC_LEVEL(builtin_level2_rows);
+CHECK_STATIC_LEVEL(builtin_level2_rows, builtin_level2);
+
+// Work that has to run on the thread owning the GL context
+mutex gl_tasks_mutex;
+condition_variable gl_tasks_cond;
+vector< function<void()> > gl_tasks;
+
+void postGLTask(function<void()> task)
+{
+    lock_guard<mutex> lock(gl_tasks_mutex);
+    gl_tasks.push_back(task);
+    gl_tasks_cond.notify_one();
+}
+
+void runGLTasks(int wait)
+{
+    vector< function<void()> > tasks;
     {
-        color_buffer_data[i]=(float)211/255;
+        unique_lock<mutex> lock(gl_tasks_mutex);
+        if(wait)
+            gl_tasks_cond.wait(lock, []{ return !gl_tasks.empty(); });
+        tasks.swap(gl_tasks);
     }
+    for(size_t i = 0; i < tasks.size(); i++)
+        tasks[i]();
+}
 
+// A level with everything needed to play it; only the current one and the prefetched next one are resident
+struct LevelSlot {
+    int number;
+    Level level;
+    SimLevel sim;  // level prepared for block_shape
+    LevelMesh mesh;
+    VAO *floor;  // NULL until uploaded
+
+    // Moves to the goal from every state, built in the background once the level is loaded
+    DistanceTable hints;
+    thread hint_builder;
+    atomic<bool> hints_ready, hints_cancel;
+    atomic<bool> hints_failed;  // the level has too many states for a table
+};
 
-    // create3DObject creates and returns a handle to a VAO that can be used later
-    rectangle = create3DObject(GL_TRIANGLES, 12*3, vertex_buffer_data, color_buffer_data, GL_FILL);
-    Sprite prsprite={};
-    prsprite.name=name;
-    prsprite.status=1;
-    prsprite.object = rectangle;
-    cube[name]=prsprite;
+// Par and one shortest solution from the distance table, walking down it from the start
+void storeSolution(LevelSlot *slot, uint64_t key)
+{
+    SolveResult r;
+    SimState s;
+    sim_start(&slot->sim, &s);
+    int left = distance_to_goal(&slot->hints, &s);
+    r.moves = left == DIST_DEAD ? -1 : left;
+    for(; r.moves > 0 && left > 0; left--)
+        for(int m = 0; m < MOVE_COUNT; m++)
+        {
+            SimState next;
+            int result = sim_step(&slot->sim, &s, m, &next);
+            if((result & SIM_WON) || (!(result & SIM_FELL) && distance_to_goal(&slot->hints, &next) == left - 1))
+            {
+                r.path.push_back(m);
+                s = next;
+                break;
+            }
+        }
+    // Not a search, so none of a solver's figures
+    r.expanded = r.visited = r.memory = r.spilled = 0;
+    r.seconds = 0;
+    solcache_store(solutions, key, &r);
+    printf("par: level %d, %d moves, kept in %s\n", slot->number, r.moves, solutions_file);
 }
 
+// Any thread that owns the slot: build its distance table in the background
+void startHints(LevelSlot *slot)
+{
+    slot->hints_ready.store(false);
+    slot->hints_cancel.store(false);
+    slot->hints_failed.store(false);
+    slot->hint_builder = thread([slot]{
+        // A level played before has its par straight away
+        uint64_t key = solcache_key(&slot->level, &block_shape);
+        SolveResult par;
+        int cached = solutions && solcache_find(solutions, key, &par);
+        if(cached)
+            printf("par: level %d, %d moves, from %s\n", slot->number, par.moves, solutions_file);
+        if(!solve_distances(&slot->sim, &slot->hints, &slot->hints_cancel))
+        {
+            if(!slot->hints_cancel.load())
+            {
+                printf("hints: level %d has too many states for a distance table\n", slot->number);
+                slot->hints_failed.store(true);
+            }
+            return;
+        }
+        printf("hints: level %d, %llu states (%llu dead), %zu bytes, built in %.2f ms\n", slot->number,
+               (unsigned long long) slot->hints.supported, (unsigned long long) slot->hints.dead,
+               slot->hints.dist.size() * sizeof(uint16_t), slot->hints.seconds * 1e3);
+        if(!cached && solutions)
+            storeSolution(slot, key);
+        slot->hints_ready.store(true, memory_order_release);
+    });
+}
 
-void createRectangle2 (string name) 
+void stopHints(LevelSlot *slot)
 {
-    static const GLfloat vertex_buffer_data [] = {
-	-0.5, -1, 1.5,
-	0.5, -1, 1.5, 
-	0.5, -1, -0.5,
-	-0.5, -1, 1.5, 
-	-0.5, -1, -0.5,
-	0.5, -1, -0.5,
-	0.5, 0, 1.5,
-	0.5, 0, -0.5,
-	0.5, -1, -0.5,
-	0.5, 0, 1.5,
-	0.5, -1, 1.5,
-	0.5, -1, -0.5,
-	-0.5, 0, 1.5,
-	0.5, 0, 1.5,
-    0.5, 0, -0.5,
-	-0.5, 0, 1.5,
-	-0.5, 0, -0.5,
-	0.5, 0, -0.5,
-	-0.5, 0, 1.5,
-	-0.5, 0, -0.5,
-	-0.5, -1, -0.5, 
-	-0.5, 0, 1.5,
-	-0.5, -1, 1.5, 
-	-0.5, -1, -0.5, 
-	-0.5, 0, 1.5,
-	0.5, 0, 1.5, 
-	0.5, -1, 1.5,
-	-0.5, 0, 1.5,
-	-0.5, -1, 1.5,
-	0.5, -1, 1.5,
-	-0.5, 0, -0.5,
-	0.5, 0, -0.5,
-	0.5, -1, -0.5,
-	-0.5, 0, -0.5, 
-	-0.5, -1, -0.5,
-	0.5, -1, -0.5,
-    };
+    slot->hints_cancel.store(true);
+    if(slot->hint_builder.joinable())
+        slot->hint_builder.join();
+    slot->hints_ready.store(false);
+}
 
-    GLfloat color_buffer_data [] = {
-	1.0f, 1.0f, 0.0f,
-	1.0f, 1.0f, 0.0f,
-	1.0f, 1.0f, 0.0f,
-	1.0f, 1.0f, 0.0f,
-	1.0f, 1.0f, 0.0f,
-	1.0f, 1.0f, 0.0f,
-	1.0f, 0.0f, 1.0f,
-	1.0f, 0.0f, 1.0f,
-	1.0f, 0.0f, 1.0f,
-	1.0f, 0.0f, 1.0f,
-	1.0f, 0.0f, 1.0f,
-	1.0f, 0.0f, 1.0f,
-	0.0f, 1.0f, 1.0f,
-	0.0f, 1.0f, 1.0f,
-	0.0f, 1.0f, 1.0f,
-	0.0f, 1.0f, 1.0f,
-	0.0f, 1.0f, 1.0f,
-	0.0f, 1.0f, 1.0f,
-	1.0f, 0.0f, 0.0f,
-	1.0f, 0.0f, 0.0f,
-	1.0f, 0.0f, 0.0f,
-	1.0f, 0.0f, 0.0f,
-	1.0f, 0.0f, 0.0f,
-	1.0f, 0.0f, 0.0f,
-	0.0f, 1.0f, 0.0f,	
-	0.0f, 1.0f, 0.0f,	
-	0.0f, 1.0f, 0.0f,	
-	0.0f, 1.0f, 0.0f,	
-	0.0f, 1.0f, 0.0f,	
-	0.0f, 1.0f, 0.0f,	
-	0.0f, 0.0f, 1.0f,
-	0.0f, 0.0f, 1.0f,
-	0.0f, 0.0f, 1.0f,
-	0.0f, 0.0f, 1.0f,
-	0.0f, 0.0f, 1.0f,
-	0.0f, 0.0f, 1.0f,
-    };
-    int i,j;
-    for(i=24;i<36;i++)
-        for(j=0;j<3;j++)
-            color_buffer_data[3*i + j]=(float)211/255;
-    for(i=0;i<24;i++)
-        for(j=0;j<3;j++)
-            color_buffer_data[3*i+j]=(float)105/255;
-    rectangle2 = create3DObject(GL_TRIANGLES, 12*3, vertex_buffer_data, color_buffer_data, GL_FILL);
-    Sprite prsprite={};
-    prsprite.name=name;
-    prsprite.status=0;
-    prsprite.object = rectangle;
-    cube[name]=prsprite;
+LevelSlot *current_level, *next_level;
+int next_level_state;   // 0 still loading, 1 ready, -1 there is no such level
+
+// Moves left to the goal from the block's state, -1 while the table is being built or if there is none
+int hintDistance(const SimState *s)
+{
+    if(!current_level->hints_ready.load(memory_order_acquire))
+        return -1;
+    return distance_to_goal(&current_level->hints, s);
 }
 
-void createRectangle3 (string name) 
+Journal journal;  // moves on the current level, for undo and redo
+#define JOURNAL_BYTES (64 << 10)
+
+void reportJournal()
 {
-    static const GLfloat vertex_buffer_data [] = {
-	1.5,0, 0.5,
-	1.5, -1, 0.5, 
-	-0.5, -1, 0.5,
-	1.5, 0, 0.5, 
-	-0.5, 0, 0.5,
-	-0.5, -1, 0.5,
-	1.5, -1, 0.5,
-	1.5, -1, -0.5,
-	-0.5, -1, -0.5,
-	1.5, -1, 0.5,
-	-0.5, -1, 0.5,
-	-0.5, -1, -0.5,
-	-0.5, 0, -0.5,
-	1.5, 0, -0.5,
-        1.5, -1, -0.5,
-	-0.5, 0, -0.5,
-	-0.5, -1, -0.5,
-	1.5, -1, -0.5,
-	1.5, 0, 0.5,
-	1.5, 0, -0.5,
-	-0.5, 0, -0.5, 
-	1.5, 0, 0.5,
-	-0.5, 0, 0.5, 
-	-0.5, 0, -0.5, 
-	1.5, 0, 0.5,
-	1.5, 0, -0.5, 
-	1.5, -1,-0.5,
-	1.5, 0, 0.5,
-	1.5, -1, 0.5,
-	1.5, -1, -0.5,
-	-0.5, 0, 0.5,
-	-0.5, 0, -0.5,
-	-0.5, -1, -0.5,
-	-0.5, 0, 0.5, 
-	-0.5, -1, 0.5,
-	-0.5, -1, -0.5,
-    };
+    int moves = journal.undo_moves + journal.redo_moves;
+    if(current_level && moves > 0)
+        printf("journal: level %d, %d moves in %zu bytes, %.0f bytes per 1000 moves\n", current_level->number,
+               moves, journal_bytes(&journal), journal_bytes(&journal) * 1000.0 / moves);
+}
 
-    GLfloat color_buffer_data [] = {
-	1.0f, 1.0f, 0.0f,
-	1.0f, 1.0f, 0.0f,
-	1.0f, 1.0f, 0.0f,
-	1.0f, 1.0f, 0.0f,
-	1.0f, 1.0f, 0.0f,
-	1.0f, 1.0f, 0.0f,
-	1.0f, 0.0f, 1.0f,
-	1.0f, 0.0f, 1.0f,
-	1.0f, 0.0f, 1.0f,
-	1.0f, 0.0f, 1.0f,
-	1.0f, 0.0f, 1.0f,
-	1.0f, 0.0f, 1.0f,
-	0.0f, 1.0f, 1.0f,
-	0.0f, 1.0f, 1.0f,
-	0.0f, 1.0f, 1.0f,
-	0.0f, 1.0f, 1.0f,
-	0.0f, 1.0f, 1.0f,
-	0.0f, 1.0f, 1.0f,
-	1.0f, 0.0f, 0.0f,
-	1.0f, 0.0f, 0.0f,
-	1.0f, 0.0f, 0.0f,
-	1.0f, 0.0f, 0.0f,
-	1.0f, 0.0f, 0.0f,
-	1.0f, 0.0f, 0.0f,
-	0.0f, 1.0f, 0.0f,	
-	0.0f, 1.0f, 0.0f,	
-	0.0f, 1.0f, 0.0f,	
-	0.0f, 1.0f, 0.0f,	
-	0.0f, 1.0f, 0.0f,	
-	0.0f, 1.0f, 0.0f,	
-	0.0f, 0.0f, 1.0f,
-	0.0f, 0.0f, 1.0f,
-	0.0f, 0.0f, 1.0f,
-	0.0f, 0.0f, 1.0f,
-	0.0f, 0.0f, 1.0f,
-	0.0f, 0.0f, 1.0f,
-    };
-    int i,j;
-    for(i=24;i<36;i++)
-        for(j=0;j<3;j++)
-            color_buffer_data[3*i + j]=(float)211/255;
-    for(i=0;i<24;i++)
-        for(j=0;j<3;j++)
-            color_buffer_data[3*i+j]=(float)105/255;
-
-    rectangle3 = create3DObject(GL_TRIANGLES, 12*3, vertex_buffer_data, color_buffer_data, GL_FILL);
-    Sprite prsprite={};
-    prsprite.name=name;
-    prsprite.status=0;
-    prsprite.object = rectangle;
-    cube[name]=prsprite;
+// Built-in level n (1 or 2), no copy or parsing
+void builtinLevel(int n, Level *lvl)
+{
+    if(n == 1)
+        level_from_static(builtin_level1, lvl);
+    else
+        level_from_static(builtin_level2, lvl);
 }
 
-void createFloor(string name, float x,float y,float z)
+LevelPack *level_pack;  // --pack, NULL to play loose level files
+
+// Take level n from the pack when it has it, else levels/<n>.lvl if it was
+// compiled with tools/levelc, otherwise levels/<n>.txt.
+// Returns 0 if none exists (*found = 0) or the level is not usable.
+int readLevelFile(int n, Level *lvl, int *found)
 {
+    if(level_pack && pack_has_level(level_pack, n))
+    {
+        *found = 1;
+        PackLoadStats stats;
+        if(!pack_load(level_pack, n, lvl, &stats))
+            return 0;
+        printf("level: %d from pack, lookup %.3f ms, decompress %.3f ms (%zu -> %zu bytes)\n", n,
+               stats.lookup_ms, stats.decompress_ms, stats.compressed_size, stats.size);
+        return 1;
+    }
 
-    static const GLfloat vertex_buffer_data [] = {
-        (float)(x-0.5),y,(float)(z+0.5),
-        (float)(x+0.5),y,(float)(z+0.5),
-        (float)(x+0.5),y,(float)(z-0.5),
-        (float)(x-0.5),y,(float)(z+0.5),
-        (float)(x-0.5),y,(float)(z-0.5),
-        (float)(x+0.5),y,(float)(z-0.5),        
-    };
+    char path[64];
+    snprintf(path, sizeof(path), "levels/%d.lvl", n);
+    *found = 1;
+    if(access(path, F_OK) == 0)
+        return level_map(path, lvl);
+    snprintf(path, sizeof(path), "levels/%d.txt", n);
+    if(access(path, F_OK) == 0)
+        return level_load(path, lvl);
+    *found = 0;
+    return 0;
+}
 
-    if(name=="normal")
+// Worker thread: load level n (or fall back to the builtin tables) and build its mesh
+LevelSlot* loadLevel(int n)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    LevelSlot *slot = new LevelSlot();
+    slot->number = n;
+    int found;
+    if(!readLevelFile(n, &slot->level, &found) || !sim_prepare(&slot->sim, &slot->level, &block_shape))
     {
-        GLfloat color_buffer_data [] = {
-            0.65, 0.165, 0.165,
-            0.65, 0.165, 0.165,
-            0.65, 0.165, 0.165,
-            0.55, 0.165, 0.165,
-            0.55, 0.165, 0.165,
-            0.55, 0.165, 0.165,
-        };
-        floor_vao = create3DObject(GL_TRIANGLES, 2*3, vertex_buffer_data, color_buffer_data, GL_FILL);
+        if(!found && n > 2)
+        {
+            delete slot;
+            return NULL;
+        }
+        fprintf(stderr, "level %d: no usable file, using builtin level\n", n);
+        builtinLevel(n, &slot->level);
+        sim_prepare(&slot->sim, &slot->level, &block_shape);
     }
-    else if(name=="frag")
+    chrono::steady_clock::time_point loaded = chrono::steady_clock::now();
+    // Meshed as the level starts, switchLevel() puts the block in the start state
+    SimState initial;
+    sim_start(&slot->sim, &initial);
+    buildLevelMesh(&slot->sim, &initial, &slot->mesh);
+    chrono::steady_clock::time_point meshed = chrono::steady_clock::now();
+    printf("level: %d loaded in %.3f ms, meshed in %.2f ms\n", n,
+           chrono::duration<double, milli>(loaded - start).count(),
+           chrono::duration<double, milli>(meshed - loaded).count());
+    startHints(slot);
+    return slot;
+}
+
+// GL thread
+void uploadLevel(LevelSlot *slot)
+{
+    LevelMesh &mesh = slot->mesh;
+    slot->floor = create3DObject(GL_TRIANGLES, mesh.floor_vertices.size()/3, mesh.floor_vertices.data(), mesh.floor_colors.data(), GL_FILL);
+}
+
+// GL thread
+void freeLevel(LevelSlot *slot)
+{
+    stopHints(slot);
+    if(slot->floor)
+        delete3DObject(slot->floor);
+    delete slot;
+}
+
+// GL thread: start loading level n in the background, it becomes next_level once uploaded
+void prefetchLevel(int n)
+{
+    if(level_loader.joinable())
+        level_loader.join();
+    next_level = NULL;
+    next_level_state = 0;
+    level_loader = thread([n]{
+        LevelSlot *slot = loadLevel(n);
+        postGLTask([slot]{
+            if(slot)
+            {
+                uploadLevel(slot);
+                next_level = slot;
+                next_level_state = 1;
+            }
+            else
+                next_level_state = -1;
+        });
+    });
+}
+
+// GL thread: swap in the prefetched level, evict the old one and prefetch the one after.
+// Only waits if the prefetch has not finished yet. Returns 0 when there is no next level.
+int switchLevel()
+{
+    while(next_level_state == 0)
+        runGLTasks(1);
+    if(next_level_state < 0)
+        return 0;
+
+    reportJournal();
+    journal_clear(&journal);
+    LevelSlot *previous = current_level;
+    current_level = next_level;
+    session->level = current_level->number;
+    if(previous)
+        postGLTask([previous]{ freeLevel(previous); });
+
+    sim_start(&current_level->sim, &session->block);
+    session->level_start_score = session->score;
+
+    prefetchLevel(session->level + 1);
+    return 1;
+}
+
+// Rewrite tiles [first, first+count) of the uploaded mesh
+void updateTiles(LevelSlot *slot, int first, int count)
+{
+    GLintptr offset = first*TILE_FLOATS*sizeof(GLfloat);
+    GLsizeiptr size = count*TILE_FLOATS*sizeof(GLfloat);
+    int index = first*TILE_FLOATS;
+    LevelMesh &mesh = slot->mesh;
+
+    glBindBuffer(GL_ARRAY_BUFFER, slot->floor->VertexBuffer);
+    glBufferSubData(GL_ARRAY_BUFFER, offset, size, &mesh.floor_vertices[index]);
+    glBindBuffer(GL_ARRAY_BUFFER, slot->floor->ColorBuffer);
+    glBufferSubData(GL_ARRAY_BUFFER, offset, size, &mesh.floor_colors[index]);
+}
+
+// GL thread: rebuild the dirty tiles (i*size_z + j, in any order, repeats allowed)
+// as they look in state s and upload them
+void refreshTiles(LevelSlot *slot, const SimState *s, vector<int> &dirty)
+{
+    sort(dirty.begin(), dirty.end());
+    dirty.erase(unique(dirty.begin(), dirty.end()), dirty.end());
+    int size_z = slot->level.size_z;
+    for(size_t k = 0; k < dirty.size(); k++)
+        buildTile(&slot->sim, s, dirty[k] / size_z, dirty[k] % size_z, &slot->mesh);
+
+    // Neighbouring tiles share one glBufferSubData call
+    for(size_t k = 0; k < dirty.size(); )
     {
-        GLfloat color_buffer_data [] = {
-            1, 1, 0,
-            1, 1, 0,
-            1, 1, 0,
-            1, 0.8, 0,
-            1, 0.8, 0,
-            1, 0.8, 0,
-        };
-        floor_vao = create3DObject(GL_TRIANGLES, 2*3, vertex_buffer_data, color_buffer_data, GL_FILL);
+        size_t end = k + 1;
+        while(end < dirty.size() && dirty[end] == dirty[end-1] + 1)
+            end++;
+        updateTiles(slot, dirty[k], end - k);
+        k = end;
+    }
+}
 
+// Same switches, links and timers
+int sameLinks(const Level *a, const Level *b)
+{
+    return a->num_switches == b->num_switches && a->num_links == b->num_links &&
+           memcmp(a->switches, b->switches, a->num_switches*sizeof(LevelSwitch)) == 0 &&
+           memcmp(a->links, b->links, a->num_links*sizeof(uint32_t)) == 0;
+}
+
+// GL thread: replace a resident level with a freshly loaded version of it,
+// re-uploading only the tiles that differ
+void reloadLevel(int n, Level *lvl)
+{
+    LevelSlot *slot = NULL;
+    if(current_level && current_level->number == n)
+        slot = current_level;
+    else if(next_level && next_level->number == n)
+        slot = next_level;
+    if(slot == NULL)
+    {
+        delete lvl;
+        return;
     }
-    else if(name=="bridge")
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    SimLevel sim;
+    if(!sim_prepare(&sim, lvl, &block_shape))
     {
+        fprintf(stderr, "level: reload of %d rejected\n", n);
+        delete lvl;
+        return;
+    }
 
-        GLfloat color_buffer_data [] = {
-            0, 1, 1,
-            0, 1, 1,
-            0, 1, 1,
-            0, 1, 0.7,
-            0, 1, 0.7,
-            0, 1, 0.7,
-        };
-        floor_vao = create3DObject(GL_TRIANGLES, 2*3, vertex_buffer_data, color_buffer_data, GL_FILL);
+    // The block state only carries over while its switch and crumble bits still
+    // mean the same tiles
+    stopHints(slot);
+    Level *old = &slot->level;
+    int resized = old->size_x != lvl->size_x || old->size_z != lvl->size_z;
+    int same_state = !resized && sameLinks(old, lvl) && sim.crumble_tiles == slot->sim.crumble_tiles;
+    vector<int> changed;
+    if(!resized)
+        for(int i = 0; i < lvl->size_x; i++)
+            for(int j = 0; j < lvl->size_z; j++)
+                if(level_tile(old, i, j) != level_tile(lvl, i, j))
+                    changed.push_back(i*lvl->size_z + j);
+    slot->level = *lvl;
+    delete lvl;
+    slot->sim = sim;
+    slot->sim.level = &slot->level;
+
+    int kept = 1;
+    if(slot == current_level && (!same_state || !sim_supported(&slot->sim, &session->block)))
+    {
+        sim_start(&slot->sim, &session->block);
+        session->score = session->level_start_score;
+        kept = 0;
     }
-    else if(name=="bridgebutton")
+    // Undo could lead onto tiles that are gone
+    if(slot == current_level)
+        journal_clear(&journal);
+    startHints(slot);
+    SimState initial;
+    sim_start(&slot->sim, &initial);
+    const SimState *shown = slot == current_level ? &session->block : &initial;
+
+    if(resized)
     {
-
-        GLfloat color_buffer_data [] = {
-            0, 0, 1,
-            0, 0, 1,
-            0, 0, 1,
-            0, 0, 0.8,
-            0, 0, 0.8,
-            0, 0, 0.8,
-        };
-        floor_vao = create3DObject(GL_TRIANGLES, 2*3, vertex_buffer_data, color_buffer_data, GL_FILL);
+        // Nothing to diff against, rebuild the whole mesh
+        buildLevelMesh(&slot->sim, shown, &slot->mesh);
+        delete3DObject(slot->floor);
+        uploadLevel(slot);
+        changed.resize(slot->level.size_x*slot->level.size_z);
     }
-    else if(name=="goal")
+    else if(!same_state)
     {
-
-        GLfloat color_buffer_data [] = {
-            0, 1, 0.5,
-            0, 1, 0.5,
-            0, 1, 0.5,
-            0, 1, 0.3,
-            0, 1, 0.3,
-            0, 1, 0.3,
-        };
-        floor_vao = create3DObject(GL_TRIANGLES, 2*3, vertex_buffer_data, color_buffer_data, GL_FILL);
+        buildLevelMesh(&slot->sim, shown, &slot->mesh);
+        changed.resize(slot->level.size_x*slot->level.size_z);
+        updateTiles(slot, 0, changed.size());
     }
+    else
+        refreshTiles(slot, shown, changed);
 
-
-    Sprite prsprite={};
-    prsprite.name=name;
-    prsprite.x=x;
-    prsprite.y=y;
-    prsprite.z=z;
-    prsprite.object=floor_vao;
-    normals[name]=prsprite;
+    printf("level: reloaded %d, %d tiles changed, block %s, %.2f ms\n", n, (int) changed.size(),
+           kept ? "kept" : "reset", chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
 }
 
-float camera_rotation_angle = 90;
-
-int normal_pos[10][10]={
-    {1,0,0,0,0,0,0,0,0,0},
-    {1,0,0,0,0,0,0,0,0,0},
-    {1,0,0,0,0,0,0,0,0,0},
-    {1,1,1,2,1,1,1,1,1,0},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-};
-int goal_normal[10][10]={
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,1},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-};
-int frag_normal[10][10]={
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,1,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-};
-int bridge_normal[10][10]={
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,1,1,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-};
+// Watcher thread: reload level n whenever levels/<n>.lvl or levels/<n>.txt is written
+void watchLevels()
+{
+    int fd = inotify_init1(IN_NONBLOCK);
+    if(fd < 0 || inotify_add_watch(fd, "levels", IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+    {
+        fprintf(stderr, "level: cannot watch levels/, hot reload disabled\n");
+        if(fd >= 0)
+            close(fd);
+        return;
+    }
 
-int normal_pos2[10][10]={
-    {1,1,1,1,1,0,0,0,0,0},
-    {1,1,1,1,1,1,0,0,0,0},
-    {1,1,1,1,1,0,0,0,0,0},
-    {1,1,1,1,1,1,2,1,0,0},
-    {0,0,0,0,1,1,1,1,0,0},
-    {0,0,1,1,1,1,1,1,0,0},
-    {0,0,0,1,1,1,1,1,1,1},
-    {0,0,1,1,1,1,1,1,1,1},
-    {0,0,0,0,0,1,1,1,0,1},
-    {0,0,0,0,0,1,1,1,1,1},
-};
-int goal_normal2[10][10]={
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,1,0},
-    {0,0,0,0,0,0,0,0,0,0},
-};
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    while(watching_levels.load())
+    {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        if(poll(&pfd, 1, 100) <= 0)
+            continue;
+        ssize_t len = read(fd, buf, sizeof(buf));
+        for(char *p = buf; len > 0 && p < buf + len; )
+        {
+            struct inotify_event *event = (struct inotify_event*) p;
+            p += sizeof(struct inotify_event) + event->len;
+
+            char *end;
+            long n = event->len ? strtol(event->name, &end, 10) : 0;
+            if(n <= 0 || end == event->name || (strcmp(end, ".txt") != 0 && strcmp(end, ".lvl") != 0))
+                continue;
+
+            // readLevelFile() picks the compiled file over the text one, like loadLevel()
+            int found;
+            Level *lvl = new Level;
+            if(readLevelFile(n, lvl, &found))
+                postGLTask([n, lvl]{ reloadLevel(n, lvl); });
+            else
+                delete lvl;
+        }
+    }
+    close(fd);
+}
 
-int frag_normal2[10][10]={
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,1,1,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,1,1,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-};
+void stopLevelThreads()
+{
+    watching_levels.store(false);
+    if(level_watcher.joinable())
+        level_watcher.join();
+    if(level_loader.joinable())
+        level_loader.join();
+    if(current_level)
+        stopHints(current_level);
+    if(next_level)
+        stopHints(next_level);
+    pack_close(level_pack);
+    level_pack = NULL;
+}
 
-int bridge_normal2[10][10]={
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,1,1,1,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,1,1,0,0},
-    {0,0,0,0,0,0,0,0,0,0},
+// Lit segments per digit, bit n is segment n of the digit (SEG_UP1 order)
+#define SEG(n) (1 << (SEG_##n##1 - SEG_UP1))
+const int digit_segments[10] = {
+    SEG(UP)|SEG(UL)|SEG(UR)|SEG(BL)|SEG(BR)|SEG(BT),          // 0
+    SEG(UR)|SEG(BR),                                          // 1
+    SEG(UP)|SEG(UR)|SEG(CN)|SEG(BL)|SEG(BT),                  // 2
+    SEG(UP)|SEG(UR)|SEG(CN)|SEG(BR)|SEG(BT),                  // 3
+    SEG(UL)|SEG(UR)|SEG(CN)|SEG(BR),                          // 4
+    SEG(UP)|SEG(UL)|SEG(CN)|SEG(BR)|SEG(BT),                  // 5
+    SEG(UP)|SEG(UL)|SEG(CN)|SEG(BL)|SEG(BR)|SEG(BT),          // 6
+    SEG(UP)|SEG(UR)|SEG(BR),                                  // 7
+    SEG(UP)|SEG(UL)|SEG(UR)|SEG(CN)|SEG(BL)|SEG(BR)|SEG(BT),  // 8
+    SEG(UP)|SEG(UL)|SEG(UR)|SEG(CN)|SEG(BR)|SEG(BT),          // 9
 };
+#undef SEG
 
 void lightitup(int sc,int bit)
 {
-    if(bit==0)
-    {
-        scoreboard["up1"].status=0;
-        scoreboard["cn1"].status=0;
-        scoreboard["bt1"].status=0;
-        scoreboard["ul1"].status=0;
-        scoreboard["ur1"].status=0;
-        scoreboard["br1"].status=0;
-        scoreboard["bl1"].status=0;
-        if(sc==2 || sc==3 || sc ==5 ||sc ==6 || sc ==7||sc ==8||sc==9||sc==0)
-            scoreboard["up1"].status=1;
-        if(sc==2||sc==3||sc==4||sc==5||sc==6||sc==8||sc==9)
-            scoreboard["cn1"].status=1;
-        if(sc==2||sc==3||sc==5||sc==6||sc==8||sc==9||sc==0)
-            scoreboard["bt1"].status=1;
-        if(sc==4||sc==5||sc==6||sc==8||sc==9||sc==0)
-            scoreboard["ul1"].status=1;
-        if(sc==1||sc==2||sc==3||sc==4||sc==7||sc==8||sc==9||sc==0)
-            scoreboard["ur1"].status=1;
-        if(sc==2||sc==6||sc==8||sc==0)
-            scoreboard["bl1"].status=1;
-        if(sc==1||sc==3||sc==4||sc==5|sc==6||sc==7||sc==8||sc==9||sc==0)
-            scoreboard["br1"].status=1;
-    }
-    else if(bit==1)
-    {
-        scoreboard["up2"].status=0;
-        scoreboard["cn2"].status=0;
-        scoreboard["bt2"].status=0;
-        scoreboard["ul2"].status=0;
-        scoreboard["ur2"].status=0;
-        scoreboard["br2"].status=0;
-        scoreboard["bl2"].status=0;
-        if(sc==2 || sc==3 || sc ==5 ||sc ==6 || sc ==7||sc ==8||sc==9||sc==0)
-            scoreboard["up2"].status=1;
-        if(sc==2||sc==3||sc==4||sc==5||sc==6||sc==8||sc==9)
-            scoreboard["cn2"].status=1;
-        if(sc==2||sc==3||sc==5||sc==6||sc==8||sc==9||sc==0)
-            scoreboard["bt2"].status=1;
-        if(sc==4||sc==5||sc==6||sc==8||sc==9||sc==0)
-            scoreboard["ul2"].status=1;
-        if(sc==1||sc==2||sc==3||sc==4||sc==7||sc==8||sc==9||sc==0)
-            scoreboard["ur2"].status=1;
-        if(sc==2||sc==6||sc==8||sc==0)
-            scoreboard["bl2"].status=1;
-        if(sc==1||sc==3||sc==4||sc==5|sc==6||sc==7||sc==8||sc==9||sc==0)
-            scoreboard["br2"].status=1;
-    }
+    int mask = (sc >= 0 && sc < 10) ? digit_segments[sc] : 0;
+    Sprite *digit = &scoreboard[bit * SEGS_PER_DIGIT];
+    for(int i=0;i<SEGS_PER_DIGIT;i++)
+        digit[i].status = (mask >> i) & 1;
 }
 
 void createScore (string name, float x,float y, float height, float width)
@@ -882,19 +1111,83 @@ void createScore (string name, float x,float y, float height, float width)
         1,1,1,  
     };
 
-    scorerectangle = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
-    Sprite prsprite={};
-    prsprite.name=name;
+    Sprite &prsprite = scoreboard[spriteIndex(segment_names, SEG_COUNT, name)];
     prsprite.x=x;
     prsprite.y=y;
     prsprite.status=1;
-    prsprite.object=scorerectangle;
-    scoreboard[name]=prsprite;
+    prsprite.object=create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
 }
 
 
-int bridge_stat=0, score=0, score2=0;
+// GL thread: bring the mesh from state before to the block's state. Only the
+// tiles that were switched, crumbled or restored are uploaded.
+void showTiles(const SimState *before)
+{
+    vector<int> dirty;
+    sim_changed_tiles(&current_level->sim, before, &session->block, &dirty);
+    for(size_t k = 0; k < dirty.size(); k++)
+    {
+        int x, z;
+        level_coords(&current_level->level, dirty[k], &x, &z);
+        dirty[k] = x*current_level->level.size_z + z;
+    }
+    if(!dirty.empty())
+        refreshTiles(current_level, &session->block, dirty);
+}
 
+// GL thread: the block went from before to the current state by a move, an
+// undo or a redo; result has the sim_step() flags
+void showMove(const SimState *before, int result)
+{
+    session->score = session->level_start_score + session->block.moves;
+    showTiles(before);
+    if(!(result & SIM_WON) && hintDistance(&session->block) == DIST_DEAD)
+        printf("hint: the goal cannot be reached from here any more, press u to undo\n");
+
+    audio_trigger(SFX_MOVE);
+    if(result & SIM_TOGGLED)
+        audio_trigger(SFX_BRIDGE);
+    if(result & SIM_FELL)
+        audio_trigger(SFX_FALL);
+    if(result & SIM_WON)
+    {
+        audio_trigger(SFX_WIN);
+        if(!switchLevel())
+            win=2;
+    }
+}
+
+// The move that gets closest to the goal, one table lookup per move
+void showHint()
+{
+    static const char keys[MOVE_COUNT] = { 'w', 'a', 's', 'd' };
+    int left = hintDistance(&session->block);
+    if(left < 0 && current_level->hints_failed.load())
+    {
+        printf("hint: this level is too big for hints\n");
+        return;
+    }
+    if(left < 0)
+    {
+        printf("hint: still working it out\n");
+        return;
+    }
+    if(left == DIST_DEAD)
+    {
+        printf("hint: the goal cannot be reached from here any more, press u to undo\n");
+        return;
+    }
+    for(int m = 0; m < MOVE_COUNT; m++)
+    {
+        SimState next;
+        int result = sim_step(&current_level->sim, &session->block, m, &next);
+        if((result & SIM_WON) || (!(result & SIM_FELL) && distance_to_goal(&current_level->hints, &next) == left - 1))
+        {
+            printf("hint: press %c, %d move%s to the goal\n", keys[m], left, left == 1 ? "" : "s");
+            return;
+        }
+    }
+}
 
 void draw (GLFWwindow* window, float x, float y, float w, float h,int t)
 {
@@ -926,21 +1219,21 @@ void draw (GLFWwindow* window, float x, float y, float w, float h,int t)
         // Load identity to model matrix
         Matrices.model = glm::mat4(1.0f);
 
-        lightitup(level,0);
+        lightitup(session->level,0);
         lightitup(0,1);
-        for(map<string,Sprite>::iterator it=scoreboard.begin();it!=scoreboard.end();it++)
+        for(int i=0;i<SEG_COUNT;i++)
         {
-            string current = it->first;
+            const Sprite &segment = scoreboard[i];
             glm::mat4 translateRectangle;
             Matrices.model = glm::mat4(1.0f);
 
-            if(scoreboard[current].status==1)
+            if(segment.status==1)
             {
-                translateRectangle = glm::translate (glm::vec3(scoreboard[current].x,scoreboard[current].y,0.0));
+                translateRectangle = glm::translate (glm::vec3(segment.x,segment.y,0.0));
                 Matrices.model *= translateRectangle;
                 MVP = VP * Matrices.model;
                 glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-                draw3DObject(scoreboard[current].object);
+                draw3DObject(segment.object);
             }
         }
     }
@@ -968,29 +1261,21 @@ void draw (GLFWwindow* window, float x, float y, float w, float h,int t)
         // Load identity to model matrix
         Matrices.model = glm::mat4(1.0f);
 
-        if(level==1)
-        {
-            lightitup(score%10,0);  //Ones digit
-            lightitup(score/10,1); //Tens digit
-        }
-        else if(level==2)
+        lightitup(session->score%10,0);  //Ones digit
+        lightitup(session->score/10,1); //Tens digit
+        for(int i=0;i<SEG_COUNT;i++)
         {
-            lightitup(score2%10,0);
-            lightitup(score2/10,1);
-        }
-        for(map<string,Sprite>::iterator it=scoreboard.begin();it!=scoreboard.end();it++)
-        {
-            string current = it->first;
+            const Sprite &segment = scoreboard[i];
             glm::mat4 translateRectangle;
             Matrices.model = glm::mat4(1.0f);
 
-            if(scoreboard[current].status==1)
+            if(segment.status==1)
             {
-                translateRectangle = glm::translate (glm::vec3(scoreboard[current].x,scoreboard[current].y,0.0));
+                translateRectangle = glm::translate (glm::vec3(segment.x,segment.y,0.0));
                 Matrices.model *= translateRectangle;
                 MVP = VP * Matrices.model;
                 glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-                draw3DObject(scoreboard[current].object);
+                draw3DObject(segment.object);
             }
         }
 
@@ -999,9 +1284,9 @@ void draw (GLFWwindow* window, float x, float y, float w, float h,int t)
     {
         reshapeWindow(window,fbwidth,fbheight);
         glViewport((int)(x*fbwidth), (int)(y*fbheight), (int)(w*fbwidth), (int)(h*fbheight));
-        float target_x=0,target_y=0,target_z=0,eye_y=5,up_y=7,up_z=0,up_x=0,eye_x=10*cos(camera_rotation_angle*M_PI/180.0f),eye_z=10*sin(camera_rotation_angle*M_PI/180.0f);
+        float target_x=0,target_y=0,target_z=0,eye_y=5,up_y=7,up_z=0,up_x=0,eye_x=10*cos(session->camera_rotation_angle*M_PI/180.0f),eye_z=10*sin(session->camera_rotation_angle*M_PI/180.0f);
 
-        if(top)  //Top view
+        if(session->top)  //Top view
         {
             eye_y=10;
             eye_x=0;
@@ -1016,8 +1301,8 @@ void draw (GLFWwindow* window, float x, float y, float w, float h,int t)
             up_y=3;
             up_z=0;
             up_x=0;
-            eye_x = 10*cos(camera_rotation_angle*M_PI/180.0f);
-            eye_z = 10*sin(camera_rotation_angle*M_PI/180.0f)-5;
+            eye_x = 10*cos(session->camera_rotation_angle*M_PI/180.0f);
+            eye_z = 10*sin(session->camera_rotation_angle*M_PI/180.0f)-5;
         }
 
         // Eye - Location of camera. 
@@ -1041,632 +1326,64 @@ void draw (GLFWwindow* window, float x, float y, float w, float h,int t)
         // Load identity to model matrix
         Matrices.model = glm::mat4(1.0f);
 
-        int i,j;
-        for(i=0;i<10;i++)
-        {
-            for(j=0;j<10;j++)
-            {
-                float k,l;
-                k = (float)i;
-                l = (float)j;
-                Matrices.model = glm::mat4(1.0f);
-                if(level==1)
-                {
-                    if(frag_normal[i][j]==1)
-                    {
-                        Matrices.model = glm::translate(glm::vec3(0.0+k,0.0,0.0+l));
-                        MVP = VP * Matrices.model;
-                        glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-                        draw3DObject(normals["frag"].object);
-                    }
-                    else if(bridge_normal[i][j]==1)
-                    {
-                        Matrices.model = glm::translate(glm::vec3(0.0+k,0.0,0.0+l));
-                        MVP = VP * Matrices.model;
-                        glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-                        if(bridge_stat)
-                            draw3DObject(normals["bridge"].object);
-                    }
-
-                    else if(normal_pos[i][j]==2)
-                    {
-                        Matrices.model = glm::translate(glm::vec3(0.0+k,0.0,0.0+l));
-                        MVP = VP * Matrices.model;
-                        glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-                        draw3DObject(normals["bridgebutton"].object);
-                    }
-                    else if(normal_pos[i][j]==1)
-                    {
-                        Matrices.model = glm::translate(glm::vec3(0.0+k,0.0,0.0+l));
-                        MVP = VP * Matrices.model;
-                        glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-                        draw3DObject(normals["normal"].object);
-                    }
-                    else if(goal_normal[i][j]==1)
-                    {
-                        Matrices.model = glm::translate(glm::vec3(0.0+k,0.0,0.0+l));
-                        MVP = VP * Matrices.model;
-                        glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-                        draw3DObject(normals["goal"].object);
-
-                    }
-                }
-
-                if(level==2)
-                {
-                    if(frag_normal2[i][j]==1)
-                    {
-                        Matrices.model = glm::translate(glm::vec3(0.0+k,0.0,0.0+l));
-                        MVP = VP * Matrices.model;
-                        glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-                        draw3DObject(normals["frag"].object);
-                    }
-                    else if(bridge_normal2[i][j]==1)
-                    {
-                        Matrices.model = glm::translate(glm::vec3(0.0+k,0.0,0.0+l));
-                        MVP = VP * Matrices.model;
-                        glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-                        if(bridge_stat)
-                            draw3DObject(normals["bridge"].object);
-                    }
-
-                    else if(normal_pos2[i][j]==2)
-                    {
-                        Matrices.model = glm::translate(glm::vec3(0.0+k,0.0,0.0+l));
-                        MVP = VP * Matrices.model;
-                        glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-                        draw3DObject(normals["bridgebutton"].object);
-                    }
-                    else if(normal_pos2[i][j]==1)
-                    {
-                        Matrices.model = glm::translate(glm::vec3(0.0+k,0.0,0.0+l));
-                        MVP = VP * Matrices.model;
-                        glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-                        draw3DObject(normals["normal"].object);
-                    }
-                    else if(goal_normal2[i][j]==1)
-                    {
-                        Matrices.model = glm::translate(glm::vec3(0.0+k,0.0,0.0+l));
-                        MVP = VP * Matrices.model;
-                        glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-                        draw3DObject(normals["goal"].object);
-
-                    }
-                }
-            }
-        }
-
-        // Load identity to model matrix
-        Matrices.model = glm::mat4(1.0f);
-        if(cube["longy"].status==1 && w_pressed==1)
-        {
-            cube["longy"].status=0;
-            cube["longz"].status=1;
-            rect_posz-=2.0;
-            w_pressed=0;
-
-            if(level==1)
-                if(normal_pos[(int)rect_posx+5][(int)rect_posz+5]==2)
-                {
-                    bridge_stat^=1;
-                    score+=1;
-                }
-                else
-                    score+=1;
-            if(level==2)
-                if(normal_pos2[(int)rect_posx+5][(int)rect_posz+5]==2)
-                {
-                    bridge_stat^=1;
-                    score2+=1;
-                }
-                else
-                    score2+=1;
-            
-            Matrices.model = glm::mat4(1.0f);
-            glm::mat4 translateRectangle = glm::translate (glm::vec3(rect_posx,rect_posy,rect_posz));    // glTranslatef
-            Matrices.model *= translateRectangle;
-            MVP = VP * Matrices.model;
-            glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-            draw3DObject(rectangle2);
-
-        }
-        else if(cube["longy"].status==1 && s_pressed==1)
-        {
-            cube["longy"].status=0;
-            cube["longz"].status=1;
-            rect_posz+=1.0;
-            s_pressed=0;
-
-            if(level==1)
-                if(normal_pos[(int)rect_posx+5][(int)rect_posz+6]==2)
-                {
-                    bridge_stat^=1;
-                    score+=1;
-                }
-                else
-                    score+=1;
-            if(level==2)
-                if(normal_pos2[(int)rect_posx+5][(int)rect_posz+6]==2)
-                {
-                    bridge_stat^=1;
-                    score2+=1;
-                }
-                else
-                    score2+=1;
-            Matrices.model = glm::mat4(1.0f);
-            glm::mat4 translateRectangle = glm::translate (glm::vec3(rect_posx,rect_posy,rect_posz));    // glTranslatef
-            Matrices.model *= translateRectangle;
-            MVP = VP * Matrices.model;
-            glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-            draw3DObject(rectangle2);
-
-        }
-        else if(cube["longy"].status==1 && a_pressed==1)
-        {
-            cube["longy"].status=0;
-            cube["longx"].status=1;
-            rect_posx-=2.0;
-            a_pressed=0;
-
-            if(level==1)
-                if(normal_pos[(int)rect_posx+5][(int)rect_posz+5]==2)
-                {
-                    bridge_stat^=1;
-                    score+=1;
-                }
-                else
-                    score+=1;
-            if(level==2)
-                if(normal_pos2[(int)rect_posx+5][(int)rect_posz+5]==2)
-                {
-                    bridge_stat^=1;
-                    score2+=1;
-                }
-                else
-                    score2+=1;
-            Matrices.model = glm::mat4(1.0f);
-            glm::mat4 translateRectangle = glm::translate (glm::vec3(rect_posx,rect_posy,rect_posz));    // glTranslatef
-            Matrices.model *= translateRectangle;
-            MVP = VP * Matrices.model;
-            glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-            draw3DObject(rectangle3);
+        MVP = VP * Matrices.model;
+        glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
+        draw3DObject(current_level->floor);
 
-        }
-        else if(cube["longy"].status==1 && d_pressed==1)
+        int move = -1;
+        if(w_pressed==1)
         {
-            cube["longy"].status=0;
-            cube["longx"].status=1;
-            rect_posx+=1.0;
-            d_pressed=0;
-
-            if(level==1)
-                if(normal_pos[(int)rect_posx+5][(int)rect_posz+5]==2)
-                {
-                    bridge_stat^=1;
-                    score+=1;
-                }
-                else
-                    score+=1;
-            if(level==2)
-                if(normal_pos2[(int)rect_posx+5][(int)rect_posz+5]==2)
-                {
-                    bridge_stat^=1;
-                    score2+=1;
-                }
-                else
-                    score2+=1;
-            Matrices.model = glm::mat4(1.0f);
-            glm::mat4 translateRectangle = glm::translate (glm::vec3(rect_posx,rect_posy,rect_posz));    // glTranslatef
-            Matrices.model *= translateRectangle;
-            MVP = VP * Matrices.model;
-            glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-            draw3DObject(rectangle3);
-
-        }
-        else if(cube["longz"].status==1 && w_pressed==1)
-        {
-            cube["longz"].status=0;
-            cube["longy"].status=1;
-            rect_posz-=1.0;
+            move = MOVE_UP;
             w_pressed=0;
-
-            if(level==1)
-                if(normal_pos[(int)rect_posx+5][(int)rect_posz+5]==2)
-                {
-                    bridge_stat^=1;
-                    score+=1;
-                }
-                else
-                    score+=1;
-            if(level==2)
-                if(normal_pos2[(int)rect_posx+5][(int)rect_posz+5]==2)
-                {
-                    bridge_stat^=1;
-                    score2+=1;
-                }
-                else
-                    score2+=1;
-            
-            Matrices.model = glm::mat4(1.0f);
-            glm::mat4 translateRectangle = glm::translate (glm::vec3(rect_posx,rect_posy,rect_posz));    // glTranslatef
-            Matrices.model *= translateRectangle;
-            MVP = VP * Matrices.model;
-            glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-            draw3DObject(rectangle);
-
         }
-        else if(cube["longz"].status==1 && s_pressed==1)
+        else if(s_pressed==1)
         {
-            cube["longz"].status=0;
-            cube["longy"].status=1;
-            rect_posz+=2.0;
+            move = MOVE_DOWN;
             s_pressed=0;
-
-            if(level==1)
-                if(normal_pos[(int)rect_posx+5][(int)rect_posz+5]==2)
-                {
-                    bridge_stat^=1;
-                    score+=1;
-                }
-                else
-                    score+=1;
-            else if(level==2)
-                if(normal_pos2[(int)rect_posx+5][(int)rect_posz+5]==2)
-                {
-                    bridge_stat^=1;
-                    score2+=1;
-                }
-                else
-                    score2+=1;
-            Matrices.model = glm::mat4(1.0f);
-            glm::mat4 translateRectangle = glm::translate (glm::vec3(rect_posx,rect_posy,rect_posz));    // glTranslatef
-            Matrices.model *= translateRectangle;
-            MVP = VP * Matrices.model;
-            glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-            draw3DObject(rectangle);
-
         }
-
-        else if(cube["longz"].status==1 && a_pressed==1)
+        else if(a_pressed==1)
         {
-            cube["longz"].status=1;
-            rect_posx-=1.0;
+            move = MOVE_LEFT;
             a_pressed=0;
-
-            if(level==1)
-                score+=1;
-            else if(level==2)
-                score2+=1;
-            Matrices.model = glm::mat4(1.0f);
-            glm::mat4 translateRectangle = glm::translate (glm::vec3(rect_posx,rect_posy,rect_posz));    // glTranslatef
-            Matrices.model *= translateRectangle;
-            MVP = VP * Matrices.model;
-            glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-            draw3DObject(rectangle2);
-
         }
-        else if(cube["longz"].status==1 && d_pressed==1)
+        else if(d_pressed==1)
         {
-            cube["longz"].status=1;
-            rect_posx+=1.0;
+            move = MOVE_RIGHT;
             d_pressed=0;
-            
-            if(level==1)
-                score+=1;
-            else
-                score2+=1;
-            Matrices.model = glm::mat4(1.0f);
-            glm::mat4 translateRectangle = glm::translate (glm::vec3(rect_posx,rect_posy,rect_posz));    // glTranslatef
-            Matrices.model *= translateRectangle;
-            MVP = VP * Matrices.model;
-            glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-            draw3DObject(rectangle2);
-
-        }
-        else if(cube["longx"].status==1 && w_pressed==1)
-        {
-            cube["longx"].status=1;
-            rect_posz-=1.0;
-            w_pressed=0;
-
-            if(level==1)
-                score+=1;
-            else
-                score2+=1;
-            Matrices.model = glm::mat4(1.0f);
-            glm::mat4 translateRectangle = glm::translate (glm::vec3(rect_posx,rect_posy,rect_posz));    // glTranslatef
-            Matrices.model *= translateRectangle;
-            MVP = VP * Matrices.model;
-            glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-            draw3DObject(rectangle3);
-
         }
-        else if(cube["longx"].status==1 && s_pressed==1)
-        {
-            cube["longx"].status=1;
-            rect_posz+=1.0;
-            s_pressed=0;
 
-            if(level==1)
-                score+=1;
-            else
-                score2+=1;
-            Matrices.model = glm::mat4(1.0f);
-            glm::mat4 translateRectangle = glm::translate (glm::vec3(rect_posx,rect_posy,rect_posz));    // glTranslatef
-            Matrices.model *= translateRectangle;
-            MVP = VP * Matrices.model;
-            glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-            draw3DObject(rectangle3);
-
-        }
-        else if(cube["longx"].status==1 && a_pressed==1)
+        if(move >= 0)
         {
-            cube["longx"].status=0;
-            cube["longy"].status=1;
-            rect_posx-=1.0;
-            a_pressed=0;
-
-            if(level==1)
-                if(normal_pos[(int)rect_posx+5][(int)rect_posz+6]==2)
-                {
-                    bridge_stat^=1;
-                    score+=1;
-                }
-                else
-                    score+=1;
-            if(level==2)
-                if(normal_pos2[(int)rect_posx+5][(int)rect_posz+6]==2)
-                {
-                    bridge_stat^=1;
-                    score2+=1;
-                }
-                else
-                    score2+=1;
-
-            Matrices.model = glm::mat4(1.0f);
-            glm::mat4 translateRectangle = glm::translate (glm::vec3(rect_posx,rect_posy,rect_posz));    // glTranslatef
-            Matrices.model *= translateRectangle;
-            MVP = VP * Matrices.model;
-            glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-            draw3DObject(rectangle);
-
+            SimState before = session->block;
+            int result = sim_step(&current_level->sim, &session->block, move, &session->block);
+            journal_record(&journal, &block_shape, &before, move, &session->block);
+            showMove(&before, result);
         }
-        else if(cube["longx"].status==1 && d_pressed==1)
+        else if(u_pressed==1)
         {
-            cube["longx"].status=0;
-            cube["longy"].status=1;
-            rect_posx+=2.0;
-            d_pressed=0;
-
-            if(level==1)
-                if(normal_pos[(int)rect_posx+5][(int)rect_posz+6]==2)
-                {
-                    bridge_stat^=1;
-                    score+=1;
-                }
-                else
-                    score+=1;
-            if(level==2)
-                if(normal_pos2[(int)rect_posx+5][(int)rect_posz+6]==2)
-                {
-                    bridge_stat^=1;
-                    score2+=1;
-                }
-                else
-                    score2+=1;
-
-            Matrices.model = glm::mat4(1.0f);
-            glm::mat4 translateRectangle = glm::translate (glm::vec3(rect_posx,rect_posy,rect_posz));    // glTranslatef
-            Matrices.model *= translateRectangle;
-            MVP = VP * Matrices.model;
-            glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-            draw3DObject(rectangle);
-
+            u_pressed=0;
+            SimState before = session->block;
+            if(journal_undo(&journal, &block_shape, &session->block))
+                showMove(&before, SIM_MOVED);
         }
-
-        if(cube["longy"].status==1)
+        else if(h_pressed==1)
         {
-            int status=0;
-            if(level==1)
-            {
-                if(normal_pos[(int)rect_posx+5][(int)rect_posz+5]==0)
-                {
-                    if(goal_normal[(int)rect_posx+5][(int)rect_posz+5]==1)
-                    {
-                        status=1;
-                        win=1;
-                        level=2;
-                    }
-
-                    else
-                    {
-                        rect_posx=-5;
-                        rect_posz=-5;
-                        bridge_stat=0;
-                        score=0;
-                    }
-                }
-                else if(frag_normal[(int)rect_posx+5][(int)rect_posz+5]==1)
-                {
-                    rect_posx=-5;
-                    rect_posz=-5;
-                    bridge_stat=0;
-                    score=0;
-                }
-                else if(bridge_normal[(int)rect_posx+5][(int)rect_posz+5]==1 && bridge_stat==0)
-                {
-                    rect_posx=-5;
-                    rect_posz=-5;
-                    bridge_stat=0;
-                    score=0;
-                }
-            }
-            if(level==2)
-            {
-                if(normal_pos2[(int)rect_posx+5][(int)rect_posz+5]==0)
-                {
-                    if(goal_normal2[(int)rect_posx+5][(int)rect_posz+5]==1)
-                    {
-                        status=1;
-                        win=2;
-                    }
-
-                    else
-                    {
-                        rect_posx=-5;
-                        rect_posz=-5;
-                        bridge_stat=0;
-                        score2=score;
-                    }
-                }
-                else if(frag_normal2[(int)rect_posx+5][(int)rect_posz+5]==1)
-                {
-                    rect_posx=-5;
-                    rect_posz=-5;
-                    bridge_stat=0;
-                    score2=score;
-                }
-                else if(bridge_normal2[(int)rect_posx+5][(int)rect_posz+5]==1 && bridge_stat==0)
-                {
-                    rect_posx=-5;
-                    rect_posz=-5;
-                    bridge_stat=0;
-                    score2=score;
-                }
-            }
-            Matrices.model = glm::mat4(1.0f);
-            glm::mat4 translateRectangle = glm::translate (glm::vec3(rect_posx,rect_posy,rect_posz));    // glTranslatef
-            Matrices.model *= translateRectangle;
-            MVP = VP * Matrices.model;
-            glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-            draw3DObject(rectangle);
+            h_pressed=0;
+            showHint();
         }
-        else if(cube["longz"].status==1)
+        else if(r_pressed==1)
         {
-            int status=0;
-            Matrices.model = glm::mat4(1.0f);
-            glm::mat4 translateRectangle = glm::translate (glm::vec3(rect_posx,rect_posy,rect_posz));    // glTranslatef
-            Matrices.model *= translateRectangle;
-            MVP = VP * Matrices.model;
-            glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-            if(level==1)
-            {
-                if((normal_pos[(int)rect_posx+5][(int)rect_posz+6]==0&&goal_normal[(int)rect_posx+5][(int)rect_posz+6]!=1)|| (normal_pos[(int)rect_posx+5][(int)rect_posz+5]==0&&goal_normal[(int)rect_posz+5][(int)rect_posz+5]!=1)||rect_posz>=4 )
-                {
-                    rect_posx=-5;
-                    rect_posz=-5;
-                    status=1;
-                    score=0;
-                    bridge_stat=0;
-                    cube["longz"].status=0;
-                    cube["longy"].status=1;
-                }
-                else if((bridge_normal[(int)rect_posx+5][(int)rect_posz+5]==1 && bridge_stat==0)||(bridge_normal[(int)rect_posx+5][(int)rect_posz+6]==1 && bridge_stat==0))
-                {
-                    rect_posx=-5;
-                    rect_posz=-5;
-                    bridge_stat=0;
-                    score=0;
-                    status=1;
-                    cube["longy"].status=1;
-                    cube["longz"].status=0;
-                }
-            }
-            if(level==2)
-            {
-                if((normal_pos2[(int)rect_posx+5][(int)rect_posz+6]==0&&goal_normal2[(int)rect_posx+5][(int)rect_posz+6]!=1)|| (normal_pos2[(int)rect_posx+5][(int)rect_posz+5]==0&&goal_normal2[(int)rect_posz+5][(int)rect_posz+5]!=1)||rect_posz>=4 )
-                {
-                    rect_posx=-5;
-                    rect_posz=-5;
-                    status=1;
-                    score2=score;
-                    bridge_stat=0;
-                    cube["longz"].status=0;
-                    cube["longy"].status=1;
-                }
-                else if((bridge_normal2[(int)rect_posx+5][(int)rect_posz+5]==1 && bridge_stat==0)||(bridge_normal2[(int)rect_posx+5][(int)rect_posz+6]==1 && bridge_stat==0))
-                {
-                    rect_posx=-5;
-                    rect_posz=-5;
-                    bridge_stat=0;
-                    score2=score;
-                    status=1;
-                    cube["longy"].status=1;
-                    cube["longz"].status=0;
-                }
-            }
-            if(status==0)
-                draw3DObject(rectangle2);
+            r_pressed=0;
+            SimState before = session->block;
+            int result = journal_redo(&journal, &current_level->sim, &session->block);
+            if(result)
+                showMove(&before, result);
         }
 
-        else if(cube["longx"].status==1)
-        {
-            
-            int status=0;
-            Matrices.model = glm::mat4(1.0f);
-            glm::mat4 translateRectangle = glm::translate (glm::vec3(rect_posx,rect_posy,rect_posz));    // glTranslatef
-            Matrices.model *= translateRectangle;
-            MVP = VP * Matrices.model;
-            glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-            if(level==1)
-            {
-                if((normal_pos[(int)(rect_posx+6)][(int)(rect_posz+5)]==0&&goal_normal[(int)rect_posx+6][(int)rect_posz+5]!=1)||(normal_pos[(int)(rect_posx+5)][(int)(rect_posz+5)]==0&&goal_normal[(int)rect_posx+5][(int)rect_posz+5]!=1)||rect_posx<-5||rect_posz<-5)
-                {
-                    rect_posx=-5;
-                    rect_posz=-5;
-                    status=1;
-                    score=0;
-                    bridge_stat=0;
-                    cube["longx"].status=0;
-                    cube["longy"].status=1;
-                }
-                else if((bridge_normal[(int)rect_posx+6][(int)rect_posz+5]==1 && bridge_stat==0)||(bridge_normal[(int)rect_posx+5][(int)rect_posz+5]==1 && bridge_stat==0))
-                {
-                    rect_posx=-5;
-                    rect_posz=-5;
-                    status=1;
-                    score=0;
-                    cube["longy"].status=1;
-                    cube["longx"].status=0;
-                    bridge_stat=0;
-                }
-            }
-            if(level==2)
-            {
-                if((normal_pos2[(int)(rect_posx+6)][(int)(rect_posz+5)]==0&&goal_normal2[(int)rect_posx+6][(int)rect_posz+5]!=1)||(normal_pos2[(int)(rect_posx+5)][(int)(rect_posz+5)]==0&&goal_normal2[(int)rect_posx+5][(int)rect_posz+5]!=1)||rect_posx<-5||rect_posz<-5)
-                {
-                    rect_posx=-5;
-                    rect_posz=-5;
-                    status=1;
-                    score2=score;
-                    bridge_stat=0;
-                    cube["longx"].status=0;
-                    cube["longy"].status=1;
-                }
-                else if((bridge_normal2[(int)rect_posx+6][(int)rect_posz+5]==1 && bridge_stat==0)||(bridge_normal2[(int)rect_posx+5][(int)rect_posz+5]==1 && bridge_stat==0))
-                {
-                    rect_posx=-5;
-                    rect_posz=-5;
-                    status=1;
-                    score2=score;
-                    cube["longy"].status=1;
-                    cube["longx"].status=0;
-                    bridge_stat=0;
-                }
-            }
-            if(status==0)
-                draw3DObject(rectangle3);
-        }
+        Matrices.model = glm::translate (glm::vec3(session->block.x - current_level->level.size_x/2, 0, session->block.z - current_level->level.size_z/2));
+        MVP = VP * Matrices.model;
+        glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
+        draw3DObject(cube[session->block.orient].object);
     }
 
 
@@ -1706,15 +1423,7 @@ GLFWwindow* initGLFW (int width, int height){
 void initGL (GLFWwindow* window, int width, int height)
 {
     // Create the models
-    createRectangle ("longy");
-    createRectangle2 ("longz");
-    createRectangle3 ("longx");
-
-    createFloor("normal",-5,-1.0,-5);
-    createFloor("frag",-5,-1.0,-5);
-    createFloor("bridge",-5,-1.0,-5);
-    createFloor("bridgebutton",-5,-1.0,-5);
-    createFloor("goal",-5,-1.0,-5);
+    createBlockMeshes(&block_shape);
 
     createScore("up1",2,3,0.25,2);
     createScore("ul1",1,1.5,3,0.25);
@@ -1732,7 +1441,10 @@ void initGL (GLFWwindow* window, int width, int height)
     createScore("br2",-1,-1.5,3,0.25);
     createScore("bt2",-2,-3,-.25,2);
 	
+    double shader_start = glfwGetTime();
     programID = LoadShaders( "Sample_GL.vert", "Sample_GL.frag" );
+    printf("startup: shaders %s in %.2f ms\n", shader_from_cache ? "loaded from cache" : "compiled from source",
+           (glfwGetTime() - shader_start) * 1000);
     Matrices.MatrixID = glGetUniformLocation(programID, "MVP");
 	
     reshapeWindow (window, width, height);
@@ -1745,52 +1457,189 @@ void initGL (GLFWwindow* window, int width, int height)
     glDepthFunc (GL_LEQUAL);
 }
 
+int new_session;  // --new: ignore the saved session
+
+void newSession()
+{
+    session_reset(session);
+    session->level = 1;
+    session->camera_rotation_angle = 90;
+    memcpy(session->block_dims, block_shape.dims, sizeof(block_shape.dims));
+    session_seal(session);
+}
+
+// Whether a saved state is one the level as it is now could be in: switch
+// bits only on buttons, each timer within its button's duration and running
+// exactly while the button is on, unused timers 0. The hint table and its
+// state keys count on all of it.
+int stateFits(const SimLevel *sim, const SimState *b)
+{
+    const Level *lvl = sim->level;
+    if(b->orient < 0 || b->orient >= sim->shape->num_orients ||
+       ((uint64_t) b->switches >> lvl->num_switches) != 0 ||
+       ((uint64_t) b->crumbled >> sim->crumble_tiles.size()) != 0)
+        return 0;
+    for(int i = 0; i < lvl->num_switches; i++)
+    {
+        int on = (b->switches >> i) & 1, t = sim->timer_of[i];
+        if(on && lvl->tiles[lvl->switches[i].tile] != TILE_BUTTON)
+            return 0;
+        if(t >= 0 && (b->timers[t] > lvl->switches[i].duration || (b->timers[t] > 0) != on))
+            return 0;
+    }
+    for(int t = sim->num_timers; t < SIM_MAX_TIMERS; t++)
+        if(b->timers[t])
+            return 0;
+    return sim_supported(sim, b);
+}
+
+// GL thread, after switchLevel() to the saved level: put the block back where
+// the session left it, unless the level changed under it
+void resumeBlock(const Session *saved)
+{
+    const SimState *b = &saved->block;
+    if(!stateFits(&current_level->sim, b))
+    {
+        fprintf(stderr, "startup: saved block does not fit level %d, restarting it\n", saved->level);
+        session->score = session->level_start_score = saved->level_start_score;
+        return;
+    }
+    SimState start = session->block;
+    session->block = *b;
+    session->score = saved->score;
+    session->level_start_score = saved->level_start_score;
+    showTiles(&start);
+}
+
 int main (int argc, char** argv)
 {
+    chrono::steady_clock::time_point startup = chrono::steady_clock::now();
+    sim_shape(&block_shape, 1, 2, 1);
+    for(int i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "--no-shader-cache") == 0)
+            use_shader_cache = 0;
+        else if(strcmp(argv[i], "--new") == 0)
+            new_session = 1;
+        else if(strcmp(argv[i], "--block") == 0 && i + 1 < argc)
+        {
+            int sx, sy, sz;
+            if(sscanf(argv[++i], "%dx%dx%d", &sx, &sy, &sz) != 3 || !sim_shape(&block_shape, sx, sy, sz))
+            {
+                fprintf(stderr, "--block wants XxYxZ, each side 1 to %d\n", SIM_MAX_DIM);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if(strcmp(argv[i], "--pack") == 0 && i + 1 < argc)
+        {
+            // Maps the pack and reads its header; levels are decompressed when loaded
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            level_pack = pack_open(argv[++i]);
+            if(level_pack == NULL)
+                fprintf(stderr, "%s: cannot open level pack, using level files\n", argv[i]);
+            else
+                printf("startup: pack %s with %d levels opened in %.3f ms\n", argv[i], pack_num_levels(level_pack),
+                       chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+        }
+    }
+
     int width = 800;
     int height = 800;
-    rect_posx = -5;
-    rect_posy = 0;
-    rect_posz = -5;
-    floor_pos = glm::vec3(0, 0, 0);
-    do_rot = 0;
-    top = 0;
+
+    // Resuming is mapping the session file again, there is nothing to parse
+    chrono::steady_clock::time_point session_start = chrono::steady_clock::now();
+    int resumed;
+    solutions = solcache_open(solutions_file);
+    session = session_open(session_file, &resumed);
+    if(session == NULL)
+    {
+        fprintf(stderr, "startup: progress is not saved\n");
+        session = &session_memory;
+        resumed = 0;
+    }
+    if(resumed && (new_session || session->level < 1 ||
+                   memcmp(session->block_dims, block_shape.dims, sizeof(block_shape.dims)) != 0))
+        resumed = 0;
+    if(resumed)
+        printf("startup: resumed level %d at move %d from %s in %.3f ms\n", session->level, session->block.moves,
+               session_file, chrono::duration<double, milli>(chrono::steady_clock::now() - session_start).count());
+    else
+        newSession();
+    Session saved = *session;
+
+    // Everything that does not need the GL context starts right away
+    audio_loader = thread(audio_init);
+    prefetchLevel(session->level);
+    journal_init(&journal, JOURNAL_BYTES);
 
     GLFWwindow* window = initGLFW(width, height);
     initGLEW();
     initGL (window, width, height);
-    
-    audio_init();
+
+    // The first frame only needs the first level, the second one is prefetched while playing
+    int ready = switchLevel();
+    if(!ready && resumed)
+    {
+        fprintf(stderr, "startup: level %d is gone, starting over\n", saved.level);
+        resumed = 0;
+        newSession();
+        prefetchLevel(1);
+        ready = switchLevel();
+    }
+    if(!ready)
+    {
+        fprintf(stderr, "No level to play\n");
+        quit(window);
+    }
+    if(resumed)
+        resumeBlock(&saved);
+    watching_levels.store(true);
+    level_watcher = thread(watchLevels);
+    printf("startup: ready in %.2f ms (shader cache %s)\n",
+           chrono::duration<double, milli>(chrono::steady_clock::now() - startup).count(),
+           use_shader_cache ? "on" : "off");
     last_update_time = glfwGetTime();
+    int first_frame = 1;
 
     while (!glfwWindowShouldClose(window)) 
     {
         if(win<2)
         {
 
+            runGLTasks(0);
             glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
             current_time = glfwGetTime();
-            if(do_rot && top==0 && front==0)
-                camera_rotation_angle += 90*(current_time - last_update_time);
-            if(camera_rotation_angle > 720)
-                camera_rotation_angle -= 720;
+            if(session->do_rot && session->top==0 && session->front==0)
+                session->camera_rotation_angle += 90*(current_time - last_update_time);
+            if(session->camera_rotation_angle > 720)
+                session->camera_rotation_angle -= 720;
             last_update_time = current_time;
             draw(window, 0,0,0.8,0.8,0);
             draw(window, 0.8,0.8,0.2,0.2,1);
             draw(window,0,0.8,0.2,0.2,2);
-            audio_play();
+            session_seal(session);
            
             glfwSwapBuffers(window);
+            if(first_frame)
+            {
+                printf("startup: first frame after %.2f ms\n",
+                       chrono::duration<double, milli>(chrono::steady_clock::now() - startup).count());
+                first_frame = 0;
+            }
             
             glfwPollEvents();
         }
         else
         {
-            cout << "You win! You took " << score2 << " moves to finish the game." << endl;
+            cout << "You win! You took " << session->score << " moves to finish the game." << endl;
+            session_reset(session);  // the next start is a new game
             break;
         }
     }
-    audio_close();
+    stopLevelThreads();
+    reportJournal();
+    shutdownAudio();
+    solcache_close(solutions);
     glfwTerminate();
 }
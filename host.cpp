@@ -0,0 +1,261 @@
+#include <chrono>
+#include <cstring>
+
+#include "host.h"
+
+using namespace std;
+
+void host_init(Host *h, int threads)
+{
+    h->levels.clear();
+    h->shards.clear();
+    h->session_shard.clear();
+    h->session_lane.clear();
+    h->free_ids.clear();
+    h->open_sessions = 0;
+    h->pool = pool_start(threads);
+}
+
+void host_free(Host *h)
+{
+    pool_stop(h->pool);
+    h->pool = NULL;
+    h->shards.clear();
+    h->levels.clear();
+}
+
+int host_add_level(Host *h, const Level *lvl, int sx, int sy, int sz)
+{
+    unique_ptr<HostLevel> hl(new HostLevel);
+    hl->level = *lvl;
+    if(!sim_shape(&hl->shape, sx, sy, sz) || !sim_prepare(&hl->sim, &hl->level, &hl->shape))
+        return -1;
+    h->levels.push_back(move(hl));
+    return h->levels.size() - 1;
+}
+
+static void shard_resize(HostShard *s, int n)
+{
+    sim_batch_resize(&s->states, n);
+    s->ids.resize(n, -1);
+    s->queued.resize(n, 0);
+    s->moves.resize(n, 0);
+    s->flags.resize(n, 0);
+    s->steps.resize(n, 0);
+    s->falls.resize(n, 0);
+    s->wins.resize(n, 0);
+}
+
+// A free lane in a shard of the level, a new shard if they are all full
+static void find_lane(Host *h, int level, int *shard, int *lane)
+{
+    for(size_t i = 0; i < h->shards.size(); i++)
+    {
+        HostShard *s = &h->shards[i];
+        if(s->level != level)
+            continue;
+        if(!s->free_lanes.empty())
+        {
+            *shard = i;
+            *lane = s->free_lanes.back();
+            s->free_lanes.pop_back();
+            return;
+        }
+        if(s->used < HOST_SHARD_SESSIONS)
+        {
+            *shard = i;
+            *lane = s->used++;
+            shard_resize(s, s->used);
+            return;
+        }
+    }
+    h->shards.push_back(HostShard());
+    HostShard *s = &h->shards.back();
+    s->level = level;
+    s->used = 1;
+    s->pending = 0;
+    s->tick_seconds = 0;
+    shard_resize(s, 1);
+    *shard = h->shards.size() - 1;
+    *lane = 0;
+}
+
+int host_open(Host *h, int level)
+{
+    if(level < 0 || level >= (int) h->levels.size())
+        return -1;
+    int id;
+    if(!h->free_ids.empty())
+    {
+        id = h->free_ids.back();
+        h->free_ids.pop_back();
+    }
+    else
+    {
+        id = h->session_shard.size();
+        h->session_shard.push_back(-1);
+        h->session_lane.push_back(-1);
+    }
+    int shard, lane;
+    find_lane(h, level, &shard, &lane);
+    HostShard *s = &h->shards[shard];
+    SimState start;
+    sim_start(&h->levels[level]->sim, &start);
+    sim_batch_set(&s->states, lane, &start);
+    s->ids[lane] = id;
+    s->queued[lane] = 0;
+    s->flags[lane] = 0;
+    s->steps[lane] = s->falls[lane] = s->wins[lane] = 0;
+    h->session_shard[id] = shard;
+    h->session_lane[id] = lane;
+    h->open_sessions++;
+    return id;
+}
+
+int host_session_open(const Host *h, int session)
+{
+    return session >= 0 && session < (int) h->session_shard.size() && h->session_shard[session] >= 0;
+}
+
+void host_close(Host *h, int session)
+{
+    if(!host_session_open(h, session))
+        return;
+    HostShard *s = &h->shards[h->session_shard[session]];
+    int lane = h->session_lane[session];
+    if(s->queued[lane])
+        s->pending--;
+    s->queued[lane] = 0;
+    s->ids[lane] = -1;
+    s->free_lanes.push_back(lane);
+    h->session_shard[session] = h->session_lane[session] = -1;
+    h->free_ids.push_back(session);
+    h->open_sessions--;
+}
+
+void host_queue(Host *h, int session, int move)
+{
+    if(!host_session_open(h, session) || move < 0 || move >= MOVE_COUNT)
+        return;
+    HostShard *s = &h->shards[h->session_shard[session]];
+    int lane = h->session_lane[session];
+    s->pending += !s->queued[lane];
+    s->queued[lane] = 1;
+    s->moves[lane] = move;
+}
+
+// Counters and restarts after a step, for every lane that was queued. Bots
+// leave random lanes out, so the counting has no branch on that.
+static void account(const SimLevel *sl, HostShard *s, int lane, int flags)
+{
+    int queued = s->queued[lane];
+    s->steps[lane] += queued;
+    s->falls[lane] += queued & (flags / SIM_FELL);
+    if(queued & (flags / SIM_WON))
+    {
+        s->wins[lane]++;
+        SimState start;
+        sim_start(sl, &start);
+        sim_batch_set(&s->states, lane, &start);
+    }
+    s->queued[lane] = 0;
+}
+
+// One pool task: every queued lane of the shard. With most lanes queued, as
+// with bots, the whole shard steps in place and the idle lanes are put back;
+// otherwise the queued lanes are copied out into a batch of their own.
+static void step_shard(const Host *h, HostShard *s)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    const SimLevel *sl = &h->levels[s->level]->sim;
+    int in_place = s->pending * 2 >= s->used;
+    int n = 0;
+    s->lanes.resize(s->used);
+    for(int lane = 0; lane < s->used; lane++)
+    {
+        s->lanes[n] = lane;
+        n += s->queued[lane] != in_place;
+    }
+    if(!in_place)
+        n = s->pending;
+    sim_batch_resize(&s->some, n);
+    s->some_moves.resize(n);
+    s->some_flags.resize(n);
+    if(in_place)
+    {
+        // Free lanes hold some valid state too, the last of their session or the start
+        for(int i = 0; i < n; i++)
+        {
+            sim_batch_copy(&s->some, i, &s->states, s->lanes[i]);
+            s->some_flags[i] = s->flags[s->lanes[i]];
+            s->moves[s->lanes[i]] = MOVE_UP;
+        }
+        sim_step_batch(sl, &s->states, s->moves.data(), s->flags.data());
+        for(int i = 0; i < n; i++)
+        {
+            sim_batch_copy(&s->states, s->lanes[i], &s->some, i);
+            s->flags[s->lanes[i]] = s->some_flags[i];
+        }
+        for(int lane = 0; lane < s->used; lane++)
+            account(sl, s, lane, s->flags[lane]);
+    }
+    else
+    {
+        for(int i = 0; i < n; i++)
+        {
+            sim_batch_copy(&s->some, i, &s->states, s->lanes[i]);
+            s->some_moves[i] = s->moves[s->lanes[i]];
+        }
+        sim_step_batch(sl, &s->some, s->some_moves.data(), s->some_flags.data());
+        for(int i = 0; i < n; i++)
+        {
+            int lane = s->lanes[i];
+            sim_batch_copy(&s->states, lane, &s->some, i);
+            s->flags[lane] = s->some_flags[i];
+            account(sl, s, lane, s->some_flags[i]);
+        }
+    }
+    s->pending = 0;
+    s->tick_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+void host_tick(Host *h, HostTickStats *stats)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    vector<int> due;
+    uint64_t moves = 0;
+    for(size_t i = 0; i < h->shards.size(); i++)
+        if(h->shards[i].pending)
+        {
+            due.push_back(i);
+            moves += h->shards[i].pending;
+        }
+    pool_run_on(h->pool, due.size(), [&](int task, int) { step_shard(h, &h->shards[due[task]]); }, NULL);
+
+    if(stats)
+    {
+        stats->shards = due.size();
+        stats->moves = moves;
+        stats->max_shard_seconds = 0;
+        for(size_t i = 0; i < due.size(); i++)
+            if(h->shards[due[i]].tick_seconds > stats->max_shard_seconds)
+                stats->max_shard_seconds = h->shards[due[i]].tick_seconds;
+        stats->seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+}
+
+void host_session(const Host *h, int session, HostSessionInfo *info)
+{
+    memset(info, 0, sizeof(*info));
+    info->level = -1;
+    if(!host_session_open(h, session))
+        return;
+    const HostShard *s = &h->shards[h->session_shard[session]];
+    int lane = h->session_lane[session];
+    info->level = s->level;
+    sim_batch_get(&s->states, lane, &info->state);
+    info->flags = s->flags[lane];
+    info->steps = s->steps[lane];
+    info->falls = s->falls[lane];
+    info->wins = s->wins[lane];
+}
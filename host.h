@@ -0,0 +1,88 @@
+#ifndef HOST_H
+#define HOST_H
+
+#include <memory>
+#include <vector>
+#include <stdint.h>
+
+#include "batch.h"
+#include "pool.h"
+
+/* Many concurrent sessions of the game rules, without the game. Sessions
+   are grouped in shards of up to HOST_SHARD_SESSIONS on the same level; a
+   shard keeps its states as a SimBatch and its counters as arrays beside it.
+   Moves are queued per session, at most one per session per tick, and a tick
+   steps every shard with queued moves as one pool task. A session lives in
+   one shard, so no two threads ever touch it in the same tick. A won session
+   starts its level again; so does a fall, as sim_step() has it. */
+#define HOST_SHARD_SESSIONS 512
+
+// A level and the SimLevel prepared from it, at a fixed address
+struct HostLevel {
+    Level level;
+    SimShape shape;
+    SimLevel sim;
+};
+
+struct HostShard {
+    int level;
+    int used;                           // lanes ever handed out
+    SimBatch states;
+    std::vector<int> ids;               // session of each lane, -1 if free
+    std::vector<unsigned char> queued;  // 1 if the lane has a move for this tick
+    std::vector<unsigned char> moves, flags;    // queued move, flags of the last step
+    std::vector<uint32_t> steps, falls, wins;   // since the session opened
+    std::vector<int> free_lanes;
+
+    // Scratch for a tick that steps only some lanes
+    SimBatch some;
+    std::vector<int> lanes;
+    std::vector<unsigned char> some_moves, some_flags;
+    int pending;                        // lanes queued
+    double tick_seconds;                // time of the last step
+};
+
+struct Host {
+    std::vector< std::unique_ptr<HostLevel> > levels;
+    std::vector<HostShard> shards;
+    std::vector<int> session_shard, session_lane;   // -1 for closed sessions
+    std::vector<int> free_ids;
+    int open_sessions;
+    Pool *pool;
+};
+
+struct HostTickStats {
+    int shards;             // stepped this tick
+    uint64_t moves;
+    double seconds;         // whole tick, queue to results
+    double max_shard_seconds;
+};
+
+// threads as for pool_start()
+void host_init(Host *h, int threads);
+void host_free(Host *h);
+
+// The level is copied. Returns its index, -1 if sim_prepare() refuses it.
+int host_add_level(Host *h, const Level *lvl, int sx, int sy, int sz);
+
+// A new session at the start of a level, -1 if there is no such level
+int host_open(Host *h, int level);
+void host_close(Host *h, int session);
+int host_session_open(const Host *h, int session);
+
+// Queue a move for the next tick; a second one replaces the first
+void host_queue(Host *h, int session, int move);
+
+// Step every queued move across the pool
+void host_tick(Host *h, HostTickStats *stats);
+
+struct HostSessionInfo {
+    int level;
+    SimState state;
+    int flags;              // of the last step, 0 before the first
+    uint32_t steps, falls, wins;
+};
+
+void host_session(const Host *h, int session, HostSessionInfo *info);
+
+#endif
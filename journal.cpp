@@ -0,0 +1,160 @@
+#include <cstring>
+
+#include "journal.h"
+
+using namespace std;
+
+#define ENTRY_EXTRAS 0x20
+#define ENTRY_MAX 32    // 2 header bytes, every extra and the length byte
+
+static size_t extras_size(int mask)
+{
+    return (mask & JOURNAL_POS ? 8 : 0) + (mask & JOURNAL_SWITCHES ? 4 : 0) + (mask & JOURNAL_CRUMBLED ? 4 : 0) +
+           (mask & JOURNAL_TIMERS ? SIM_MAX_TIMERS : 0) + (mask & JOURNAL_MOVES ? 4 : 0);
+}
+
+static inline unsigned char get(const Journal *j, uint64_t pos)
+{
+    return j->ring[pos % j->ring.size()];
+}
+
+// Size of the entry starting at pos
+static size_t entry_size(const Journal *j, uint64_t pos)
+{
+    unsigned char head = get(j, pos);
+    return head & ENTRY_EXTRAS ? 3 + extras_size(get(j, pos + 1)) : 2;
+}
+
+static unsigned char *put32(unsigned char *p, uint32_t v)
+{
+    for(int i = 0; i < 4; i++)
+        *p++ = v >> (8*i);
+    return p;
+}
+
+static uint32_t get32(const Journal *j, uint64_t *pos)
+{
+    uint32_t v = 0;
+    for(int i = 0; i < 4; i++)
+        v |= (uint32_t) get(j, (*pos)++) << (8*i);
+    return v;
+}
+
+void journal_init(Journal *j, size_t bytes)
+{
+    j->ring.assign(bytes < ENTRY_MAX ? ENTRY_MAX : bytes, 0);
+    journal_clear(j);
+}
+
+void journal_clear(Journal *j)
+{
+    j->begin = j->cursor = j->end = 0;
+    j->undo_moves = j->redo_moves = 0;
+}
+
+void journal_record(Journal *j, const SimShape *shape, const SimState *before, int move, const SimState *after)
+{
+    const int *t = shape->transitions[before->orient][move];
+    int mask = 0;
+    if(after->x != before->x + t[1] || after->z != before->z + t[2])
+        mask |= JOURNAL_POS;
+    if(after->switches != before->switches)
+        mask |= JOURNAL_SWITCHES;
+    if(after->crumbled != before->crumbled)
+        mask |= JOURNAL_CRUMBLED;
+    if(memcmp(after->timers, before->timers, SIM_MAX_TIMERS) != 0)
+        mask |= JOURNAL_TIMERS;
+    if(after->moves != before->moves + 1)
+        mask |= JOURNAL_MOVES;
+
+    unsigned char entry[ENTRY_MAX], *p = entry;
+    *p++ = move | before->orient << 2 | (mask ? ENTRY_EXTRAS : 0);
+    if(mask)
+        *p++ = mask;
+    if(mask & JOURNAL_POS)
+    {
+        p = put32(p, before->x ^ after->x);
+        p = put32(p, before->z ^ after->z);
+    }
+    if(mask & JOURNAL_SWITCHES)
+        p = put32(p, before->switches ^ after->switches);
+    if(mask & JOURNAL_CRUMBLED)
+        p = put32(p, before->crumbled ^ after->crumbled);
+    if(mask & JOURNAL_TIMERS)
+        for(int i = 0; i < SIM_MAX_TIMERS; i++)
+            *p++ = before->timers[i] ^ after->timers[i];
+    if(mask & JOURNAL_MOVES)
+        p = put32(p, before->moves ^ after->moves);
+    size_t size = p - entry + 1;
+    *p = size;
+
+    // A new move ends the redo history; a full ring drops the oldest moves
+    j->end = j->cursor;
+    j->redo_moves = 0;
+    while(j->end - j->begin + size > j->ring.size())
+    {
+        j->begin += entry_size(j, j->begin);
+        j->undo_moves--;
+    }
+    for(size_t i = 0; i < size; i++)
+        j->ring[(j->end + i) % j->ring.size()] = entry[i];
+    j->end += size;
+    j->cursor = j->end;
+    j->undo_moves++;
+}
+
+int journal_undo(Journal *j, const SimShape *shape, SimState *s)
+{
+    if(j->cursor == j->begin)
+        return 0;
+    uint64_t start = j->cursor - get(j, j->cursor - 1);
+    uint64_t pos = start;
+    unsigned char head = get(j, pos++);
+    int move = head & 3, orient = (head >> 2) & 7;
+    int mask = head & ENTRY_EXTRAS ? get(j, pos++) : 0;
+
+    if(mask & JOURNAL_POS)
+    {
+        s->x ^= get32(j, &pos);
+        s->z ^= get32(j, &pos);
+    }
+    else
+    {
+        const int *t = shape->transitions[orient][move];
+        s->x -= t[1];
+        s->z -= t[2];
+    }
+    s->orient = orient;
+    if(mask & JOURNAL_SWITCHES)
+        s->switches ^= get32(j, &pos);
+    if(mask & JOURNAL_CRUMBLED)
+        s->crumbled ^= get32(j, &pos);
+    if(mask & JOURNAL_TIMERS)
+        for(int i = 0; i < SIM_MAX_TIMERS; i++)
+            s->timers[i] ^= get(j, pos++);
+    if(mask & JOURNAL_MOVES)
+        s->moves ^= get32(j, &pos);
+    else
+        s->moves--;
+
+    j->cursor = start;
+    j->undo_moves--;
+    j->redo_moves++;
+    return 1;
+}
+
+int journal_redo(Journal *j, const SimLevel *sl, SimState *s)
+{
+    if(j->cursor == j->end)
+        return 0;
+    int flags = sim_step(sl, s, get(j, j->cursor) & 3, s);
+    j->cursor += entry_size(j, j->cursor);
+    j->undo_moves++;
+    j->redo_moves--;
+    return flags;
+}
+
+size_t journal_bytes(const Journal *j)
+{
+    return j->end - j->begin;
+}
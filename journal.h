@@ -0,0 +1,50 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sim.h"
+
+/* Move journal: every applied move as a few bytes in a ring buffer, for undo
+   and redo in constant time. An entry holds what undoing needs:
+     byte 0      move (bits 0-1), orientation before (bits 2-4), has extras (bit 5)
+     byte 1      which extras follow (JOURNAL_*), only with bit 5 set
+     extras      XOR of the before and after value, little endian
+     last byte   length of the whole entry, to walk back over it
+   A plain roll is 2 bytes: its position and orientation follow from the
+   shape's transitions. Redo replays the entry's move with sim_step(), which
+   gives the same state again. Once the ring is full the oldest moves are
+   dropped. */
+enum {
+    JOURNAL_POS      = 1,   // x and z, int32 each: teleports and falls
+    JOURNAL_SWITCHES = 2,   // uint32, the switches the move toggled
+    JOURNAL_CRUMBLED = 4,   // uint32
+    JOURNAL_TIMERS   = 8,   // SIM_MAX_TIMERS bytes
+    JOURNAL_MOVES    = 16,  // int32, when the move count did not just go up by one
+};
+
+struct Journal {
+    std::vector<unsigned char> ring;
+    uint64_t begin, cursor, end;    // byte positions, ever growing: undo goes back from cursor, redo forward to end
+    int undo_moves, redo_moves;     // entries in [begin, cursor) and [cursor, end)
+};
+
+void journal_init(Journal *j, size_t bytes);
+void journal_clear(Journal *j);
+
+// Record the move that took before to after, dropping anything that could be redone
+void journal_record(Journal *j, const SimShape *shape, const SimState *before, int move, const SimState *after);
+
+// Step s back over the last move. Returns 0 if there is nothing to undo.
+int journal_undo(Journal *j, const SimShape *shape, SimState *s);
+
+// Apply the move undone last to s. Returns its sim_step() flags, 0 if there is
+// nothing to redo.
+int journal_redo(Journal *j, const SimLevel *sl, SimState *s);
+
+// Bytes the entries use, undo and redo alike
+size_t journal_bytes(const Journal *j);
+
+#endif
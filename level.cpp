@@ -0,0 +1,381 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "level.h"
+
+using namespace std;
+
+// Link tables set after loading; keeps the storage of the tiles alive
+struct LevelLinks {
+    shared_ptr<void> tiles;
+    vector<LevelSwitch> switches;
+    vector<uint32_t> links;
+};
+
+// A binary level file mapped by level_map()
+struct LevelMapping {
+    void *addr;
+    size_t size;
+    ~LevelMapping() { munmap(addr, size); }
+};
+
+static size_t grid_size(const Level *lvl)
+{
+    return (size_t) (lvl->size_x + 2*LEVEL_BORDER) * lvl->stride;
+}
+
+void level_init(Level *lvl, int size_x, int size_z)
+{
+    lvl->size_x = size_x;
+    lvl->size_z = size_z;
+    lvl->stride = size_z + 2*LEVEL_BORDER;
+    lvl->start_x = 0;
+    lvl->start_z = 0;
+    lvl->goal_x = -1;
+    lvl->goal_z = -1;
+    shared_ptr< vector<unsigned char> > tiles = make_shared< vector<unsigned char> >(grid_size(lvl), TILE_VOID);
+    lvl->tiles = tiles->data();
+    lvl->num_switches = 0;
+    lvl->num_links = 0;
+    lvl->switches = NULL;
+    lvl->links = NULL;
+    lvl->storage = tiles;
+}
+
+void level_set_links(Level *lvl, const vector<LevelSwitch> &switches, const vector<uint32_t> &links)
+{
+    shared_ptr<LevelLinks> owner = make_shared<LevelLinks>();
+    owner->tiles = lvl->storage;
+    owner->switches = switches;
+    owner->links = links;
+    lvl->num_switches = switches.size();
+    lvl->num_links = links.size();
+    lvl->switches = owner->switches.data();
+    lvl->links = owner->links.data();
+    lvl->storage = owner;
+}
+
+// Append one range of links shared by all buttons, with every bridge in it
+static void default_links(const Level *lvl, vector<LevelSwitch> *switches, vector<uint32_t> *links)
+{
+    uint32_t first = links->size();
+    for(size_t i = 0; i < grid_size(lvl); i++)
+        if(lvl->tiles[i] == TILE_BRIDGE || lvl->tiles[i] == TILE_FRAGILE_BRIDGE)
+            links->push_back(i);
+    for(size_t i = 0; i < grid_size(lvl); i++)
+        if(lvl->tiles[i] == TILE_BUTTON)
+        {
+            LevelSwitch sw = { (uint32_t) i, first, (uint32_t) links->size() - first, 0 };
+            switches->push_back(sw);
+        }
+}
+
+void level_default_links(Level *lvl)
+{
+    vector<LevelSwitch> switches;
+    vector<uint32_t> links;
+    default_links(lvl, &switches, &links);
+    level_set_links(lvl, switches, links);
+}
+
+int level_load(const char *path, Level *lvl)
+{
+    FILE *fp = fopen(path, "r");
+    if(fp == NULL)
+        return 0;
+
+    vector<string> rows, link_lines, timer_lines;
+    vector<int> linenos, link_linenos, timer_linenos;
+    size_t size_z = 0;
+    char *line = NULL;
+    size_t capacity = 0;
+    int lineno = 0;
+    while(getline(&line, &capacity, fp) != -1)
+    {
+        lineno++;
+        if(line[0] == '#')
+            continue;
+        size_t len = strcspn(line, "\r\n");
+        if(len == 0)
+            continue;
+        if(strncmp(line, "link ", 5) == 0)
+        {
+            link_lines.push_back(string(line + 5, len - 5));
+            link_linenos.push_back(lineno);
+            continue;
+        }
+        if(strncmp(line, "timer ", 6) == 0)
+        {
+            timer_lines.push_back(string(line + 6, len - 6));
+            timer_linenos.push_back(lineno);
+            continue;
+        }
+        rows.push_back(string(line, len));
+        linenos.push_back(lineno);
+        size_z = max(size_z, len);
+    }
+    free(line);
+    fclose(fp);
+
+    if(rows.empty())
+    {
+        fprintf(stderr, "%s: empty level\n", path);
+        return 0;
+    }
+
+    level_init(lvl, rows.size(), size_z);
+    for(size_t x = 0; x < rows.size(); x++)
+    {
+        for(size_t z = 0; z < rows[x].size(); z++)
+        {
+            int tile = level_tile_from_char(rows[x][z]);
+            if(tile < 0)
+            {
+                fprintf(stderr, "%s:%d: unknown tile '%c'\n", path, linenos[x], rows[x][z]);
+                return 0;
+            }
+            if(rows[x][z] == 'S')
+            {
+                lvl->start_x = x;
+                lvl->start_z = z;
+            }
+            if(tile == TILE_GOAL && lvl->goal_x < 0)
+            {
+                lvl->goal_x = x;
+                lvl->goal_z = z;
+            }
+            lvl->tiles[level_index(lvl, x, z)] = tile;
+        }
+    }
+
+    vector<LevelSwitch> switches;
+    vector<uint32_t> links;
+    int linked_buttons = 0;
+    for(size_t k = 0; k < link_lines.size(); k++)
+    {
+        const char *p = link_lines[k].c_str();
+        int x, z, used = -1;
+        if(sscanf(p, "%d %d :%n", &x, &z, &used) != 2 || used < 0 || x < 0 || x >= lvl->size_x || z < 0 || z >= lvl->size_z ||
+           (level_tile(lvl, x, z) != TILE_BUTTON && level_tile(lvl, x, z) != TILE_TELEPORT))
+        {
+            fprintf(stderr, "%s:%d: link needs the position of a button or teleporter\n", path, link_linenos[k]);
+            return 0;
+        }
+        LevelSwitch sw = { (uint32_t) level_index(lvl, x, z), (uint32_t) links.size(), 0, 0 };
+        int teleporter = level_tile(lvl, x, z) == TILE_TELEPORT;
+        for(p += used; sscanf(p, "%d %d%n", &x, &z, &used) == 2; p += strspn(p, " \t,"))
+        {
+            p += used;
+            if(x < 0 || x >= lvl->size_x || z < 0 || z >= lvl->size_z)
+            {
+                fprintf(stderr, "%s:%d: linked tile %d %d outside the level\n", path, link_linenos[k], x, z);
+                return 0;
+            }
+            links.push_back(level_index(lvl, x, z));
+            sw.num_links++;
+        }
+        if(teleporter && sw.num_links == 0)
+        {
+            fprintf(stderr, "%s:%d: teleporter without a destination\n", path, link_linenos[k]);
+            return 0;
+        }
+        switches.push_back(sw);
+        linked_buttons += !teleporter;
+    }
+    if(linked_buttons == 0)
+        default_links(lvl, &switches, &links);
+    for(size_t k = 0; k < timer_lines.size(); k++)
+    {
+        int x, z, duration;
+        size_t i = 0;
+        if(sscanf(timer_lines[k].c_str(), "%d %d %d", &x, &z, &duration) == 3 && duration > 0 &&
+           x >= 0 && x < lvl->size_x && z >= 0 && z < lvl->size_z && level_tile(lvl, x, z) == TILE_BUTTON)
+            while(i < switches.size() && switches[i].tile != (uint32_t) level_index(lvl, x, z))
+                i++;
+        else
+            i = switches.size();
+        if(i == switches.size())
+        {
+            fprintf(stderr, "%s:%d: timer needs the position of a linked button and a number of moves\n", path, timer_linenos[k]);
+            return 0;
+        }
+        switches[i].duration = duration;
+    }
+    level_set_links(lvl, switches, links);
+    return 1;
+}
+
+static size_t align_up(size_t n, size_t a)
+{
+    return (n + a - 1) / a * a;
+}
+
+void level_image(const Level *lvl, vector<unsigned char> *image)
+{
+    LevelFileHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, LEVEL_FILE_MAGIC, 4);
+    h.version = LEVEL_FILE_VERSION;
+    h.size_x = lvl->size_x;
+    h.size_z = lvl->size_z;
+    h.stride = lvl->stride;
+    h.start_x = lvl->start_x;
+    h.start_z = lvl->start_z;
+    h.goal_x = lvl->goal_x;
+    h.goal_z = lvl->goal_z;
+    h.num_switches = lvl->num_switches;
+    h.num_links = lvl->num_links;
+    h.tiles_offset = align_up(sizeof(h), 64);
+    h.switches_offset = align_up(h.tiles_offset + grid_size(lvl), 8);
+    h.links_offset = h.switches_offset + lvl->num_switches * sizeof(LevelSwitch);
+
+    // Padding stays zero
+    image->assign(h.links_offset + lvl->num_links * sizeof(uint32_t), 0);
+    unsigned char *p = image->data();
+    memcpy(p, &h, sizeof(h));
+    memcpy(p + h.tiles_offset, lvl->tiles, grid_size(lvl));
+    if(lvl->num_switches)
+        memcpy(p + h.switches_offset, lvl->switches, lvl->num_switches * sizeof(LevelSwitch));
+    if(lvl->num_links)
+        memcpy(p + h.links_offset, lvl->links, lvl->num_links * sizeof(uint32_t));
+}
+
+int level_save(const char *path, const Level *lvl)
+{
+    vector<unsigned char> image;
+    level_image(lvl, &image);
+
+    string tmp = string(path) + ".tmp";
+    FILE *fp = fopen(tmp.c_str(), "wb");
+    if(fp == NULL)
+        return 0;
+    int ok = fwrite(image.data(), image.size(), 1, fp) == 1;
+    if(fclose(fp) != 0)
+        ok = 0;
+    if(!ok || rename(tmp.c_str(), path) != 0)
+    {
+        unlink(tmp.c_str());
+        return 0;
+    }
+    return 1;
+}
+
+// Everything a mapped file must satisfy before its pointers are handed out
+static const char *check_header(const LevelFileHeader *h, size_t file_size)
+{
+    if(memcmp(h->magic, LEVEL_FILE_MAGIC, 4) != 0)
+        return "not a level file";
+    if(h->version != LEVEL_FILE_VERSION)
+        return "unsupported version";
+    if(h->size_x <= 0 || h->size_z <= 0 || h->size_x > 65536 || h->size_z > 65536 ||
+       h->stride != h->size_z + 2*LEVEL_BORDER)
+        return "bad dimensions";
+    // level_index() is an int, so the padded grid must fit one
+    uint64_t grid = (uint64_t) (h->size_x + 2*LEVEL_BORDER) * h->stride;
+    if(grid > INT32_MAX)
+        return "bad dimensions";
+    if(h->start_x < 0 || h->start_x >= h->size_x || h->start_z < 0 || h->start_z >= h->size_z)
+        return "start outside the level";
+    if(h->tiles_offset < sizeof(*h) || h->tiles_offset + grid > file_size)
+        return "tiles past the end of the file";
+    if(h->switches_offset % 4 || h->switches_offset + (uint64_t) h->num_switches * sizeof(LevelSwitch) > file_size)
+        return "switches past the end of the file";
+    if(h->links_offset % 4 || h->links_offset + (uint64_t) h->num_links * sizeof(uint32_t) > file_size)
+        return "links past the end of the file";
+    return NULL;
+}
+
+int level_map(const char *path, Level *lvl)
+{
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
+        return 0;
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(LevelFileHeader))
+    {
+        close(fd);
+        fprintf(stderr, "%s: not a level file\n", path);
+        return 0;
+    }
+    // Private and writable: tile changes at run time copy the page instead of reaching the file
+    void *addr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(addr == MAP_FAILED)
+        return 0;
+    shared_ptr<LevelMapping> mapping = make_shared<LevelMapping>();
+    mapping->addr = addr;
+    mapping->size = st.st_size;
+    return level_from_image(path, (unsigned char*) addr, st.st_size, mapping, lvl);
+}
+
+int level_from_image(const char *name, unsigned char *base, size_t size, shared_ptr<void> owner, Level *lvl)
+{
+    if(size < sizeof(LevelFileHeader))
+    {
+        fprintf(stderr, "%s: not a level file\n", name);
+        return 0;
+    }
+    const LevelFileHeader *h = (const LevelFileHeader*) base;
+    const char *error = check_header(h, size);
+    if(error)
+    {
+        fprintf(stderr, "%s: %s\n", name, error);
+        return 0;
+    }
+
+    Level l;
+    l.size_x = h->size_x;
+    l.size_z = h->size_z;
+    l.stride = h->stride;
+    l.start_x = h->start_x;
+    l.start_z = h->start_z;
+    l.goal_x = h->goal_x;
+    l.goal_z = h->goal_z;
+    l.tiles = base + h->tiles_offset;
+    l.num_switches = h->num_switches;
+    l.num_links = h->num_links;
+    l.switches = (const LevelSwitch*) (base + h->switches_offset);
+    l.links = (const uint32_t*) (base + h->links_offset);
+    l.storage = owner;
+
+    // Indices in the link tables must stay inside the grid
+    size_t grid = grid_size(&l);
+    for(int i = 0; i < l.num_switches; i++)
+        if(l.switches[i].tile >= grid || l.switches[i].first_link > (uint32_t) l.num_links ||
+           l.switches[i].num_links > (uint32_t) l.num_links - l.switches[i].first_link)
+        {
+            fprintf(stderr, "%s: bad switch %d\n", name, i);
+            return 0;
+        }
+    for(int i = 0; i < l.num_links; i++)
+        if(l.links[i] >= grid)
+        {
+            fprintf(stderr, "%s: bad link %d\n", name, i);
+            return 0;
+        }
+
+    // The rules only skip bounds checks because the border is void
+    size_t rows = l.size_x + 2*LEVEL_BORDER;
+    for(size_t r = 0; r < rows; r++)
+    {
+        const unsigned char *row = l.tiles + r * l.stride;
+        int border_row = r < LEVEL_BORDER || r >= rows - LEVEL_BORDER;
+        int checked = border_row ? l.stride : LEVEL_BORDER;
+        for(int k = 0; k < checked; k++)
+            if(row[k] != TILE_VOID || (!border_row && row[l.stride - 1 - k] != TILE_VOID))
+            {
+                fprintf(stderr, "%s: border is not void\n", name);
+                return 0;
+            }
+    }
+
+    *lvl = l;
+    return 1;
+}
@@ -0,0 +1,137 @@
+#ifndef LEVEL_H
+#define LEVEL_H
+
+#include <vector>
+#include <memory>
+#include <stdint.h>
+
+// One byte per tile
+enum {
+    TILE_VOID,
+    TILE_FLOOR,
+    TILE_FRAGILE,           // breaks under a standing block
+    TILE_BUTTON,            // switches its linked bridges
+    TILE_BRIDGE,            // solid only while its switches have it up
+    TILE_FRAGILE_BRIDGE,
+    TILE_GOAL,
+    TILE_CRUMBLE,           // falls away once the block has left it
+    TILE_TELEPORT,          // sends a block resting on it alone to its link
+    TILE_COUNT
+};
+
+// Void tiles around the playable area. One move shifts the block by at most two
+// tiles, so footprint lookups after a move from a valid position never leave the grid.
+#define LEVEL_BORDER 2
+
+// A button and the tiles it switches, or a teleporter and its destination
+// (the first link); a range of Level::links
+struct LevelSwitch {
+    uint32_t tile;          // level_index() of the button or teleporter
+    uint32_t first_link, num_links;
+    uint32_t duration;      // moves a timed button keeps its bridges switched, 0 toggles
+};
+
+struct Level {
+    int size_x, size_z;     // playable tiles, x is the row and z the column
+    int stride;             // size_z + 2*LEVEL_BORDER
+    int start_x, start_z;
+    int goal_x, goal_z;     // -1 if the level has no goal
+    unsigned char *tiles;   // (size_x + 2*LEVEL_BORDER) rows of stride tiles
+    int num_switches, num_links;
+    const LevelSwitch *switches;
+    const uint32_t *links;  // level_index() of switched tiles
+
+    // Owns what the pointers above point to: heap buffers or a file mapping.
+    // Copies of a Level share it. Empty for built-in levels (level_static.h),
+    // whose tables are constants.
+    std::shared_ptr<void> storage;
+};
+
+// Index of a tile in Level::tiles, valid for the playable area and the border
+inline int level_index(const Level *lvl, int x, int z)
+{
+    return (x + LEVEL_BORDER) * lvl->stride + z + LEVEL_BORDER;
+}
+
+// Inverse of level_index()
+inline void level_coords(const Level *lvl, int index, int *x, int *z)
+{
+    *x = index / lvl->stride - LEVEL_BORDER;
+    *z = index % lvl->stride - LEVEL_BORDER;
+}
+
+inline int level_tile(const Level *lvl, int x, int z)
+{
+    return lvl->tiles[level_index(lvl, x, z)];
+}
+
+// Make lvl an empty (all void) level of the given size, without switches
+void level_init(Level *lvl, int size_x, int size_z);
+
+// Replace the link tables; switches[i].first_link/num_links index links
+void level_set_links(Level *lvl, const std::vector<LevelSwitch> &switches, const std::vector<uint32_t> &links);
+
+// Link every button to every bridge tile, the classic rule
+void level_default_links(Level *lvl);
+
+// Tile of a text level character, -1 if the character is not a tile
+constexpr int level_tile_from_char(char c)
+{
+    return c == '.' ? TILE_VOID :
+           c == 'o' || c == 'S' ? TILE_FLOOR :
+           c == 'f' ? TILE_FRAGILE :
+           c == 'b' ? TILE_BUTTON :
+           c == '=' ? TILE_BRIDGE :
+           c == 'x' ? TILE_FRAGILE_BRIDGE :
+           c == 'G' ? TILE_GOAL :
+           c == 'c' ? TILE_CRUMBLE :
+           c == 't' ? TILE_TELEPORT : -1;
+}
+
+/* Text level format, one line per row (x), one character per tile (z):
+     .  void            o  floor           S  floor, start position
+     f  fragile floor   b  bridge button   =  bridge
+     x  fragile bridge  G  goal            c  crumbling floor
+     t  teleporter
+   Lines starting with '#' are comments. The first G is the goal.
+   A line "link X Z: X Z, X Z, ..." makes the button at X Z switch the listed
+   tiles; without link lines for buttons every button switches every bridge. For a
+   teleporter at X Z the first listed tile is its destination.
+   "timer X Z N" makes the button at X Z switch its tiles for N moves only.
+   Returns 0 if the file cannot be used. */
+int level_load(const char *path, Level *lvl);
+
+/* Binary level format, native byte order. The file is the in-memory layout:
+   a LevelFileHeader, the padded tile grid exactly as Level::tiles, then the
+   LevelSwitch table and the links, each at the offset the header gives. */
+#define LEVEL_FILE_MAGIC "BLXL"
+#define LEVEL_FILE_VERSION 2
+
+struct LevelFileHeader {
+    char magic[4];
+    uint32_t version;
+    int32_t size_x, size_z, stride;
+    int32_t start_x, start_z;
+    int32_t goal_x, goal_z;
+    uint32_t num_switches, num_links;
+    uint32_t reserved;
+    uint64_t tiles_offset, switches_offset, links_offset;
+};
+
+// Serialize lvl in the binary format
+void level_image(const Level *lvl, std::vector<unsigned char> *image);
+
+// Write lvl as a binary level. The file is written next to path and renamed
+// over it, so a game that has the old version mapped keeps a valid copy.
+int level_save(const char *path, const Level *lvl);
+
+// Map a binary level without copying or parsing the tiles. Only the header,
+// the link tables and the void border are checked; sim_prepare() rejects tiles
+// not below TILE_COUNT. Changes to lvl->tiles stay private to the process.
+int level_map(const char *path, Level *lvl);
+
+// Point lvl into a binary level image already in memory, with the checks of
+// level_map(). owner keeps the image alive; name is used in error messages.
+int level_from_image(const char *name, unsigned char *image, size_t size, std::shared_ptr<void> owner, Level *lvl);
+
+#endif
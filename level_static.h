@@ -0,0 +1,144 @@
+#ifndef LEVEL_STATIC_H
+#define LEVEL_STATIC_H
+
+#include "level.h"
+
+/* Levels built at compile time from rows in the text format (see level.h), e.g.
+
+     constexpr char level1_rows[][11] = { "So...", ... };
+     constexpr auto level1 = STATIC_LEVEL(level1_rows);
+     CHECK_STATIC_LEVEL(level1_rows, level1);
+
+   The result holds the padded tile grid and the link tables exactly as
+   level_load() would build them, as a constant in read-only data. */
+
+// Rows are string literals of equal length, the length is the level's size_z
+template<int SX, int W>
+constexpr int static_count(const char (&rows)[SX][W], char c)
+{
+    int n = 0;
+    for(int x = 0; x < SX; x++)
+        for(int z = 0; z < W - 1; z++)
+            n += rows[x][z] == c;
+    return n;
+}
+
+// Every character is a tile and no row is shorter than the others
+template<int SX, int W>
+constexpr bool static_rows_valid(const char (&rows)[SX][W])
+{
+    for(int x = 0; x < SX; x++)
+        for(int z = 0; z < W - 1; z++)
+            if(rows[x][z] == '\0' || level_tile_from_char(rows[x][z]) < 0)
+                return false;
+    return true;
+}
+
+template<int SX, int SZ, int NS, int NL>
+struct StaticLevel {
+    static constexpr int size_x = SX, size_z = SZ;
+    static constexpr int stride = SZ + 2*LEVEL_BORDER;
+    static constexpr int num_switches = NS, num_links = NL;
+
+    int start_x, start_z;
+    int goal_x, goal_z;
+    unsigned char tiles[(SX + 2*LEVEL_BORDER) * stride];
+    LevelSwitch switches[NS > 0 ? NS : 1];
+    uint32_t links[NL > 0 ? NL : 1];
+
+    constexpr int index(int x, int z) const { return (x + LEVEL_BORDER) * stride + z + LEVEL_BORDER; }
+
+    constexpr bool border_sealed() const
+    {
+        for(int r = 0; r < SX + 2*LEVEL_BORDER; r++)
+            for(int c = 0; c < stride; c++)
+            {
+                bool inside = r >= LEVEL_BORDER && r < SX + LEVEL_BORDER && c >= LEVEL_BORDER && c < SZ + LEVEL_BORDER;
+                if(!inside && tiles[r * stride + c] != TILE_VOID)
+                    return false;
+            }
+        return true;
+    }
+
+    constexpr bool start_valid() const
+    {
+        return start_x >= 0 && start_x < SX && start_z >= 0 && start_z < SZ && tiles[index(start_x, start_z)] == TILE_FLOOR;
+    }
+
+    constexpr bool goal_valid() const
+    {
+        return goal_x >= 0 && goal_x < SX && goal_z >= 0 && goal_z < SZ && tiles[index(goal_x, goal_z)] == TILE_GOAL &&
+               (goal_x != start_x || goal_z != start_z);
+    }
+};
+
+// Same tiles, start, goal and links (level_default_links()) as level_load()
+template<int NS, int NL, int SX, int W>
+constexpr StaticLevel<SX, W - 1, NS, NL> static_level(const char (&rows)[SX][W])
+{
+    StaticLevel<SX, W - 1, NS, NL> l {};
+    l.start_x = l.start_z = l.goal_x = l.goal_z = -1;
+    for(int x = 0; x < SX; x++)
+        for(int z = 0; z < W - 1; z++)
+        {
+            int tile = level_tile_from_char(rows[x][z]);
+            l.tiles[l.index(x, z)] = tile < 0 ? TILE_VOID : tile;
+            if(rows[x][z] == 'S')
+            {
+                l.start_x = x;
+                l.start_z = z;
+            }
+            if(tile == TILE_GOAL && l.goal_x < 0)
+            {
+                l.goal_x = x;
+                l.goal_z = z;
+            }
+        }
+
+    int ns = 0, nl = 0;
+    for(int i = 0; i < (SX + 2*LEVEL_BORDER) * l.stride; i++)
+        if(l.tiles[i] == TILE_BRIDGE || l.tiles[i] == TILE_FRAGILE_BRIDGE)
+            l.links[nl++] = i;
+    for(int i = 0; i < (SX + 2*LEVEL_BORDER) * l.stride; i++)
+        if(l.tiles[i] == TILE_BUTTON)
+        {
+            l.switches[ns].tile = i;
+            l.switches[ns].first_link = 0;
+            l.switches[ns].num_links = NL;
+            l.switches[ns].duration = 0;
+            ns++;
+        }
+    return l;
+}
+
+#define STATIC_LEVEL(rows) \
+    static_level<static_count(rows, 'b'), static_count(rows, '=') + static_count(rows, 'x')>(rows)
+
+#define CHECK_STATIC_LEVEL(rows, lvl) \
+    static_assert(static_rows_valid(rows), #rows ": unknown tile character or short row"); \
+    static_assert(static_count(rows, 'S') == 1, #rows ": needs exactly one start"); \
+    static_assert(static_count(rows, 't') == 0, #rows ": teleporters need link lines, use a level file"); \
+    static_assert((lvl).start_valid(), #rows ": start is not on the level"); \
+    static_assert((lvl).goal_valid(), #rows ": needs a goal apart from the start"); \
+    static_assert((lvl).border_sealed(), #rows ": border is not void")
+
+// Point lvl at a compile-time level without copying it. The tiles are read-only.
+template<int SX, int SZ, int NS, int NL>
+void level_from_static(const StaticLevel<SX, SZ, NS, NL> &s, Level *lvl)
+{
+    lvl->size_x = SX;
+    lvl->size_z = SZ;
+    lvl->stride = s.stride;
+    lvl->start_x = s.start_x;
+    lvl->start_z = s.start_z;
+    lvl->goal_x = s.goal_x;
+    lvl->goal_z = s.goal_z;
+    lvl->tiles = const_cast<unsigned char*>(s.tiles);
+    lvl->num_switches = NS;
+    lvl->num_links = NL;
+    lvl->switches = s.switches;
+    lvl->links = s.links;
+    lvl->storage.reset();
+}
+
+#endif
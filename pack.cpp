@@ -0,0 +1,214 @@
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <lz4.h>
+
+#include "pack.h"
+
+using namespace std;
+
+struct LevelPack {
+    string path;
+    const unsigned char *base;
+    size_t size;
+    const PackEntry *toc;
+    uint32_t num_levels;
+};
+
+static double ms_since(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+LevelPack *pack_open(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
+        return NULL;
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(PackHeader))
+    {
+        close(fd);
+        fprintf(stderr, "%s: not a level pack\n", path);
+        return NULL;
+    }
+    void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(addr == MAP_FAILED)
+        return NULL;
+
+    const PackHeader *h = (const PackHeader*) addr;
+    const char *error = NULL;
+    if(memcmp(h->magic, PACK_MAGIC, 4) != 0)
+        error = "not a level pack";
+    else if(h->version != PACK_VERSION)
+        error = "unsupported version";
+    else if(h->toc_offset % 8 || h->toc_offset + (uint64_t) h->num_levels * sizeof(PackEntry) > (uint64_t) st.st_size)
+        error = "table of contents past the end of the file";
+    else
+    {
+        // Numbers positive and strictly increasing, so lookups and walks over them end
+        const PackEntry *toc = (const PackEntry*) ((const unsigned char*) addr + h->toc_offset);
+        for(uint32_t i = 0; i < h->num_levels && !error; i++)
+            if((int32_t) toc[i].number <= 0 || (i > 0 && toc[i].number <= toc[i-1].number))
+                error = "level numbers in the table of contents not positive, sorted and unique";
+    }
+    if(error)
+    {
+        fprintf(stderr, "%s: %s\n", path, error);
+        munmap(addr, st.st_size);
+        return NULL;
+    }
+
+    LevelPack *pack = new LevelPack;
+    pack->path = path;
+    pack->base = (const unsigned char*) addr;
+    pack->size = st.st_size;
+    pack->toc = (const PackEntry*) (pack->base + h->toc_offset);
+    pack->num_levels = h->num_levels;
+    return pack;
+}
+
+void pack_close(LevelPack *pack)
+{
+    if(pack == NULL)
+        return;
+    munmap((void*) pack->base, pack->size);
+    delete pack;
+}
+
+int pack_num_levels(const LevelPack *pack)
+{
+    return pack->num_levels;
+}
+
+int pack_level_number(const LevelPack *pack, int i)
+{
+    return pack->toc[i].number;
+}
+
+static const PackEntry *find_entry(const LevelPack *pack, int number)
+{
+    const PackEntry *end = pack->toc + pack->num_levels;
+    const PackEntry *e = lower_bound(pack->toc, end, (uint32_t) number,
+                                     [](const PackEntry &a, uint32_t n) { return a.number < n; });
+    return e != end && e->number == (uint32_t) number ? e : NULL;
+}
+
+int pack_has_level(const LevelPack *pack, int number)
+{
+    return number > 0 && find_entry(pack, number) != NULL;
+}
+
+size_t pack_level_size(const LevelPack *pack, int number)
+{
+    const PackEntry *e = number > 0 ? find_entry(pack, number) : NULL;
+    return e ? e->size : 0;
+}
+
+int pack_load(const LevelPack *pack, int number, Level *lvl, PackLoadStats *stats)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    const PackEntry *e = number > 0 ? find_entry(pack, number) : NULL;
+    if(e == NULL)
+        return 0;
+
+    char name[256];
+    snprintf(name, sizeof(name), "%s:%d", pack->path.c_str(), number);
+    if(e->offset > pack->size || e->compressed_size > pack->size - e->offset ||
+       e->compressed_size > (uint32_t) LZ4_compressBound(e->size) || e->size > (1u << 31) - 1)
+    {
+        fprintf(stderr, "%s: entry past the end of the pack\n", name);
+        return 0;
+    }
+    double lookup_ms = ms_since(start);
+
+    start = chrono::steady_clock::now();
+    shared_ptr< vector<unsigned char> > image = make_shared< vector<unsigned char> >(e->size);
+    int got = LZ4_decompress_safe((const char*) pack->base + e->offset, (char*) image->data(),
+                                  e->compressed_size, e->size);
+    if(got != (int) e->size)
+    {
+        fprintf(stderr, "%s: corrupt level data\n", name);
+        return 0;
+    }
+    double decompress_ms = ms_since(start);
+
+    if(!level_from_image(name, image->data(), image->size(), image, lvl))
+        return 0;
+    if(stats)
+    {
+        stats->lookup_ms = lookup_ms;
+        stats->decompress_ms = decompress_ms;
+        stats->compressed_size = e->compressed_size;
+        stats->size = e->size;
+    }
+    return 1;
+}
+
+int pack_save(const char *path, const vector<Level> &levels, const vector<int> &numbers)
+{
+    // Entries are sorted so pack_load() can binary search them
+    vector<size_t> order(levels.size());
+    for(size_t i = 0; i < order.size(); i++)
+        order[i] = i;
+    sort(order.begin(), order.end(), [&](size_t a, size_t b) { return numbers[a] < numbers[b]; });
+
+    vector<PackEntry> toc;
+    vector<char> blobs;
+    vector<unsigned char> image;
+    for(size_t k = 0; k < order.size(); k++)
+    {
+        size_t i = order[k];
+        if(numbers[i] <= 0 || (k > 0 && numbers[i] == numbers[order[k-1]]))
+        {
+            fprintf(stderr, "%s: level number %d is invalid or repeated\n", path, numbers[i]);
+            return 0;
+        }
+        level_image(&levels[i], &image);
+        PackEntry e;
+        memset(&e, 0, sizeof(e));
+        e.number = numbers[i];
+        e.size = image.size();
+        e.offset = sizeof(PackHeader) + blobs.size();
+        blobs.resize(blobs.size() + LZ4_compressBound(image.size()));
+        e.compressed_size = LZ4_compress_default((const char*) image.data(), &blobs[e.offset - sizeof(PackHeader)],
+                                                 image.size(), LZ4_compressBound(image.size()));
+        if(e.compressed_size == 0)
+            return 0;
+        blobs.resize(e.offset - sizeof(PackHeader) + e.compressed_size);
+        toc.push_back(e);
+    }
+    blobs.resize((blobs.size() + 7) / 8 * 8);
+
+    PackHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, PACK_MAGIC, 4);
+    h.version = PACK_VERSION;
+    h.num_levels = toc.size();
+    h.toc_offset = sizeof(h) + blobs.size();
+
+    string tmp = string(path) + ".tmp";
+    FILE *fp = fopen(tmp.c_str(), "wb");
+    if(fp == NULL)
+        return 0;
+    int ok = fwrite(&h, sizeof(h), 1, fp) == 1 &&
+        (blobs.empty() || fwrite(blobs.data(), blobs.size(), 1, fp) == 1) &&
+        (toc.empty() || fwrite(toc.data(), sizeof(PackEntry), toc.size(), fp) == toc.size());
+    if(fclose(fp) != 0)
+        ok = 0;
+    if(!ok || rename(tmp.c_str(), path) != 0)
+    {
+        unlink(tmp.c_str());
+        return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,63 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include <vector>
+
+#include "level.h"
+
+/* Level pack: many levels in one file, each an LZ4-compressed binary level
+   image (see level.h). Native byte order:
+     PackHeader
+     PackEntry[num_levels] at toc_offset, sorted by number
+     compressed blobs at the offsets the entries give
+   Opening a pack maps it and checks the header and the level numbers in the
+   table of contents, without touching the levels; a level is decompressed
+   when it is loaded. */
+#define PACK_MAGIC "BLXP"
+#define PACK_VERSION 1
+
+struct PackHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t num_levels;
+    uint32_t reserved;
+    uint64_t toc_offset;
+};
+
+struct PackEntry {
+    uint32_t number;
+    uint32_t size;              // of the decompressed level image
+    uint64_t offset;
+    uint32_t compressed_size;
+    uint32_t reserved;
+};
+
+struct LevelPack;
+
+// Timings of one pack_load()
+struct PackLoadStats {
+    double lookup_ms, decompress_ms;
+    size_t compressed_size, size;
+};
+
+LevelPack *pack_open(const char *path);
+void pack_close(LevelPack *pack);
+
+int pack_num_levels(const LevelPack *pack);
+int pack_has_level(const LevelPack *pack, int number);
+
+// Number of the i-th level, 0 <= i < pack_num_levels(); numbers increase with i
+int pack_level_number(const LevelPack *pack, int i);
+
+// Bytes of the decompressed level image, from the table of contents; 0 if the
+// pack has no such level
+size_t pack_level_size(const LevelPack *pack, int number);
+
+// Decompress level number into lvl. Safe to call from several threads at once.
+// stats may be NULL. Returns 0 if the pack has no such level or it is damaged.
+int pack_load(const LevelPack *pack, int number, Level *lvl, PackLoadStats *stats);
+
+// Write a pack of the given levels, numbers[i] being the number of levels[i]
+int pack_save(const char *path, const std::vector<Level> &levels, const std::vector<int> &numbers);
+
+#endif
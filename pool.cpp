@@ -0,0 +1,177 @@
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "pool.h"
+
+using namespace std;
+
+struct WorkQueue {
+    mutex lock;
+    deque<int> tasks;
+};
+
+struct Pool {
+    int threads;
+    vector<WorkQueue> queues;
+    vector<uint64_t> steals;
+    vector<thread> workers;
+
+    // Workers 1.. wait for the next run, worker 0 for the end of this one
+    mutex lock;
+    condition_variable wake, done;
+    const function<void(int, int)> *task;
+    uint64_t run;               // runs started
+    int running;                // workers 1.. still in this run
+    int stopping;
+};
+
+// Half of victim's tasks, from the back, into thief's queue
+static int steal(WorkQueue *victim, WorkQueue *thief)
+{
+    vector<int> taken;
+    {
+        lock_guard<mutex> l(victim->lock);
+        size_t n = (victim->tasks.size() + 1) / 2;
+        for(size_t i = 0; i < n; i++)
+        {
+            taken.push_back(victim->tasks.back());
+            victim->tasks.pop_back();
+        }
+    }
+    if(taken.empty())
+        return 0;
+    lock_guard<mutex> l(thief->lock);
+    for(size_t i = taken.size(); i-- > 0;)
+        thief->tasks.push_back(taken[i]);
+    return 1;
+}
+
+// Run tasks until every queue is empty
+static void work(Pool *pool, int w)
+{
+    int n = pool->threads;
+    WorkQueue *own = &pool->queues[w];
+    for(;;)
+    {
+        int index = -1;
+        {
+            lock_guard<mutex> l(own->lock);
+            if(!own->tasks.empty())
+            {
+                index = own->tasks.front();
+                own->tasks.pop_front();
+            }
+        }
+        if(index >= 0)
+        {
+            (*pool->task)(index, w);
+            continue;
+        }
+        int stolen = 0;
+        for(int i = 1; i < n && !stolen; i++)
+            stolen = steal(&pool->queues[(w + i) % n], own);
+        if(!stolen)
+            return;
+        pool->steals[w]++;
+    }
+}
+
+static void worker(Pool *pool, int w)
+{
+    uint64_t seen = 0;
+    for(;;)
+    {
+        {
+            unique_lock<mutex> l(pool->lock);
+            pool->wake.wait(l, [&]{ return pool->stopping || pool->run != seen; });
+            if(pool->stopping)
+                return;
+            seen = pool->run;
+        }
+        work(pool, w);
+        lock_guard<mutex> l(pool->lock);
+        if(--pool->running == 0)
+            pool->done.notify_one();
+    }
+}
+
+int pool_default_threads()
+{
+    int n = thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
+
+Pool *pool_start(int threads)
+{
+    Pool *pool = new Pool;
+    pool->threads = threads > 0 ? threads : pool_default_threads();
+    pool->queues = vector<WorkQueue>(pool->threads);
+    pool->steals.assign(pool->threads, 0);
+    pool->task = NULL;
+    pool->run = 0;
+    pool->running = 0;
+    pool->stopping = 0;
+    for(int w = 1; w < pool->threads; w++)
+        pool->workers.push_back(thread(worker, pool, w));
+    return pool;
+}
+
+void pool_stop(Pool *pool)
+{
+    {
+        lock_guard<mutex> l(pool->lock);
+        pool->stopping = 1;
+    }
+    pool->wake.notify_all();
+    for(size_t i = 0; i < pool->workers.size(); i++)
+        pool->workers[i].join();
+    delete pool;
+}
+
+int pool_threads(const Pool *pool)
+{
+    return pool->threads;
+}
+
+void pool_run_on(Pool *pool, int num_tasks, const function<void(int, int)> &task, PoolStats *stats)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    int threads = pool->threads;
+    for(int i = 0; i < num_tasks; i++)
+        pool->queues[i % threads].tasks.push_back(i);
+    pool->steals.assign(threads, 0);
+
+    // The calling thread is worker 0
+    {
+        lock_guard<mutex> l(pool->lock);
+        pool->task = &task;
+        pool->running = threads - 1;
+        pool->run++;
+    }
+    pool->wake.notify_all();
+    work(pool, 0);
+    {
+        unique_lock<mutex> l(pool->lock);
+        pool->done.wait(l, [&]{ return pool->running == 0; });
+    }
+
+    if(stats)
+    {
+        stats->threads = threads;
+        stats->steals = 0;
+        for(int w = 0; w < threads; w++)
+            stats->steals += pool->steals[w];
+        stats->seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+}
+
+void pool_run(int num_tasks, int threads, const function<void(int, int)> &task, PoolStats *stats)
+{
+    Pool *pool = pool_start(threads);
+    pool_run_on(pool, num_tasks, task, stats);
+    pool_stop(pool);
+}
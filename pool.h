@@ -0,0 +1,35 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <functional>
+#include <stdint.h>
+
+/* Run tasks 0 .. num_tasks-1 on a pool of threads with work stealing. The
+   tasks are dealt out round robin, so worker w starts with w, w + threads, ...
+   and callers that know which tasks are big put them first. A worker takes
+   its own tasks from the front; once it has none left it takes half of the
+   remaining tasks of another worker from the back. Tasks never add tasks, so a
+   worker that finds every queue empty is done. */
+struct PoolStats {
+    int threads;
+    uint64_t steals;        // times a worker took tasks from another
+    double seconds;         // wall time of the whole run
+};
+
+// 0 threads means one per core. task(index, worker) may run on any thread,
+// worker being 0 .. threads-1. stats may be NULL.
+void pool_run(int num_tasks, int threads, const std::function<void(int, int)> &task, PoolStats *stats);
+
+// The same threads kept for many runs, for callers that run often and cannot
+// wait for threads to start each time. The thread calling pool_run_on() is
+// worker 0; one run at a time.
+struct Pool;
+Pool *pool_start(int threads);
+void pool_stop(Pool *pool);
+int pool_threads(const Pool *pool);
+void pool_run_on(Pool *pool, int num_tasks, const std::function<void(int, int)> &task, PoolStats *stats);
+
+// Threads pool_run() uses for 0
+int pool_default_threads();
+
+#endif
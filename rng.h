@@ -0,0 +1,21 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+
+/* Seeded random numbers for the tools, benchmarks and bots: a 64-bit LCG,
+   cheap and the same on every machine, so a seed replays the same run. */
+
+// The high bits of the next state
+static inline uint32_t next_random(uint64_t *r)
+{
+    *r = *r * 6364136223846793005ull + 1442695040888963407ull;
+    return *r >> 33;
+}
+
+static inline int random_below(uint64_t *r, int n)
+{
+    return next_random(r) % n;
+}
+
+#endif
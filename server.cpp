@@ -0,0 +1,592 @@
+// Headless game server: many sessions of the game rules in one process, moves
+// applied in ticks across a thread pool. Runs built-in bots that move every
+// session each tick and reports moves per second and tick latency for each
+// thread count, or with --listen serves bots over a Unix socket (botproto.h).
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "botproto.h"
+#include "host.h"
+#include "pack.h"
+#include "rng.h"
+
+using namespace std;
+
+// Level files or the levels of a pack, in order
+static int load_levels(const vector<const char*> &paths, vector<Level> *levels)
+{
+    for(size_t i = 0; i < paths.size(); i++)
+    {
+        const char *ext = strrchr(paths[i], '.');
+        Level lvl;
+        if(ext && strcmp(ext, ".pack") == 0)
+        {
+            LevelPack *pack = pack_open(paths[i]);
+            if(pack == NULL)
+                return 0;
+            for(int i = 0; i < pack_num_levels(pack); i++)
+            {
+                if(!pack_load(pack, pack_level_number(pack, i), &lvl, NULL))
+                    return 0;
+                levels->push_back(lvl);
+            }
+            pack_close(pack);
+        }
+        else if(ext && strcmp(ext, ".lvl") == 0 ? level_map(paths[i], &lvl) : level_load(paths[i], &lvl))
+            levels->push_back(lvl);
+        else
+        {
+            fprintf(stderr, "server: cannot load %s\n", paths[i]);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static double percentile(vector<double> v, double p)
+{
+    sort(v.begin(), v.end());
+    return v[(size_t) (p * (v.size() - 1))];
+}
+
+// Reply bytes a bot may leave unread before its requests wait for it
+#define BOT_MAX_BACKLOG (4 << 20)
+
+// A connected bot
+struct BotClient {
+    int fd;
+    vector<char> in, out;      // bytes of requests not handled yet, of replies not sent yet
+    size_t sent;                    // of out, already sent
+    vector<int> passed;        // fds that came along with the bytes, for BOT_SHM
+    char *shm;                      // BOT_STATES items go here once the bot sent one
+    size_t shm_size;
+    int more;                       // in holds requests not handled yet
+    int closing;
+    uint64_t requests, moves;
+};
+
+// A BotState to write once the tick with its move is done
+struct BotFill {
+    int client;
+    int in_shm;
+    size_t offset;                  // in the client's out or shm
+    int session;
+};
+
+struct BotServer {
+    Host host;
+    vector<BotClient> clients;
+    vector<int> owner;         // fd of the bot that opened each session, -1 if closed
+    vector<uint64_t> stamp;    // tick + 1 a session last had a move queued for
+    vector<BotFill> fills;
+    uint64_t tick, moves;
+    double busy;
+};
+
+static volatile sig_atomic_t stop_serving;
+
+static void on_stop(int)
+{
+    stop_serving = 1;
+}
+
+static void put_reply(BotClient *c, uint32_t type, uint32_t count)
+{
+    BotHeader hdr = { type, count };
+    c->out.insert(c->out.end(), (const char*) &hdr, (const char*) (&hdr + 1));
+}
+
+static void state_of(const Host *h, int session, BotState *st)
+{
+    HostSessionInfo info;
+    host_session(h, session, &info);
+    st->session = session;
+    st->x = info.state.x;
+    st->z = info.state.z;
+    st->orient = info.state.orient;
+    st->flags = info.flags;
+    st->moves = info.state.moves;
+    st->falls = info.falls;
+    st->wins = info.wins;
+}
+
+// Step what is queued and write the states of those moves
+static void bot_tick(BotServer *sv)
+{
+    if(sv->fills.empty())
+        return;
+    HostTickStats stats;
+    host_tick(&sv->host, &stats);
+    sv->moves += stats.moves;
+    sv->busy += stats.seconds;
+    for(size_t i = 0; i < sv->fills.size(); i++)
+    {
+        const BotFill &f = sv->fills[i];
+        BotClient *c = &sv->clients[f.client];
+        BotState st;
+        state_of(&sv->host, f.session, &st);
+        memcpy((f.in_shm ? c->shm : c->out.data()) + f.offset, &st, sizeof(st));
+    }
+    sv->fills.clear();
+    sv->tick++;
+}
+
+static int bot_backlogged(const BotClient *c)
+{
+    return c->out.size() - c->sent > BOT_MAX_BACKLOG;
+}
+
+static int bot_owns(const BotServer *sv, const BotClient *c, uint32_t session)
+{
+    return session < sv->owner.size() && sv->owner[session] == c->fd;
+}
+
+// The whole requests the bot has sent, up to and including one BOT_MOVES so
+// that two batches never share its shared memory, unless it has not read the
+// replies to earlier ones. Returns 0 if a request is bad.
+static int bot_requests(BotServer *sv, int ci)
+{
+    BotClient *c = &sv->clients[ci];
+    size_t used = 0;
+    int ok = 1;
+    c->more = 0;
+    if(bot_backlogged(c))
+    {
+        c->more = c->in.size() >= sizeof(BotHeader);
+        return 1;
+    }
+    while(c->in.size() - used >= sizeof(BotHeader))
+    {
+        BotHeader hdr;
+        memcpy(&hdr, &c->in[used], sizeof(hdr));
+        size_t item = hdr.type == BOT_OPEN || hdr.type == BOT_CLOSE ? sizeof(uint32_t) :
+                      hdr.type == BOT_MOVES ? sizeof(BotMove) : 0;
+        if((item == 0 && hdr.type != BOT_SHM) || hdr.count > (hdr.type == BOT_SHM ? BOT_MAX_SHM : BOT_MAX_ITEMS))
+        {
+            ok = 0;
+            break;
+        }
+        size_t size = sizeof(hdr) + item * hdr.count;
+        if(c->in.size() - used < size)
+            break;
+        const char *items = &c->in[used + sizeof(hdr)];
+        used += size;
+        c->requests++;
+
+        if(hdr.type == BOT_OPEN)
+        {
+            put_reply(c, BOT_OPENED, hdr.count);
+            for(uint32_t i = 0; i < hdr.count; i++)
+            {
+                uint32_t level;
+                memcpy(&level, items + i * item, sizeof(level));
+                int32_t id = level < sv->host.levels.size() ? host_open(&sv->host, level) : -1;
+                if(id >= 0)
+                {
+                    if(id >= (int) sv->owner.size())
+                    {
+                        sv->owner.resize(id + 1, -1);
+                        sv->stamp.resize(id + 1, 0);
+                    }
+                    sv->owner[id] = c->fd;
+                    sv->stamp[id] = 0;
+                }
+                c->out.insert(c->out.end(), (const char*) &id, (const char*) (&id + 1));
+            }
+        }
+        else if(hdr.type == BOT_CLOSE)
+        {
+            for(uint32_t i = 0; i < hdr.count; i++)
+            {
+                uint32_t session;
+                memcpy(&session, items + i * item, sizeof(session));
+                if(!bot_owns(sv, c, session))
+                    continue;
+                // A move of the batch before may still wait for its tick
+                if(sv->stamp[session] == sv->tick + 1)
+                    bot_tick(sv);
+                host_close(&sv->host, session);
+                sv->owner[session] = -1;
+            }
+            put_reply(c, BOT_CLOSED, 0);
+        }
+        else if(hdr.type == BOT_SHM)
+        {
+            // A file the bot could shrink would fault the server on its next write
+            struct stat st;
+            int seals = c->passed.empty() ? -1 : fcntl(c->passed[0], F_GET_SEALS);
+            if(seals < 0 || !(seals & F_SEAL_SHRINK) || fstat(c->passed[0], &st) < 0 ||
+               (uint64_t) st.st_size < hdr.count || hdr.count == 0)
+            {
+                ok = 0;
+                break;
+            }
+            void *addr = mmap(NULL, hdr.count, PROT_READ | PROT_WRITE, MAP_SHARED, c->passed[0], 0);
+            close(c->passed[0]);
+            c->passed.erase(c->passed.begin());
+            if(addr == MAP_FAILED)
+            {
+                ok = 0;
+                break;
+            }
+            bot_tick(sv);
+            if(c->shm)
+                munmap(c->shm, c->shm_size);
+            c->shm = (char*) addr;
+            c->shm_size = hdr.count;
+            put_reply(c, BOT_SHM_OK, 0);
+        }
+        else
+        {
+            for(uint32_t i = 0; i < hdr.count; i++)
+            {
+                BotMove m;
+                memcpy(&m, items + i * item, sizeof(m));
+                ok &= m.move < MOVE_COUNT;
+            }
+            if(!ok || (c->shm && hdr.count * sizeof(BotState) > c->shm_size))
+            {
+                ok = 0;
+                break;
+            }
+            put_reply(c, BOT_STATES, hdr.count);
+            size_t offset = c->shm ? 0 : c->out.size();
+            if(!c->shm)
+                c->out.resize(c->out.size() + hdr.count * sizeof(BotState));
+            for(uint32_t i = 0; i < hdr.count; i++, offset += sizeof(BotState))
+            {
+                BotMove m;
+                memcpy(&m, items + i * item, sizeof(m));
+                if(!bot_owns(sv, c, m.session))
+                {
+                    BotState st;
+                    memset(&st, 0, sizeof(st));
+                    st.session = -1;
+                    memcpy((c->shm ? c->shm : c->out.data()) + offset, &st, sizeof(st));
+                    continue;
+                }
+                // A second move of a session waits for the first one's tick
+                if(sv->stamp[m.session] == sv->tick + 1)
+                    bot_tick(sv);
+                sv->stamp[m.session] = sv->tick + 1;
+                host_queue(&sv->host, m.session, m.move);
+                BotFill f = { ci, c->shm != NULL, offset, (int) m.session };
+                sv->fills.push_back(f);
+                c->moves++;
+            }
+            c->more = c->in.size() - used >= sizeof(BotHeader);
+            break;
+        }
+    }
+    c->in.erase(c->in.begin(), c->in.begin() + used);
+    return ok;
+}
+
+// Whatever the bot has sent, with any fds. Returns 0 once it has gone.
+static int bot_read(BotClient *c)
+{
+    char buf[65536];
+    char control[CMSG_SPACE(4 * sizeof(int))];
+    for(;;)
+    {
+        iovec iov = { buf, sizeof(buf) };
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        ssize_t n = recvmsg(c->fd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+        if(n < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        for(cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm))
+            if(cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS)
+                for(size_t i = 0; i < (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int); i++)
+                {
+                    int fd;
+                    memcpy(&fd, CMSG_DATA(cm) + i * sizeof(int), sizeof(fd));
+                    c->passed.push_back(fd);
+                }
+        if(n == 0)
+            return 0;
+        c->in.insert(c->in.end(), buf, buf + n);
+        if(n < (ssize_t) sizeof(buf))
+            return 1;
+    }
+}
+
+// As much of the replies as the socket takes; the rest waits for POLLOUT, so a
+// bot that does not read holds up only itself. Returns 0 once it has gone.
+static int bot_write(BotClient *c)
+{
+    while(c->sent < c->out.size())
+    {
+        ssize_t n = send(c->fd, c->out.data() + c->sent, c->out.size() - c->sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if(n <= 0)
+            return 0;
+        c->sent += n;
+    }
+    // No BotFill points into out here, so the sent part can go
+    if(c->sent == c->out.size())
+    {
+        c->out.clear();
+        c->sent = 0;
+    }
+    else if(c->sent >= c->out.size() / 2)
+    {
+        c->out.erase(c->out.begin(), c->out.begin() + c->sent);
+        c->sent = 0;
+    }
+    return 1;
+}
+
+static void bot_drop(BotServer *sv, BotClient *c)
+{
+    for(size_t i = 0; i < sv->owner.size(); i++)
+        if(sv->owner[i] == c->fd)
+        {
+            host_close(&sv->host, i);
+            sv->owner[i] = -1;
+        }
+    for(size_t i = 0; i < c->passed.size(); i++)
+        close(c->passed[i]);
+    if(c->shm)
+        munmap(c->shm, c->shm_size);
+    printf("server: bot %d left after %llu requests, %llu moves\n", c->fd, (unsigned long long) c->requests,
+           (unsigned long long) c->moves);
+    close(c->fd);
+}
+
+// Serve bots on a Unix socket until SIGINT or SIGTERM. Each round reads what
+// every bot has sent, queues the moves of all of them, steps them in as few
+// ticks as the batches allow and only then replies, so bots that send at the
+// same time share ticks.
+static int serve(const char *path, const vector<Level> &levels, const int *block, int threads)
+{
+    BotServer sv;
+    host_init(&sv.host, threads);
+    for(size_t i = 0; i < levels.size(); i++)
+        if(host_add_level(&sv.host, &levels[i], block[0], block[1], block[2]) < 0)
+            return 1;
+    sv.tick = sv.moves = 0;
+    sv.busy = 0;
+
+    int lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "server: socket path too long: %s\n", path);
+        return 1;
+    }
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if(lfd < 0 || bind(lfd, (sockaddr*) &addr, sizeof(addr)) < 0 || listen(lfd, 64) < 0)
+    {
+        fprintf(stderr, "server: cannot listen on %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    printf("server: listening on %s, %zu levels, %d threads, batch code %s\n", path, levels.size(),
+           pool_threads(sv.host.pool), sim_batch_isa_name(sim_batch_isa()));
+
+    vector<pollfd> fds;
+    int more = 0;
+    while(!stop_serving)
+    {
+        fds.resize(sv.clients.size() + 1);
+        fds[0].fd = lfd;
+        fds[0].events = POLLIN;
+        for(size_t i = 0; i < sv.clients.size(); i++)
+        {
+            const BotClient *c = &sv.clients[i];
+            fds[i + 1].fd = c->fd;
+            fds[i + 1].events = (bot_backlogged(c) ? 0 : POLLIN) | (c->sent < c->out.size() ? POLLOUT : 0);
+        }
+        if(poll(fds.data(), fds.size(), more ? 0 : -1) < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            break;
+        }
+        for(size_t i = 0; i < sv.clients.size(); i++)
+            if((fds[i + 1].revents & ~POLLOUT) && !bot_read(&sv.clients[i]))
+                sv.clients[i].closing = 1;
+        if(fds[0].revents & POLLIN)
+        {
+            int fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+            if(fd >= 0)
+            {
+                BotClient c;
+                c.fd = fd;
+                c.sent = 0;
+                c.shm = NULL;
+                c.shm_size = 0;
+                c.more = c.closing = 0;
+                c.requests = c.moves = 0;
+                sv.clients.push_back(c);
+                printf("server: bot %d connected\n", fd);
+            }
+        }
+
+        more = 0;
+        for(size_t i = 0; i < sv.clients.size(); i++)
+            if(!sv.clients[i].closing && !bot_requests(&sv, i))
+            {
+                put_reply(&sv.clients[i], BOT_ERROR, 0);
+                sv.clients[i].closing = 2;
+            }
+        bot_tick(&sv);
+        for(size_t i = 0; i < sv.clients.size(); i++)
+        {
+            BotClient *c = &sv.clients[i];
+            if(c->closing != 1 && !bot_write(c))
+                c->closing = 1;
+            more |= c->more && !c->closing && !bot_backlogged(c);
+        }
+        for(size_t i = sv.clients.size(); i-- > 0;)
+            if(sv.clients[i].closing)
+            {
+                bot_drop(&sv, &sv.clients[i]);
+                sv.clients.erase(sv.clients.begin() + i);
+            }
+    }
+
+    for(size_t i = 0; i < sv.clients.size(); i++)
+        bot_drop(&sv, &sv.clients[i]);
+    close(lfd);
+    unlink(path);
+    printf("server: %llu moves in %llu ticks, %.1f M moves/s while stepping\n", (unsigned long long) sv.moves,
+           (unsigned long long) sv.tick, sv.busy > 0 ? sv.moves / sv.busy / 1e6 : 0.0);
+    host_free(&sv.host);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int sessions = 10000, ticks = 1000, active = 100;
+    int block[3] = { 1, 2, 1 };
+    vector<int> thread_counts;
+    vector<const char*> paths;
+    const char *listen_path = NULL;
+    for(int i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "--listen") == 0 && i + 1 < argc)
+            listen_path = argv[++i];
+        else if(strcmp(argv[i], "--sessions") == 0 && i + 1 < argc)
+            sessions = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--ticks") == 0 && i + 1 < argc)
+            ticks = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--active") == 0 && i + 1 < argc)
+            active = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            // A list such as 1,2,4
+            for(char *p = argv[++i]; *p;)
+            {
+                thread_counts.push_back(strtol(p, &p, 10));
+                if(*p == ',')
+                    p++;
+                else if(*p)
+                    break;
+            }
+        }
+        else if(strcmp(argv[i], "--block") == 0 && i + 1 < argc)
+        {
+            SimShape shape;
+            if(sscanf(argv[++i], "%dx%dx%d", &block[0], &block[1], &block[2]) != 3 ||
+               !sim_shape(&shape, block[0], block[1], block[2]))
+            {
+                fprintf(stderr, "--block wants XxYxZ, each side 1 to %d\n", SIM_MAX_DIM);
+                return 1;
+            }
+        }
+        else
+            paths.push_back(argv[i]);
+    }
+    if(paths.empty())
+        paths.push_back("levels/2.txt");
+    if(thread_counts.empty() && !listen_path)
+        for(int t = 1; t <= pool_default_threads(); t *= 2)
+            thread_counts.push_back(t);
+    vector<Level> levels;
+    if(sessions < 1 || ticks < 1 || active < 1 || active > 100 || !load_levels(paths, &levels))
+    {
+        fprintf(stderr, "usage: server [--sessions N] [--ticks N] [--active PERCENT] [--threads N,N,...] [--block XxYxZ]\n"
+                        "              [--listen SOCKET] [level.txt|level.lvl|levels.pack]...\n");
+        return 1;
+    }
+    if(listen_path)
+        return serve(listen_path, levels, block, thread_counts.empty() ? 0 : thread_counts[0]);
+    printf("server: %d sessions on %zu levels, %d ticks, %d%% of sessions moving each tick, batch code %s\n", sessions,
+           levels.size(), ticks, active, sim_batch_isa_name(sim_batch_isa()));
+
+    for(size_t t = 0; t < thread_counts.size(); t++)
+    {
+        Host h;
+        host_init(&h, thread_counts[t]);
+        for(size_t i = 0; i < levels.size(); i++)
+            if(host_add_level(&h, &levels[i], block[0], block[1], block[2]) < 0)
+                return 1;
+        for(int i = 0; i < sessions; i++)
+            host_open(&h, i % levels.size());
+
+        // Every bot picks a random move; some sit a tick out
+        uint64_t r = 1, moves = 0;
+        vector<double> latency;
+        double busy = 0;
+        for(int k = 0; k < ticks; k++)
+        {
+            for(int i = 0; i < sessions; i++)
+            {
+                uint32_t v = next_random(&r);
+                if(active == 100 || (int) (v % 100) < active)
+                    host_queue(&h, i, (v >> 8) & 3);
+            }
+            HostTickStats stats;
+            host_tick(&h, &stats);
+            moves += stats.moves;
+            busy += stats.seconds;
+            latency.push_back(stats.seconds);
+        }
+
+        uint64_t steps = 0, falls = 0, wins = 0;
+        for(int i = 0; i < sessions; i++)
+        {
+            HostSessionInfo info;
+            host_session(&h, i, &info);
+            steps += info.steps;
+            falls += info.falls;
+            wins += info.wins;
+        }
+        printf("  %2d threads: %zu shards, %.1f M moves/s, tick latency p50 %.3f ms, p99 %.3f ms, max %.3f ms"
+               " (%llu moves, %llu falls, %llu wins)\n", pool_threads(h.pool), h.shards.size(), moves / busy / 1e6,
+               percentile(latency, 0.5) * 1e3, percentile(latency, 0.99) * 1e3, percentile(latency, 1) * 1e3,
+               (unsigned long long) steps, (unsigned long long) falls, (unsigned long long) wins);
+        host_free(&h);
+    }
+    return 0;
+}
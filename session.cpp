@@ -0,0 +1,72 @@
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "session.h"
+
+// FNV-1a over the state after the checksum field
+static uint32_t session_checksum(const Session *s)
+{
+    const unsigned char *p = (const unsigned char*) &s->checksum + sizeof(s->checksum);
+    const unsigned char *end = (const unsigned char*) s + sizeof(*s);
+    uint32_t h = 2166136261u;
+    for(; p < end; p++)
+        h = (h ^ *p) * 16777619u;
+    return h;
+}
+
+Session *session_open(const char *path, int *resumed)
+{
+    *resumed = 0;
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if(fd < 0)
+    {
+        perror(path);
+        return NULL;
+    }
+    // A shorter file reads as zeros past its end, which fails the header check
+    struct stat st;
+    if(fstat(fd, &st) != 0 || ((size_t) st.st_size != sizeof(Session) && ftruncate(fd, sizeof(Session)) != 0))
+    {
+        perror(path);
+        close(fd);
+        return NULL;
+    }
+    void *addr = mmap(NULL, sizeof(Session), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(addr == MAP_FAILED)
+    {
+        perror(path);
+        return NULL;
+    }
+
+    Session *s = (Session*) addr;
+    *resumed = memcmp(s->magic, SESSION_MAGIC, 4) == 0 && s->version == SESSION_VERSION &&
+               s->size == sizeof(Session) && s->checksum == session_checksum(s);
+    if(!*resumed)
+        session_reset(s);
+    return s;
+}
+
+void session_seal(Session *s)
+{
+    s->checksum = session_checksum(s);
+}
+
+void session_reset(Session *s)
+{
+    memset(s, 0, sizeof(*s));
+    memcpy(s->magic, SESSION_MAGIC, 4);
+    s->version = SESSION_VERSION;
+    s->size = sizeof(Session);
+    session_seal(s);
+}
+
+void session_close(Session *s)
+{
+    munmap(s, sizeof(Session));
+}
@@ -0,0 +1,45 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stdint.h>
+
+#include "sim.h"
+
+/* Everything a player would lose by quitting, as one plain struct that lives
+   in a shared mapping of the session file. The game plays on it directly, so
+   the file is always current and resuming is just mapping it again. The
+   checksum covers everything after it; session_seal() updates it once the
+   state is consistent again, and a session that does not match is dropped.
+   Native byte order. */
+#define SESSION_MAGIC "BLXG"
+#define SESSION_VERSION 1
+
+struct Session {
+    char magic[4];
+    uint32_t version;
+    uint32_t size;              // sizeof(Session)
+    uint32_t checksum;
+
+    int level;
+    int score;                  // moves over every level so far
+    int level_start_score;      // score when the current level started
+    int block_dims[3];          // shape the block state belongs to
+    SimState block;
+    float camera_rotation_angle;
+    int top, front, do_rot;     // views
+};
+
+// Map the session file, creating it if needed. *resumed is 1 if it held a
+// valid session, otherwise the session is zeroed apart from its header.
+// Returns NULL if the file cannot be mapped.
+Session *session_open(const char *path, int *resumed);
+
+// Update the checksum after a change
+void session_seal(Session *s);
+
+// Clear the state, so the next start is a new game
+void session_reset(Session *s);
+
+void session_close(Session *s);
+
+#endif
@@ -0,0 +1,390 @@
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+#include "sim.h"
+
+using namespace std;
+
+#define TILE_BIT(t) (1u << (t))
+
+// Tile types that are always solid, by heavy
+static const unsigned static_masks[2] = {
+    TILE_BIT(TILE_FLOOR) | TILE_BIT(TILE_FRAGILE) | TILE_BIT(TILE_GOAL),
+    TILE_BIT(TILE_FLOOR) | TILE_BIT(TILE_GOAL),
+};
+
+// Tile types set in each plane
+static const unsigned plane_masks[PLANE_COUNT] = {
+    static_masks[0],
+    static_masks[1],
+    TILE_BIT(TILE_BUTTON) | TILE_BIT(TILE_BRIDGE) | TILE_BIT(TILE_FRAGILE_BRIDGE) |
+        TILE_BIT(TILE_CRUMBLE) | TILE_BIT(TILE_TELEPORT),
+    TILE_BIT(TILE_GOAL),
+};
+
+int sim_shape(SimShape *shape, int sx, int sy, int sz)
+{
+    if(sx < 1 || sy < 1 || sz < 1 || sx > SIM_MAX_DIM || sy > SIM_MAX_DIM || sz > SIM_MAX_DIM)
+        return 0;
+    memset(shape, 0, sizeof(*shape));
+    shape->dims[0] = sx;
+    shape->dims[1] = sy;
+    shape->dims[2] = sz;
+
+    // Orientations are numbered in the order they are first reached, moves in enum order
+    shape->num_orients = 1;
+    shape->axis[0][0] = 0;
+    shape->axis[0][1] = 1;
+    shape->axis[0][2] = 2;
+    for(int o = 0; o < shape->num_orients; o++)
+    {
+        for(int k = 0; k < 3; k++)
+            shape->extent[o][k] = shape->dims[shape->axis[o][k]];
+        for(int move = 0; move < MOVE_COUNT; move++)
+        {
+            // Rolling along x swaps the x and y axes, along z the z and y axes
+            int along = move == MOVE_LEFT || move == MOVE_RIGHT ? 0 : 2;
+            int axis[3] = { shape->axis[o][0], shape->axis[o][1], shape->axis[o][2] };
+            axis[1] = shape->axis[o][along];
+            axis[along] = shape->axis[o][1];
+
+            // Orientations with the same extents behave the same, whichever sides they show
+            int next = 0;
+            while(next < shape->num_orients && !(shape->dims[shape->axis[next][0]] == shape->dims[axis[0]] &&
+                                                 shape->dims[shape->axis[next][1]] == shape->dims[axis[1]] &&
+                                                 shape->dims[shape->axis[next][2]] == shape->dims[axis[2]]))
+                next++;
+            if(next == shape->num_orients)
+            {
+                memcpy(shape->axis[next], axis, sizeof(axis));
+                shape->num_orients++;
+            }
+
+            // Forward moves step over the old size, backward ones over the new one
+            int *t = shape->transitions[o][move];
+            int step = move == MOVE_RIGHT || move == MOVE_DOWN ? shape->dims[shape->axis[o][along]] : -shape->dims[axis[along]];
+            t[0] = next;
+            t[1] = along == 0 ? step : 0;
+            t[2] = along == 2 ? step : 0;
+        }
+    }
+
+    for(int o = 0; o < shape->num_orients; o++)
+    {
+        shape->footprint[o] = (1ull << shape->extent[o][2]) - 1;
+        shape->single[o] = shape->extent[o][0] == 1 && shape->extent[o][2] == 1;
+        shape->heavy[o] = shape->single[o] && shape->extent[o][1] > 1;
+    }
+    return 1;
+}
+
+// Bits of a plane row from level column z on, little endian
+static inline uint64_t row_bits(const unsigned char *row, int z)
+{
+    int c = z + SIM_BORDER;
+    uint64_t bits;
+    memcpy(&bits, row + (c >> 3), sizeof(bits));
+    return bits >> (c & 7);
+}
+
+// Position of a tile in a sorted lookup table, -1 if it is not there
+static int find_tile(const vector<uint32_t> &tiles, uint32_t tile)
+{
+    vector<uint32_t>::const_iterator it = lower_bound(tiles.begin(), tiles.end(), tile);
+    return it != tiles.end() && *it == tile ? it - tiles.begin() : -1;
+}
+
+int sim_prepare(SimLevel *sl, const Level *lvl, const SimShape *shape)
+{
+    sl->level = lvl;
+    sl->shape = shape;
+    sl->rows = lvl->size_x + 2*SIM_BORDER;
+    sl->row_bytes = (lvl->size_z + 2*SIM_BORDER + 7) / 8 + 8;
+    sl->planes.assign((size_t) PLANE_COUNT * sl->rows * sl->row_bytes, 0);
+    sl->crumble_tiles.clear();
+    for(int x = 0; x < lvl->size_x; x++)
+        for(int z = 0; z < lvl->size_z; z++)
+        {
+            int tile = level_tile(lvl, x, z);
+            if(tile >= TILE_COUNT)
+            {
+                fprintf(stderr, "sim: level has tile %d at %d,%d, not one of the %d kinds\n", tile, x, z, TILE_COUNT);
+                return 0;
+            }
+            int c = z + SIM_BORDER;
+            for(int p = 0; p < PLANE_COUNT; p++)
+                if((plane_masks[p] >> tile) & 1)
+                    const_cast<unsigned char*>(sim_plane_row(sl, p, x))[c >> 3] |= 1 << (c & 7);
+            if(tile == TILE_CRUMBLE)
+                sl->crumble_tiles.push_back(level_index(lvl, x, z));
+        }
+
+    if(lvl->num_switches > SIM_MAX_SWITCHES || sl->crumble_tiles.size() > SIM_MAX_CRUMBLE)
+    {
+        fprintf(stderr, "sim: level has %d switches and %d crumbling tiles, at most %d of each\n",
+                lvl->num_switches, (int) sl->crumble_tiles.size(), SIM_MAX_SWITCHES);
+        return 0;
+    }
+
+    // Sorted (tile, switch) pairs, and the buttons linking each tile
+    vector< pair<uint32_t, int> > switches;
+    vector< pair<uint32_t, uint32_t> > links;
+    sl->num_timers = 0;
+    for(int i = 0; i < lvl->num_switches; i++)
+    {
+        const LevelSwitch &sw = lvl->switches[i];
+        switches.push_back(make_pair(sw.tile, i));
+        sl->timer_of[i] = -1;
+        if(lvl->tiles[sw.tile] != TILE_BUTTON)
+            continue;
+        if(sw.duration > 0)
+        {
+            if(sl->num_timers == SIM_MAX_TIMERS)
+            {
+                fprintf(stderr, "sim: level has more than %d timed buttons\n", SIM_MAX_TIMERS);
+                return 0;
+            }
+            sl->timer_of[i] = sl->num_timers++;
+        }
+        for(uint32_t k = 0; k < sw.num_links; k++)
+            links.push_back(make_pair(lvl->links[sw.first_link + k], 1u << i));
+    }
+    sort(switches.begin(), switches.end());
+    sort(links.begin(), links.end());
+    sl->switch_tiles.clear();
+    sl->switch_ids.clear();
+    for(size_t i = 0; i < switches.size(); i++)
+    {
+        sl->switch_tiles.push_back(switches[i].first);
+        sl->switch_ids.push_back(switches[i].second);
+    }
+    sl->linked_tiles.clear();
+    sl->linked_masks.clear();
+    for(size_t i = 0; i < links.size(); i++)
+    {
+        if(!sl->linked_tiles.empty() && sl->linked_tiles.back() == links[i].first)
+            sl->linked_masks.back() |= links[i].second;
+        else
+        {
+            sl->linked_tiles.push_back(links[i].first);
+            sl->linked_masks.push_back(links[i].second);
+        }
+    }
+    return 1;
+}
+
+void sim_start(const SimLevel *sl, SimState *s)
+{
+    memset(s, 0, sizeof(*s));
+    s->x = sl->level->start_x;
+    s->z = sl->level->start_z;
+}
+
+// Whether a tile some buttons link to is switched: a bridge is up
+static int switched(const SimLevel *sl, const SimState *s, uint32_t index)
+{
+    int i = find_tile(sl->linked_tiles, index);
+    return i >= 0 && (__builtin_popcount(s->switches & sl->linked_masks[i]) & 1);
+}
+
+// The tile at a level index as state s shows it
+static int tile_in_state(const SimLevel *sl, const SimState *s, uint32_t index)
+{
+    int tile = sl->level->tiles[index];
+    switch(tile)
+    {
+    case TILE_BRIDGE:
+    case TILE_FRAGILE_BRIDGE:
+        return switched(sl, s, index) ? tile : TILE_VOID;
+    case TILE_CRUMBLE:
+        return (s->crumbled >> find_tile(sl->crumble_tiles, index)) & 1 ? TILE_VOID : tile;
+    }
+    return tile;
+}
+
+int sim_tile(const SimLevel *sl, const SimState *s, int x, int z)
+{
+    return tile_in_state(sl, s, level_index(sl->level, x, z));
+}
+
+void sim_changed_tiles(const SimLevel *sl, const SimState *a, const SimState *b, vector<int> *tiles)
+{
+    const Level *lvl = sl->level;
+    uint32_t switches = a->switches ^ b->switches;
+    for(int i = 0; switches; i++, switches >>= 1)
+        if(switches & 1)
+        {
+            const LevelSwitch &sw = lvl->switches[i];
+            tiles->insert(tiles->end(), lvl->links + sw.first_link, lvl->links + sw.first_link + sw.num_links);
+        }
+    uint32_t crumbled = a->crumbled ^ b->crumbled;
+    for(int i = 0; crumbled; i++, crumbled >>= 1)
+        if(crumbled & 1)
+            tiles->push_back(sl->crumble_tiles[i]);
+}
+
+// Every tile under the block is solid, looked up one at a time
+static int footprint_solid(const SimLevel *sl, const SimState *s)
+{
+    const Level *lvl = sl->level;
+    const int *extent = sl->shape->extent[s->orient];
+    int heavy = sl->shape->heavy[s->orient];
+    for(int i = 0; i < extent[0]; i++)
+        for(int j = 0; j < extent[2]; j++)
+        {
+            int x = s->x + i, z = s->z + j;
+            if(x < 0 || x >= lvl->size_x || z < 0 || z >= lvl->size_z)
+                return 0;
+            int tile = tile_in_state(sl, s, level_index(lvl, x, z));
+            if(tile == TILE_VOID || (heavy && (tile == TILE_FRAGILE || tile == TILE_FRAGILE_BRIDGE)))
+                return 0;
+        }
+    return 1;
+}
+
+// Support from the static planes: every tile under the block is always solid.
+// *dynamic gets the footprint bits on tiles that need footprint_solid().
+// The plane border keeps every lookup inside the planes; each footprint row
+// takes one masked AND per plane.
+static inline int plane_solid(const SimLevel *sl, const SimState *s, uint64_t *dynamic)
+{
+    const SimShape *shape = sl->shape;
+    int rows = shape->extent[s->orient][0];
+    uint64_t mask = shape->footprint[s->orient];
+    const unsigned char *row = sim_plane_row(sl, 0, s->x);
+    int row_bytes = sl->row_bytes;
+    int plane = shape->heavy[s->orient] ? PLANE_HEAVY : PLANE_LIGHT;
+    uint64_t solid = mask, dyn = 0;
+    for(int r = 0; r < rows; r++, row += PLANE_COUNT * row_bytes)
+    {
+        solid &= row_bits(row + plane * row_bytes, s->z);
+        dyn |= row_bits(row + PLANE_DYNAMIC * row_bytes, s->z);
+    }
+    *dynamic = dyn & mask;
+    return solid == mask;
+}
+
+int sim_supported(const SimLevel *sl, const SimState *s)
+{
+    const int *extent = sl->shape->extent[s->orient];
+    if(s->x < 0 || s->x + extent[0] > sl->level->size_x || s->z < 0 || s->z + extent[2] > sl->level->size_z)
+        return 0;
+    uint64_t dynamic;
+    if(plane_solid(sl, s, &dynamic))
+        return 1;
+    return dynamic && footprint_solid(sl, s);
+}
+
+// Everything the block does to and gets from dynamic tiles after it moved to s.
+// Returns the sim_step() flags of the effects.
+static int dynamic_effects(const SimLevel *sl, const SimState *in, SimState *s)
+{
+    const Level *lvl = sl->level;
+    const SimShape *shape = sl->shape;
+    int flags = 0;
+
+    // Crumbling tiles the block just left fall away
+    const int *old_extent = shape->extent[in->orient];
+    const int *extent = shape->extent[s->orient];
+    for(size_t i = 0; i < sl->crumble_tiles.size(); i++)
+    {
+        if((s->crumbled >> i) & 1)
+            continue;
+        int x, z;
+        level_coords(lvl, sl->crumble_tiles[i], &x, &z);
+        int was_under = x >= in->x && x < in->x + old_extent[0] && z >= in->z && z < in->z + old_extent[2];
+        int is_under = x >= s->x && x < s->x + extent[0] && z >= s->z && z < s->z + extent[2];
+        if(was_under && !is_under)
+        {
+            s->crumbled |= 1u << i;
+            flags |= SIM_CRUMBLED;
+        }
+    }
+
+    // Timed buttons run down by one move
+    for(int i = 0; i < lvl->num_switches && sl->num_timers; i++)
+    {
+        int t = sl->timer_of[i];
+        if(t >= 0 && s->timers[t] > 0 && --s->timers[t] == 0)
+        {
+            s->switches &= ~(1u << i);
+            flags |= SIM_TOGGLED;
+        }
+    }
+
+    // Buttons and teleporters under the block
+    int teleport_to = -1;
+    for(int i = 0; i < extent[0]; i++)
+        for(int j = 0; j < extent[2]; j++)
+        {
+            int x = s->x + i, z = s->z + j;
+            if(x < 0 || x >= lvl->size_x || z < 0 || z >= lvl->size_z)
+                continue;
+            uint32_t index = level_index(lvl, x, z);
+            int k = find_tile(sl->switch_tiles, index);
+            for(; k >= 0 && k < (int) sl->switch_tiles.size() && sl->switch_tiles[k] == index; k++)
+            {
+                int id = sl->switch_ids[k];
+                const LevelSwitch &sw = lvl->switches[id];
+                if(lvl->tiles[index] == TILE_TELEPORT)
+                {
+                    if(shape->single[s->orient] && sw.num_links > 0)
+                        teleport_to = lvl->links[sw.first_link];
+                }
+                else if(sl->timer_of[id] >= 0)
+                {
+                    // A timed button is switched on again for its full time
+                    if(!((s->switches >> id) & 1))
+                        flags |= SIM_TOGGLED;
+                    s->switches |= 1u << id;
+                    s->timers[sl->timer_of[id]] = sw.duration > 255 ? 255 : sw.duration;
+                }
+                else
+                {
+                    s->switches ^= 1u << id;
+                    flags |= SIM_TOGGLED;
+                }
+            }
+        }
+
+    if(teleport_to >= 0)
+    {
+        level_coords(lvl, teleport_to, &s->x, &s->z);
+        flags |= SIM_TELEPORTED;
+    }
+    return flags;
+}
+
+int sim_step(const SimLevel *sl, const SimState *in, int move, SimState *out)
+{
+    const SimShape *shape = sl->shape;
+    const int *t = shape->transitions[in->orient][move];
+    SimState s = *in;
+    s.orient = t[0];
+    s.x += t[1];
+    s.z += t[2];
+    s.moves++;
+
+    // Anything that changes over time needs the slow path: dynamic tiles under
+    // the block, crumbling tiles it may have left, running timers
+    int flags = SIM_MOVED;
+    uint64_t dynamic;
+    int supported = plane_solid(sl, &s, &dynamic);
+    if(dynamic || !sl->crumble_tiles.empty() || sl->num_timers)
+    {
+        flags |= dynamic_effects(sl, in, &s);
+        supported = sim_supported(sl, &s);
+    }
+
+    if(!supported)
+    {
+        sim_start(sl, out);
+        return SIM_MOVED | SIM_FELL;
+    }
+
+    *out = s;
+    if(shape->single[s.orient] && (row_bits(sim_plane_row(sl, PLANE_GOAL, s.x), s.z) & 1))
+        flags |= SIM_WON;
+    return flags;
+}
@@ -0,0 +1,126 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "level.h"
+
+// Orientations of the classic 1x2x1 block, in the order sim_shape() numbers them
+enum {
+    ORIENT_STAND,   // "longy", one tile
+    ORIENT_LONGZ,   // lying on tiles (x,z) and (x,z+1)
+    ORIENT_LONGX,   // lying on tiles (x,z) and (x+1,z)
+    ORIENT_COUNT
+};
+
+// Moves, in the order of the w/a/s/d keys
+enum {
+    MOVE_UP,        // w, towards -z
+    MOVE_LEFT,      // a, towards -x
+    MOVE_DOWN,      // s, towards +z
+    MOVE_RIGHT,     // d, towards +x
+    MOVE_COUNT
+};
+
+#define SIM_MAX_DIM 4       // largest side of a block, in tiles
+#define SIM_MAX_ORIENTS 6   // a cuboid with three different sides
+
+// A cuboid block and everything the rules need to know about each way it can lie.
+// Rolling over an edge swaps the height with the size along the move.
+struct SimShape {
+    int dims[3];                                    // x, y (height) and z size at the start
+    int num_orients;                                // orientation 0 is the start one
+    int extent[SIM_MAX_ORIENTS][3];                 // x, y and z size of each orientation
+    int axis[SIM_MAX_ORIENTS][3];                   // which of dims lies along x, y and z
+    int transitions[SIM_MAX_ORIENTS][MOVE_COUNT][3];// new orientation, x and z offset of the anchor
+    uint64_t footprint[SIM_MAX_ORIENTS];            // one row of the footprint: extent z low bits
+    int single[SIM_MAX_ORIENTS];                    // rests on one tile: can finish on the goal
+    int heavy[SIM_MAX_ORIENTS];                     // single and taller than one tile: breaks fragile tiles
+};
+
+// Build the shape of a sx by sy by sz block. Returns 0 if a side is not in 1..SIM_MAX_DIM.
+int sim_shape(SimShape *shape, int sx, int sy, int sz);
+
+#define SIM_MAX_SWITCHES 32  // buttons and teleporters per level
+#define SIM_MAX_TIMERS 8     // timed buttons per level
+#define SIM_MAX_CRUMBLE 32   // crumbling tiles per level
+
+// Everything that changes while a level is played. Plain data, so states can be
+// copied, compared and stored as they are.
+struct SimState {
+    int x, z;           // level tile of the block's lowest corner
+    int orient;         // index into the shape's orientations
+    int moves;          // since the level started, a fall resets it
+    uint32_t switches;  // bit i: switch i is on; a bridge is up while an odd number of its switches are
+    uint32_t crumbled;  // bit i: crumbling tile i has fallen away
+    unsigned char timers[SIM_MAX_TIMERS];  // moves left on each timed button, 0 when off
+};
+
+// sim_step() result bits
+enum {
+    SIM_MOVED      = 1,
+    SIM_TOGGLED    = 2,     // a button switched its bridges
+    SIM_FELL       = 4,     // the block fell off, the state is back at the start
+    SIM_WON        = 8,     // the block rests on the goal alone
+    SIM_TELEPORTED = 16,
+    SIM_CRUMBLED   = 32,    // a crumbling tile fell away behind the block
+};
+
+// Bitplanes of a level, one bit per tile, SIM_BORDER void tiles around it so a
+// block that moved off the level is still looked up inside the planes
+enum {
+    PLANE_LIGHT,        // always solid under a block that is not heavy
+    PLANE_HEAVY,        // always solid under a heavy block
+    PLANE_DYNAMIC,      // depends on the state or acts on the block: the slow path
+    PLANE_GOAL,
+    PLANE_COUNT
+};
+#define SIM_BORDER SIM_MAX_DIM
+
+// A level prepared for a block shape. Keeps pointers to both, which must outlive it.
+struct SimLevel {
+    const Level *level;
+    const SimShape *shape;
+    int rows, row_bytes;                // row_bytes includes 8 bytes of slack for unaligned loads
+    std::vector<unsigned char> planes;  // PLANE_COUNT * rows * row_bytes
+
+    // Tile state lookups by level_index(), sorted by it
+    std::vector<uint32_t> switch_tiles;     // tiles of buttons and teleporters
+    std::vector<int> switch_ids;            // their index in Level::switches
+    std::vector<uint32_t> linked_tiles;     // every tile some button links to
+    std::vector<uint32_t> linked_masks;     // the buttons linking linked_tiles[i]
+    std::vector<uint32_t> crumble_tiles;    // tile of crumbling tile i
+    int timer_of[SIM_MAX_SWITCHES];         // timer slot of a timed button, else -1
+    int num_timers;
+};
+
+// Row x of a plane, bit c of it being level column c - SIM_BORDER. The planes
+// of one level row are next to each other, row_bytes apart.
+inline const unsigned char *sim_plane_row(const SimLevel *sl, int plane, int x)
+{
+    return &sl->planes[((size_t) (x + SIM_BORDER) * PLANE_COUNT + plane) * sl->row_bytes];
+}
+
+// Returns 0, with a message, if the level has a tile of no known kind, or more
+// switches, timed buttons or crumbling tiles than a SimState can hold
+int sim_prepare(SimLevel *sl, const Level *lvl, const SimShape *shape);
+
+void sim_start(const SimLevel *sl, SimState *s);
+
+// What tile (x,z) is in state s: a bridge that is down or a crumbled tile is void
+int sim_tile(const SimLevel *sl, const SimState *s, int x, int z);
+
+// Append the level_index() of every tile that sim_tile() shows differently in
+// the two states, possibly more than once
+void sim_changed_tiles(const SimLevel *sl, const SimState *a, const SimState *b, std::vector<int> *tiles);
+
+// Whether the block can rest in this state: it is inside the level, every tile
+// under it is solid and it is not heavy on a fragile tile
+int sim_supported(const SimLevel *sl, const SimState *s);
+
+// Apply one move to a state sim_supported() accepts. Pure: the result only
+// depends on the arguments, and out may alias in.
+int sim_step(const SimLevel *sl, const SimState *in, int move, SimState *out);
+
+#endif
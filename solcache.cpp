@@ -0,0 +1,305 @@
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "solcache.h"
+
+using namespace std;
+
+#define INITIAL_SLOTS 256
+
+struct SolCache {
+    string path;
+    int fd;
+    char *addr;
+    size_t size;
+    mutex lock;     // threads of this process; flock() for other processes
+};
+
+static SolCacheHeader *header(const SolCache *c)
+{
+    return (SolCacheHeader*) c->addr;
+}
+
+static SolCacheSlot *slots(const SolCache *c)
+{
+    return (SolCacheSlot*) (c->addr + sizeof(SolCacheHeader));
+}
+
+static size_t file_size(uint32_t num_slots)
+{
+    return sizeof(SolCacheHeader) + (size_t) num_slots * sizeof(SolCacheSlot);
+}
+
+// FNV-1a
+static uint64_t hash_bytes(uint64_t h, const void *data, size_t size)
+{
+    const unsigned char *p = (const unsigned char*) data;
+    for(size_t i = 0; i < size; i++)
+        h = (h ^ p[i]) * 1099511628211ull;
+    return h;
+}
+
+static uint64_t hash_int(uint64_t h, int32_t v)
+{
+    return hash_bytes(h, &v, sizeof(v));
+}
+
+uint64_t solcache_key(const Level *lvl, const SimShape *shape)
+{
+    uint64_t h = 14695981039346656037ull;
+    int fields[] = { lvl->size_x, lvl->size_z, lvl->start_x, lvl->start_z, lvl->goal_x, lvl->goal_z,
+                     shape->dims[0], shape->dims[1], shape->dims[2], lvl->num_switches };
+    for(size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++)
+        h = hash_int(h, fields[i]);
+    for(int x = 0; x < lvl->size_x; x++)
+        h = hash_bytes(h, &lvl->tiles[level_index(lvl, x, 0)], lvl->size_z);
+
+    // Switches and links by position, so the border and stride do not matter
+    for(int i = 0; i < lvl->num_switches; i++)
+    {
+        const LevelSwitch &sw = lvl->switches[i];
+        int x, z;
+        level_coords(lvl, sw.tile, &x, &z);
+        h = hash_int(hash_int(hash_int(hash_int(h, x), z), sw.duration), sw.num_links);
+        for(uint32_t k = 0; k < sw.num_links; k++)
+        {
+            level_coords(lvl, lvl->links[sw.first_link + k], &x, &z);
+            h = hash_int(hash_int(h, x), z);
+        }
+    }
+    return h && h != SOLCACHE_RETIRED ? h : 1;
+}
+
+// Make the file num_slots empty slots
+static int init_file(const char *path, int fd, uint32_t num_slots)
+{
+    SolCacheHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SOLCACHE_MAGIC, 4);
+    h.version = SOLCACHE_VERSION;
+    h.slot_size = sizeof(SolCacheSlot);
+    h.num_slots = num_slots;
+    if(ftruncate(fd, 0) != 0 || ftruncate(fd, file_size(num_slots)) != 0 || pwrite(fd, &h, sizeof(h), 0) != (ssize_t) sizeof(h))
+    {
+        perror(path);
+        return 0;
+    }
+    return 1;
+}
+
+// Map c->fd, after checking its header. Returns 0 if it is not a cache file.
+static int map_file(SolCache *c)
+{
+    struct stat st;
+    SolCacheHeader h;
+    if(fstat(c->fd, &st) != 0 || pread(c->fd, &h, sizeof(h), 0) != (ssize_t) sizeof(h) ||
+       memcmp(h.magic, SOLCACHE_MAGIC, 4) != 0 || h.version != SOLCACHE_VERSION ||
+       h.slot_size != sizeof(SolCacheSlot) || h.num_slots == 0 || (h.num_slots & (h.num_slots - 1)) != 0 ||
+       (size_t) st.st_size != file_size(h.num_slots))
+        return 0;
+    void *addr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, c->fd, 0);
+    if(addr == MAP_FAILED)
+        return 0;
+    c->addr = (char*) addr;
+    c->size = st.st_size;
+    return 1;
+}
+
+static void unmap_file(SolCache *c)
+{
+    if(c->addr)
+        munmap(c->addr, c->size);
+    if(c->fd >= 0)
+        close(c->fd);
+    c->addr = NULL;
+    c->fd = -1;
+}
+
+// Whether another process has renamed a larger file over the one mapped
+static int replaced(const SolCache *c)
+{
+    struct stat now, mine;
+    return stat(c->path.c_str(), &now) == 0 && fstat(c->fd, &mine) == 0 &&
+           (now.st_ino != mine.st_ino || now.st_dev != mine.st_dev);
+}
+
+static int follow_file(SolCache *c)
+{
+    if(!replaced(c))
+        return 1;
+    unmap_file(c);
+    c->fd = open(c->path.c_str(), O_RDWR | O_CLOEXEC);
+    return c->fd >= 0 && map_file(c);
+}
+
+SolCache *solcache_open(const char *path)
+{
+    SolCache *c = new SolCache;
+    c->path = path;
+    c->addr = NULL;
+    c->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if(c->fd < 0)
+    {
+        perror(path);
+        delete c;
+        return NULL;
+    }
+    // A new, short or foreign file starts empty
+    flock(c->fd, LOCK_EX);
+    if(!map_file(c))
+    {
+        if(!init_file(path, c->fd, INITIAL_SLOTS) || !map_file(c))
+        {
+            fprintf(stderr, "%s: cannot set up the solution cache\n", path);
+            unmap_file(c);
+            delete c;
+            return NULL;
+        }
+    }
+    flock(c->fd, LOCK_UN);
+    return c;
+}
+
+void solcache_close(SolCache *c)
+{
+    if(c == NULL)
+        return;
+    unmap_file(c);
+    delete c;
+}
+
+// The slot of key, or the free slot it would go in; retired slots are passed over
+static SolCacheSlot *probe(const SolCache *c, uint64_t key)
+{
+    uint32_t mask = header(c)->num_slots - 1;
+    SolCacheSlot *s = slots(c);
+    for(uint32_t i = key & mask;; i = (i + 1) & mask)
+    {
+        uint64_t k = __atomic_load_n(&s[i].key, __ATOMIC_ACQUIRE);
+        if(k == key || k == 0)
+            return &s[i];
+    }
+}
+
+// The first free slot on the probe path of key
+static SolCacheSlot *free_slot(const SolCache *c, uint64_t key)
+{
+    uint32_t mask = header(c)->num_slots - 1;
+    SolCacheSlot *s = slots(c);
+    uint32_t i = key & mask;
+    while(s[i].key != 0)
+        i = (i + 1) & mask;
+    return &s[i];
+}
+
+int solcache_find(SolCache *c, uint64_t key, SolveResult *r)
+{
+    lock_guard<mutex> lock(c->lock);
+    SolCacheSlot *s = probe(c, key);
+    // Another process may have added it to a file it has since replaced
+    if(s->key != key && follow_file(c))
+        s = probe(c, key);
+    if(s->key != key)
+        return 0;
+    r->moves = s->par;
+    r->path.clear();
+    for(int i = 0; i < s->path_moves && i < SOLCACHE_MAX_PATH; i++)
+        r->path.push_back((s->path[i / 4] >> (i % 4 * 2)) & 3);
+    r->expanded = s->expanded;
+    r->visited = s->visited;
+    r->memory = s->memory;
+    r->spilled = 0;
+    r->seconds = s->seconds;
+    return 1;
+}
+
+// Every entry into a file twice the size, renamed over the old one
+static int grow(SolCache *c)
+{
+    uint32_t num_slots = header(c)->num_slots * 2;
+    string tmp = c->path + ".tmp";
+    SolCache bigger;
+    bigger.path = c->path;
+    bigger.addr = NULL;
+    bigger.fd = open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(bigger.fd < 0 || !init_file(tmp.c_str(), bigger.fd, num_slots) || !map_file(&bigger))
+    {
+        unmap_file(&bigger);
+        return 0;
+    }
+    flock(bigger.fd, LOCK_EX);
+    const SolCacheSlot *old = slots(c);
+    for(uint32_t i = 0; i < header(c)->num_slots; i++)
+        if(old[i].key && old[i].key != SOLCACHE_RETIRED)
+        {
+            *probe(&bigger, old[i].key) = old[i];
+            header(&bigger)->used++;
+        }
+    if(rename(tmp.c_str(), c->path.c_str()) != 0)
+    {
+        perror(c->path.c_str());
+        unmap_file(&bigger);
+        return 0;
+    }
+    // Closing the old file unlocks it; others follow the rename
+    unmap_file(c);
+    c->fd = bigger.fd;
+    c->addr = bigger.addr;
+    c->size = bigger.size;
+    return 1;
+}
+
+int solcache_store(SolCache *c, uint64_t key, const SolveResult *r)
+{
+    lock_guard<mutex> lock(c->lock);
+    // Lock the file the name points to, which may change while waiting for it
+    for(;;)
+    {
+        flock(c->fd, LOCK_EX);
+        if(!replaced(c))
+            break;
+        flock(c->fd, LOCK_UN);
+        if(!follow_file(c))
+            return 0;
+    }
+
+    // Every store fills a free slot
+    SolCacheSlot *s = probe(c, key);
+    if((header(c)->used + 1) * 4 > (uint64_t) header(c)->num_slots * 3)
+    {
+        if(!grow(c))
+        {
+            flock(c->fd, LOCK_UN);
+            return 0;
+        }
+        s = probe(c, key);
+    }
+
+    SolCacheSlot entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.par = r->moves;
+    entry.path_moves = r->path.empty() || r->path.size() > SOLCACHE_MAX_PATH ? -1 : r->path.size();
+    for(int i = 0; i < entry.path_moves; i++)
+        entry.path[i / 4] |= r->path[i] << (i % 4 * 2);
+    entry.expanded = r->expanded;
+    entry.visited = r->visited;
+    entry.memory = r->memory;
+    entry.seconds = r->seconds;
+    // Readers find the old entry, whole, until the new one is in place
+    SolCacheSlot *to = s->key == key ? free_slot(c, key) : s;
+    memcpy((char*) to + sizeof(to->key), (const char*) &entry + sizeof(entry.key), sizeof(entry) - sizeof(entry.key));
+    __atomic_store_n(&to->key, key, __ATOMIC_RELEASE);
+    if(to != s)
+        __atomic_store_n(&s->key, (uint64_t) SOLCACHE_RETIRED, __ATOMIC_RELEASE);
+    header(c)->used++;
+    flock(c->fd, LOCK_UN);
+    return 1;
+}
@@ -0,0 +1,58 @@
+#ifndef SOLCACHE_H
+#define SOLCACHE_H
+
+#include <stdint.h>
+
+#include "solver.h"
+
+/* Par and one shortest solution of each level solved before, kept across runs
+   in a memory-mapped file so tools solve a level once. Entries are keyed by a
+   hash of everything the rules see of a level: its packed grid (the playable
+   tiles row by row), switches, links, start and goal, and the block. A level
+   whose tiles change gets another key, so a stale entry is never found. Native
+   byte order:
+     SolCacheHeader
+     SolCacheSlot[num_slots], open addressing with linear probing by key
+   A lookup is a probe of the mapped table. A table three quarters full is
+   written again twice the size, next to the file and renamed over it. Stores
+   are locked across processes and fill a free slot, its key written last; a
+   key stored again gets a new slot before the old one is retired, so a slot
+   is never written over while a reader may be looking at it. */
+#define SOLCACHE_MAGIC "BLXC"
+#define SOLCACHE_VERSION 1
+#define SOLCACHE_MAX_PATH 1000  // longer solutions keep their par only
+#define SOLCACHE_RETIRED UINT64_MAX  // key of a slot whose entry was stored again
+
+struct SolCacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t slot_size;         // sizeof(SolCacheSlot)
+    uint32_t num_slots;         // a power of two
+    uint64_t used;              // slots not free, retired ones included
+};
+
+struct SolCacheSlot {
+    uint64_t key;               // 0 for a free slot
+    int32_t par;                // -1 if the goal cannot be reached
+    int32_t path_moves;         // moves in path, -1 if the solution was not kept
+    uint64_t expanded, visited, memory;
+    double seconds;             // of the solve that found it; all 0 if it was not a search
+    unsigned char path[SOLCACHE_MAX_PATH / 4];  // MOVE_*, 2 bits each, the first in the low bits
+};
+
+struct SolCache;
+
+// Opens or creates the file. Returns NULL, with a message, if it cannot.
+SolCache *solcache_open(const char *path);
+void solcache_close(SolCache *c);
+
+uint64_t solcache_key(const Level *lvl, const SimShape *shape);
+
+// The stored result in r: moves, path (empty if not kept) and the solver
+// statistics. Returns 0 if the key is not there.
+int solcache_find(SolCache *c, uint64_t key, SolveResult *r);
+
+// Keep r under key, replacing an entry already there. Returns 0 if the file cannot grow.
+int solcache_store(SolCache *c, uint64_t key, const SolveResult *r);
+
+#endif
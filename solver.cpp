@@ -0,0 +1,602 @@
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <algorithm>
+
+#include <unistd.h>
+
+#include "solver.h"
+
+using namespace std;
+
+int codec_init(StateCodec *c, const SimLevel *sl)
+{
+    const Level *lvl = sl->level;
+    c->sl = sl;
+    c->size_x = lvl->size_x;
+    c->size_z = lvl->size_z;
+    c->num_orients = sl->shape->num_orients;
+    c->num_buttons = 0;
+    for(int i = 0; i < lvl->num_switches; i++)
+    {
+        c->button_of[i] = -1;
+        if(lvl->tiles[lvl->switches[i].tile] == TILE_BUTTON)
+        {
+            c->button_switch[c->num_buttons] = i;
+            c->button_of[i] = c->num_buttons++;
+        }
+    }
+    c->num_crumble = sl->crumble_tiles.size();
+    c->num_timers = sl->num_timers;
+    for(int i = 0; i < lvl->num_switches; i++)
+        if(sl->timer_of[i] >= 0)
+        {
+            uint32_t duration = lvl->switches[i].duration;
+            c->timer_radix[sl->timer_of[i]] = (duration > 255 ? 255 : duration) + 1;
+        }
+
+    // Counted in doubles first: the exponents alone can overflow 64 bits
+    double states = ldexp((double) c->size_x * c->size_z * c->num_orients, c->num_buttons + c->num_crumble);
+    for(int t = 0; t < c->num_timers; t++)
+        states *= c->timer_radix[t];
+    if(states >= 18446744073709551616.0)
+        return 0;
+    c->num_states = (uint64_t) states;
+    return 1;
+}
+
+uint64_t codec_key(const StateCodec *c, const SimState *s)
+{
+    uint64_t key = 0;
+    for(int t = c->num_timers - 1; t >= 0; t--)
+        key = key * c->timer_radix[t] + s->timers[t];
+    key = key << c->num_crumble | s->crumbled;
+    uint32_t buttons = 0;
+    for(uint32_t sw = s->switches; sw; sw &= sw - 1)
+        buttons |= 1u << c->button_of[__builtin_ctz(sw)];
+    key = key << c->num_buttons | buttons;
+    key = key * c->num_orients + s->orient;
+    key = key * c->size_x + s->x;
+    return key * c->size_z + s->z;
+}
+
+void codec_state(const StateCodec *c, uint64_t key, SimState *s)
+{
+    memset(s, 0, sizeof(*s));
+    uint64_t k = key;
+    s->z = k % c->size_z;
+    k /= c->size_z;
+    s->x = k % c->size_x;
+    k /= c->size_x;
+    s->orient = k % c->num_orients;
+    k /= c->num_orients;
+    uint32_t buttons = k & ((1ull << c->num_buttons) - 1);
+    k >>= c->num_buttons;
+    for(; buttons; buttons &= buttons - 1)
+        s->switches |= 1u << c->button_switch[__builtin_ctz(buttons)];
+    s->crumbled = k & ((1ull << c->num_crumble) - 1);
+    k >>= c->num_crumble;
+    for(int t = 0; t < c->num_timers; t++)
+    {
+        s->timers[t] = k % c->timer_radix[t];
+        k /= c->timer_radix[t];
+    }
+}
+
+// The move from a state of the previous layer that leads to key
+static int step_back(const StateCodec *c, const vector<uint32_t> &queue, size_t begin, size_t end,
+                     uint32_t key, uint32_t *from)
+{
+    for(size_t i = begin; i < end; i++)
+    {
+        SimState s, t;
+        codec_state(c, queue[i], &s);
+        for(int m = 0; m < MOVE_COUNT; m++)
+        {
+            int flags = sim_step(c->sl, &s, m, &t);
+            t.moves = 0;
+            if(!(flags & (SIM_FELL | SIM_WON)) && codec_key(c, &t) == key)
+            {
+                *from = queue[i];
+                return m;
+            }
+        }
+    }
+    return -1;
+}
+
+int solve_bfs(const SimLevel *sl, SolveResult *r)
+{
+    StateCodec c;
+    if(!codec_init(&c, sl) || c.num_states > (1ull << 32))
+        return 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    vector<uint64_t> seen((c.num_states + 63) / 64);
+    vector<uint32_t> queue;
+    vector<size_t> layers;  // queue offset of each depth
+    SimState s;
+    sim_start(sl, &s);
+    uint32_t key = codec_key(&c, &s);
+    seen[key >> 6] |= 1ull << (key & 63);
+    queue.push_back(key);
+
+    // A fall goes back to the start, which is never shorter, so it is not an edge
+    r->moves = -1;
+    r->path.clear();
+    r->expanded = 0;
+    uint32_t last_key = 0;
+    int last_move = -1;
+    size_t head = 0;
+    for(int depth = 0; head < queue.size() && last_move < 0; depth++)
+    {
+        layers.push_back(head);
+        size_t layer_end = queue.size();
+        for(; head < layer_end && last_move < 0; head++)
+        {
+            codec_state(&c, queue[head], &s);
+            r->expanded++;
+            for(int m = 0; m < MOVE_COUNT; m++)
+            {
+                SimState t;
+                int flags = sim_step(sl, &s, m, &t);
+                if(flags & SIM_FELL)
+                    continue;
+                if(flags & SIM_WON)
+                {
+                    r->moves = depth + 1;
+                    last_key = queue[head];
+                    last_move = m;
+                    break;
+                }
+                t.moves = 0;
+                key = codec_key(&c, &t);
+                if(!(seen[key >> 6] & (1ull << (key & 63))))
+                {
+                    seen[key >> 6] |= 1ull << (key & 63);
+                    queue.push_back(key);
+                }
+            }
+        }
+    }
+
+    // Walk back one layer at a time to a state that leads to the one after it
+    if(last_move >= 0)
+    {
+        r->path.assign(r->moves, 0);
+        r->path[r->moves - 1] = last_move;
+        for(int depth = r->moves - 1; depth > 0; depth--)
+            r->path[depth - 1] = step_back(&c, queue, layers[depth - 1], layers[depth], last_key, &last_key);
+    }
+    r->visited = queue.size();
+    r->memory = seen.size() * sizeof(uint64_t) + queue.capacity() * sizeof(uint32_t);
+    r->spilled = 0;
+    r->seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return 1;
+}
+
+// Mark the tiles under the block in state s
+static void touch_footprint(const SimLevel *sl, const SimState *s, vector<unsigned char> *touched)
+{
+    const int *extent = sl->shape->extent[s->orient];
+    for(int i = 0; i < extent[0]; i++)
+        for(int j = 0; j < extent[2]; j++)
+            (*touched)[level_index(sl->level, s->x + i, s->z + j)] = 1;
+}
+
+int solve_reachable(const SimLevel *sl, vector<unsigned char> *touched, uint64_t *states)
+{
+    StateCodec c;
+    if(!codec_init(&c, sl) || c.num_states > (1ull << 32))
+        return 0;
+    const Level *lvl = sl->level;
+    touched->assign((size_t) (lvl->size_x + 2*LEVEL_BORDER) * lvl->stride, 0);
+
+    // The same search as solve_bfs(), run to the end; a win ends a path but
+    // the block did get onto the goal
+    vector<uint64_t> seen((c.num_states + 63) / 64);
+    vector<uint32_t> queue;
+    SimState s;
+    sim_start(sl, &s);
+    uint32_t key = codec_key(&c, &s);
+    seen[key >> 6] |= 1ull << (key & 63);
+    queue.push_back(key);
+    for(size_t head = 0; head < queue.size(); head++)
+    {
+        codec_state(&c, queue[head], &s);
+        touch_footprint(sl, &s, touched);
+        for(int m = 0; m < MOVE_COUNT; m++)
+        {
+            SimState t;
+            int flags = sim_step(sl, &s, m, &t);
+            if(flags & SIM_FELL)
+                continue;
+            if(flags & SIM_WON)
+            {
+                touch_footprint(sl, &t, touched);
+                continue;
+            }
+            t.moves = 0;
+            key = codec_key(&c, &t);
+            if(!(seen[key >> 6] & (1ull << (key & 63))))
+            {
+                seen[key >> 6] |= 1ull << (key & 63);
+                queue.push_back(key);
+            }
+        }
+    }
+    *states = queue.size();
+    return 1;
+}
+
+string solve_path_string(const vector<int> &path)
+{
+    static const char keys[MOVE_COUNT] = { 'w', 'a', 's', 'd' };
+    string s;
+    for(size_t i = 0; i < path.size(); i++)
+        s += keys[path[i]];
+    return s;
+}
+
+// Fewest rolls along one axis (MOVE_UP/DOWN for z, MOVE_LEFT/RIGHT for x) to
+// stand at offset 0 from offset d, rolls along the other axis being free.
+// dist[o * (2*range + 1) + d + range], by 0-1 BFS back from the targets.
+static void axis_distances(const SimShape *shape, int axis, int range, vector<int> *dist)
+{
+    int width = 2*range + 1, n = shape->num_orients * width;
+    dist->assign(n, INT_MAX);
+    deque<int> queue;
+    for(int o = 0; o < shape->num_orients; o++)
+        if(shape->single[o])
+        {
+            (*dist)[o * width + range] = 0;
+            queue.push_back(o * width + range);
+        }
+    while(!queue.empty())
+    {
+        int node = queue.front();
+        queue.pop_front();
+        int o = node / width, d = node % width - range;
+        for(int p = 0; p < shape->num_orients; p++)
+            for(int m = 0; m < MOVE_COUNT; m++)
+            {
+                const int *t = shape->transitions[p][m];
+                if(t[0] != o)
+                    continue;
+                int along = (m == MOVE_LEFT || m == MOVE_RIGHT) == (axis == 0);
+                int pd = along ? d - t[1 + axis] : d;
+                if(pd < -range || pd > range)
+                    continue;
+                int cost = (*dist)[node] + along;
+                int &pdist = (*dist)[p * width + pd + range];
+                if(cost < pdist)
+                {
+                    pdist = cost;
+                    if(along)
+                        queue.push_back(p * width + pd + range);
+                    else
+                        queue.push_front(p * width + pd + range);
+                }
+            }
+    }
+}
+
+struct Heuristic {
+    int range, width;
+    vector<int> dist[2];        // x, z
+    vector<int> target_x, target_z;  // every goal tile and every teleporter
+};
+
+static void heuristic_init(Heuristic *h, const SimLevel *sl)
+{
+    const Level *lvl = sl->level;
+    h->range = max(lvl->size_x, lvl->size_z) + SIM_MAX_DIM;
+    h->width = 2*h->range + 1;
+    axis_distances(sl->shape, 0, h->range, &h->dist[0]);
+    axis_distances(sl->shape, 1, h->range, &h->dist[1]);
+    // Standing on any goal tile wins, not only the one the level names
+    h->target_x.clear();
+    h->target_z.clear();
+    for(int x = 0; x < lvl->size_x; x++)
+        for(int z = 0; z < lvl->size_z; z++)
+            if(level_tile(lvl, x, z) == TILE_GOAL)
+            {
+                h->target_x.push_back(x);
+                h->target_z.push_back(z);
+            }
+    for(int i = 0; i < lvl->num_switches; i++)
+        if(lvl->tiles[lvl->switches[i].tile] == TILE_TELEPORT && lvl->switches[i].num_links > 0)
+        {
+            int x, z;
+            level_coords(lvl, lvl->switches[i].tile, &x, &z);
+            h->target_x.push_back(x);
+            h->target_z.push_back(z);
+        }
+}
+
+static int heuristic(const Heuristic *h, const SimState *s)
+{
+    int best = INT_MAX;
+    for(size_t i = 0; i < h->target_x.size(); i++)
+    {
+        int dx = h->dist[0][s->orient * h->width + s->x - h->target_x[i] + h->range];
+        int dz = h->dist[1][s->orient * h->width + s->z - h->target_z[i] + h->range];
+        if(dx != INT_MAX && dz != INT_MAX)
+            best = min(best, dx + dz);
+    }
+    return best;
+}
+
+// Visited states: one bit each while that fits, else open addressing on key + 1
+struct VisitedSet {
+    vector<uint64_t> bits, table;
+    size_t count;
+};
+
+static int visited_insert(VisitedSet *v, uint64_t key)
+{
+    if(!v->bits.empty())
+    {
+        uint64_t bit = 1ull << (key & 63);
+        if(v->bits[key >> 6] & bit)
+            return 0;
+        v->bits[key >> 6] |= bit;
+        return 1;
+    }
+    if(2 * (v->count + 1) > v->table.size())
+    {
+        vector<uint64_t> old;
+        old.swap(v->table);
+        v->table.assign(max<size_t>(1024, old.size() * 2), 0);
+        v->count = 0;
+        for(size_t i = 0; i < old.size(); i++)
+            if(old[i])
+                visited_insert(v, old[i] - 1);
+    }
+    size_t mask = v->table.size() - 1;
+    for(size_t i = (key * 0x9e3779b97f4a7c15ull) >> 20 & mask; ; i = (i + 1) & mask)
+    {
+        if(v->table[i] == key + 1)
+            return 0;
+        if(v->table[i] == 0)
+        {
+            v->table[i] = key + 1;
+            v->count++;
+            return 1;
+        }
+    }
+}
+
+static int visited_contains(const VisitedSet *v, uint64_t key)
+{
+    if(!v->bits.empty())
+        return (v->bits[key >> 6] >> (key & 63)) & 1;
+    if(v->table.empty())
+        return 0;
+    size_t mask = v->table.size() - 1;
+    for(size_t i = (key * 0x9e3779b97f4a7c15ull) >> 20 & mask; v->table[i]; i = (i + 1) & mask)
+        if(v->table[i] == key + 1)
+            return 1;
+    return 0;
+}
+
+// The states with one f value: in memory, plus runs written to the spill file
+struct Bucket {
+    vector<uint64_t> keys;
+    vector< pair<uint64_t, size_t> > runs;  // file offset, count
+};
+
+#define SPILL_CHUNK (1 << 16)   // states read back at a time
+
+int solve_astar(const SimLevel *sl, const AStarOptions *opt, SolveResult *r)
+{
+    StateCodec c;
+    if(!codec_init(&c, sl))
+        return 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    string spill_path = string(opt->spill_dir) + "/bloxsolve.XXXXXX";
+    int fd = mkstemp(&spill_path[0]);
+    if(fd < 0)
+    {
+        perror(spill_path.c_str());
+        return 0;
+    }
+    unlink(spill_path.c_str());
+    uint64_t spill_end = 0;
+
+    Heuristic h;
+    heuristic_init(&h, sl);
+    VisitedSet visited;
+    visited.count = 0;
+    if(c.num_states / 8 <= opt->memory_budget / 2)
+        visited.bits.assign((c.num_states + 63) / 64, 0);
+
+    vector<Bucket> buckets;
+    size_t frontier = 0;    // states held in memory
+    r->memory = 0;
+    r->spilled = 0;
+    r->expanded = 0;
+    r->path.clear();
+
+    SimState s;
+    sim_start(sl, &s);
+    int best = INT_MAX;     // fewest moves to win found so far
+    int f0 = heuristic(&h, &s);
+    if(f0 != INT_MAX)
+    {
+        buckets.resize(f0 + 1);
+        buckets[f0].keys.push_back(codec_key(&c, &s));
+        frontier = 1;
+    }
+
+    // All states with f below the best win found are expanded, lowest f first
+    for(int f = f0; f < (int) buckets.size() && f < best; f++)
+    {
+        // buckets grows while this one is expanded, so it is looked up each time
+        for(;;)
+        {
+            Bucket &bucket = buckets[f];
+            if(bucket.keys.empty())
+            {
+                if(bucket.runs.empty())
+                    break;
+                pair<uint64_t, size_t> &run = bucket.runs.back();
+                size_t n = min<size_t>(run.second, SPILL_CHUNK);
+                run.second -= n;
+                bucket.keys.resize(n);
+                if(pread(fd, &bucket.keys[0], n * sizeof(uint64_t), run.first + run.second * sizeof(uint64_t)) !=
+                   (ssize_t) (n * sizeof(uint64_t)))
+                {
+                    perror("spill file");
+                    close(fd);
+                    return 0;
+                }
+                frontier += n;
+                if(run.second == 0)
+                    bucket.runs.pop_back();
+            }
+
+            uint64_t key = bucket.keys.back();
+            bucket.keys.pop_back();
+            frontier--;
+            if(!visited_insert(&visited, key))
+                continue;
+            codec_state(&c, key, &s);
+            int g = f - heuristic(&h, &s);
+            r->expanded++;
+
+            for(int m = 0; m < MOVE_COUNT; m++)
+            {
+                SimState t;
+                int flags = sim_step(sl, &s, m, &t);
+                if(flags & SIM_FELL)
+                    continue;
+                if(flags & SIM_WON)
+                {
+                    best = min(best, g + 1);
+                    continue;
+                }
+                t.moves = 0;
+                uint64_t child = codec_key(&c, &t);
+                int ht = heuristic(&h, &t);
+                if(ht == INT_MAX || g + 1 + ht >= best || visited_contains(&visited, child))
+                    continue;
+                int fc = g + 1 + ht;
+                if(fc >= (int) buckets.size())
+                    buckets.resize(fc + 1);
+                buckets[fc].keys.push_back(child);
+                frontier++;
+            }
+
+            // Over budget: move the buckets furthest away to disk, keeping the one in
+            // use, in writes of at least a chunk
+            size_t memory = visited.bits.size() * sizeof(uint64_t) + visited.table.size() * sizeof(uint64_t) +
+                            frontier * sizeof(uint64_t);
+            r->memory = max(r->memory, memory);
+            for(int b = buckets.size() - 1; memory > opt->memory_budget && frontier > SPILL_CHUNK && b > f; b--)
+            {
+                Bucket &far = buckets[b];
+                if(far.keys.empty())
+                    continue;
+                size_t bytes = far.keys.size() * sizeof(uint64_t);
+                if(pwrite(fd, &far.keys[0], bytes, spill_end) != (ssize_t) bytes)
+                {
+                    perror("spill file");
+                    close(fd);
+                    return 0;
+                }
+                far.runs.push_back(make_pair(spill_end, far.keys.size()));
+                spill_end += bytes;
+                r->spilled += bytes;
+                frontier -= far.keys.size();
+                memory -= bytes;
+                vector<uint64_t>().swap(far.keys);
+            }
+        }
+        vector<uint64_t>().swap(buckets[f].keys);
+    }
+    close(fd);
+
+    r->moves = best == INT_MAX ? -1 : best;
+    r->visited = r->expanded;
+    r->seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return 1;
+}
+
+int solve_distances(const SimLevel *sl, DistanceTable *t, const atomic<bool> *cancel)
+{
+    StateCodec &c = t->codec;
+    if(!codec_init(&c, sl) || c.num_states > DIST_MAX_STATES)
+        return 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    uint32_t n = c.num_states;
+
+    // Predecessor lists of every state, counted on a first pass over the moves
+    // and filled on a second one; states with a winning move are 1 away
+    vector<uint32_t> first(n + 1, 0), fill, preds;
+    vector<uint32_t> queue;
+    t->dist.assign(n, DIST_DEAD);
+    t->supported = 0;
+    for(int pass = 0; pass < 2; pass++)
+    {
+        if(pass == 1)
+        {
+            for(uint32_t k = 0; k < n; k++)
+                first[k + 1] += first[k];
+            preds.resize(first[n]);
+            fill.assign(first.begin(), first.end() - 1);
+        }
+        for(uint32_t key = 0; key < n; key++)
+        {
+            if((key & 4095) == 0 && cancel->load(memory_order_relaxed))
+                return 0;
+            SimState s, next;
+            codec_state(&c, key, &s);
+            if(!sim_supported(sl, &s))
+                continue;
+            for(int m = 0; m < MOVE_COUNT; m++)
+            {
+                int flags = sim_step(sl, &s, m, &next);
+                if(flags & SIM_FELL)
+                    continue;
+                if(flags & SIM_WON)
+                {
+                    if(pass == 0 && t->dist[key] != 1)
+                    {
+                        t->dist[key] = 1;
+                        queue.push_back(key);
+                    }
+                    continue;
+                }
+                next.moves = 0;
+                uint32_t to = codec_key(&c, &next);
+                if(pass == 0)
+                    first[to + 1]++;
+                else
+                    preds[fill[to]++] = key;
+            }
+            t->supported += pass == 0;
+        }
+    }
+    vector<uint32_t>().swap(fill);
+
+    // Predecessors of key are preds[first[key] .. first[key + 1])
+    for(size_t head = 0; head < queue.size(); head++)
+    {
+        uint32_t key = queue[head];
+        int d = t->dist[key] + 1;
+        for(uint32_t i = first[key]; i < first[key + 1]; i++)
+            if(t->dist[preds[i]] == DIST_DEAD && d < DIST_DEAD)
+            {
+                t->dist[preds[i]] = d;
+                queue.push_back(preds[i]);
+            }
+    }
+    t->dead = t->supported - queue.size();
+    t->seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return 1;
+}
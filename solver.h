@@ -0,0 +1,101 @@
+#ifndef SOLVER_H
+#define SOLVER_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sim.h"
+
+/* Solvers over the full state of a level: block position and orientation,
+   switches, crumbled tiles and timers. They use sim_step(), the rules the game
+   plays by. */
+
+// Every state of a level as a number below num_states, mixed radix:
+//   z, x, orientation, button switches, crumbled tiles, then each timer
+struct StateCodec {
+    const SimLevel *sl;
+    uint64_t num_states;
+    int size_x, size_z, num_orients;
+    int num_buttons;                    // switches that can be on
+    int button_of[SIM_MAX_SWITCHES];    // bit of switch i in the key, -1 for teleporters
+    int button_switch[SIM_MAX_SWITCHES];
+    int num_crumble;
+    int num_timers;
+    int timer_radix[SIM_MAX_TIMERS];    // duration + 1
+};
+
+// Returns 0 if the level has 2^64 states or more
+int codec_init(StateCodec *c, const SimLevel *sl);
+
+// The moves field is not part of the key
+uint64_t codec_key(const StateCodec *c, const SimState *s);
+void codec_state(const StateCodec *c, uint64_t key, SimState *s);
+
+struct SolveResult {
+    int moves;                  // fewest moves to the goal, -1 if it cannot be reached
+    std::vector<int> path;      // MOVE_* of one shortest solution
+    uint64_t expanded;          // states taken off the queue
+    uint64_t visited;           // distinct states reached
+    size_t memory;              // peak bytes of the visited set and the queue or frontier
+    uint64_t spilled;           // frontier bytes written to disk
+    double seconds;
+};
+
+// Breadth-first search from the start state, one visited bit per state.
+// Returns 0 if the state space does not fit a 32-bit key.
+int solve_bfs(const SimLevel *sl, SolveResult *r);
+
+// Every state the block can reach from the start without falling, and in
+// touched (by level_index(), resized to the level) a 1 for each tile the block
+// rests on in one of them, the goal included. Returns 0 if the state space
+// does not fit a 32-bit key.
+int solve_reachable(const SimLevel *sl, std::vector<unsigned char> *touched, uint64_t *states);
+
+/* A* for levels too large for solve_bfs(), with frontier buckets by f = g + h.
+   h is admissible and consistent: the fewest x rolls plus the fewest z rolls an
+   empty plane needs to stand on any goal tile (or on a teleporter, which may be
+   closer), each counted with the rolls along the other axis free. The visited
+   set is a bitset while it fits half the budget, else a hash set of the states
+   reached. When the frontier takes the memory past the budget, the buckets
+   with the highest f are written to a file in spill_dir and read back once the
+   search gets to them. Finds the fewest moves, without the path. */
+struct AStarOptions {
+    size_t memory_budget;       // bytes
+    const char *spill_dir;
+};
+
+// Returns 0 if the level has too many states for a 64-bit key or the spill file fails
+int solve_astar(const SimLevel *sl, const AStarOptions *opt, SolveResult *r);
+
+/* Moves to the goal from every state, by breadth-first search backwards from
+   the states one move away from winning. Built over every supported state, so
+   a lookup is one table read. The table keeps 2 bytes a state, but building it
+   peaks at up to 26: predecessor offsets and fill cursors (4 each), up to four
+   predecessors (16) and the queue (4) besides. That is 110 MB at the cap, and
+   the game builds one for the level played and one for the next. */
+#define DIST_DEAD 0xffff            // the goal cannot be reached any more
+#define DIST_MAX_STATES (1u << 22)
+
+struct DistanceTable {
+    StateCodec codec;
+    std::vector<uint16_t> dist;     // by codec_key()
+    uint64_t supported, dead;       // states the block can rest in, and those of them with no way to the goal
+    double seconds;
+};
+
+// Returns 0 if the level has more than DIST_MAX_STATES states, or once *cancel is set
+int solve_distances(const SimLevel *sl, DistanceTable *t, const std::atomic<bool> *cancel);
+
+// Moves left to win from s, DIST_DEAD if there is no way
+static inline int distance_to_goal(const DistanceTable *t, const SimState *s)
+{
+    return t->dist[codec_key(&t->codec, s)];
+}
+
+// The w/a/s/d keys of a path
+std::string solve_path_string(const std::vector<int> &path);
+
+#endif
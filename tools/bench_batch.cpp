@@ -0,0 +1,142 @@
+// Batch stepping against sim_step() one state at a time: random walks of many
+// blocks from states all over a level, as a solver's frontier would have them.
+// Every code path the CPU has is checked against sim_step() after each step.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <vector>
+
+#include "batch.h"
+#include "rng.h"
+
+using namespace std;
+
+static double seconds_since(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// The next moves of every walk
+static void random_moves(uint64_t *r, vector<unsigned char> *moves)
+{
+    for(size_t i = 0; i < moves->size(); i++)
+        (*moves)[i] = next_random(r) & 3;
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = argc > 1 ? argv[1] : "levels/2.txt";
+    int lanes = argc > 2 ? atoi(argv[2]) : 4096;
+    int steps = argc > 3 ? atoi(argv[3]) : 2000;
+    Level lvl;
+    SimShape shape;
+    SimLevel sl;
+    const char *ext = strrchr(path, '.');
+    if(lanes < 1 || steps < 1 || !(ext && strcmp(ext, ".lvl") == 0 ? level_map(path, &lvl) : level_load(path, &lvl)) ||
+       !sim_shape(&shape, 1, 2, 1) || !sim_prepare(&sl, &lvl, &shape))
+    {
+        fprintf(stderr, "usage: bench_batch [level file] [states] [steps]\n");
+        return 1;
+    }
+
+    // Start every walk on a random state the block can rest in, with any
+    // switches on
+    vector<SimState> start(lanes);
+    vector<unsigned char> moves(lanes);
+    uint64_t r = 1;
+    for(int i = 0; i < lanes; i++)
+    {
+        SimState &s = start[i];
+        sim_start(&sl, &s);
+        do
+        {
+            s.x = next_random(&r) % lvl.size_x;
+            s.z = next_random(&r) % lvl.size_z;
+            s.orient = next_random(&r) % shape.num_orients;
+            s.switches = lvl.num_switches ? next_random(&r) & ((2ull << (lvl.num_switches - 1)) - 1) : 0;
+        } while(!sim_supported(&sl, &s));
+    }
+
+    // Scalar: an array of states, one sim_step() each
+    vector<SimState> states = start;
+    vector<unsigned char> flags(lanes);
+    uint64_t seed = r;
+    long long falls = 0, wins = 0;
+    chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+    for(int k = 0; k < steps; k++)
+    {
+        random_moves(&r, &moves);
+        for(int i = 0; i < lanes; i++)
+        {
+            flags[i] = sim_step(&sl, &states[i], moves[i], &states[i]);
+            falls += (flags[i] & SIM_FELL) != 0;
+            if(flags[i] & SIM_WON)
+            {
+                wins++;
+                sim_start(&sl, &states[i]);
+            }
+        }
+    }
+    double scalar = seconds_since(begin);
+    printf("%s: %d states, %d steps, %lld falls, %lld wins\n", path, lanes, steps, falls, wins);
+    printf("  sim_step      %7.1f M moves/s\n", (double) lanes * steps / scalar / 1e6);
+
+    // Each batch path, timed on its own and then run again next to sim_step()
+    for(int isa = SIM_BATCH_SCALAR; isa <= sim_batch_isa(); isa++)
+    {
+        SimBatch b;
+        sim_batch_resize(&b, lanes);
+        for(int i = 0; i < lanes; i++)
+            sim_batch_set(&b, i, &start[i]);
+        r = seed;
+        begin = chrono::steady_clock::now();
+        for(int k = 0; k < steps; k++)
+        {
+            random_moves(&r, &moves);
+            sim_step_batch_isa(isa, &sl, &b, moves.data(), flags.data());
+            for(int i = 0; i < lanes; i++)
+                if(flags[i] & SIM_WON)
+                {
+                    SimState s;
+                    sim_start(&sl, &s);
+                    sim_batch_set(&b, i, &s);
+                }
+        }
+        double seconds = seconds_since(begin);
+
+        vector<SimState> check = start;
+        vector<unsigned char> check_flags(lanes);
+        for(int i = 0; i < lanes; i++)
+            sim_batch_set(&b, i, &start[i]);
+        r = seed;
+        int bad = 0;
+        for(int k = 0; k < steps && !bad; k++)
+        {
+            random_moves(&r, &moves);
+            sim_step_batch_isa(isa, &sl, &b, moves.data(), flags.data());
+            for(int i = 0; i < lanes; i++)
+            {
+                check_flags[i] = sim_step(&sl, &check[i], moves[i], &check[i]);
+                SimState s;
+                sim_batch_get(&b, i, &s);
+                if(flags[i] != check_flags[i] || memcmp(&s, &check[i], sizeof(s)) != 0)
+                {
+                    printf("MISMATCH: %s, step %d, state %d\n", sim_batch_isa_name(isa), k, i);
+                    bad = 1;
+                    break;
+                }
+                if(flags[i] & SIM_WON)
+                {
+                    sim_start(&sl, &check[i]);
+                    sim_batch_set(&b, i, &check[i]);
+                }
+            }
+        }
+        printf("  batch %-7s %7.1f M moves/s, %.2fx%s\n", sim_batch_isa_name(isa), (double) lanes * steps / seconds / 1e6,
+               scalar / seconds, bad ? "" : ", same states");
+        if(bad)
+            return 1;
+    }
+    return 0;
+}
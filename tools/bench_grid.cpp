@@ -0,0 +1,107 @@
+// Footprint check on the level bitplanes against the old layout of four int[10][10] tables
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <vector>
+
+#include "sim.h"
+
+using namespace std;
+
+// The tables as game.cpp used to keep them
+struct TableLevel {
+    int normal[10][10];
+    int goal[10][10];
+    int frag[10][10];
+    int bridge[10][10];
+};
+
+static void to_tables(const Level *lvl, TableLevel *t)
+{
+    memset(t, 0, sizeof(*t));
+    for(int x = 0; x < 10; x++)
+        for(int z = 0; z < 10; z++)
+            switch(level_tile(lvl, x, z))
+            {
+            case TILE_FLOOR: t->normal[x][z] = 1; break;
+            case TILE_FRAGILE: t->normal[x][z] = 1; t->frag[x][z] = 1; break;
+            case TILE_BUTTON: t->normal[x][z] = 2; break;
+            case TILE_BRIDGE: t->normal[x][z] = 1; t->bridge[x][z] = 1; break;
+            case TILE_FRAGILE_BRIDGE: t->normal[x][z] = 1; t->frag[x][z] = 1; t->bridge[x][z] = 1; break;
+            case TILE_GOAL: t->goal[x][z] = 1; break;
+            }
+}
+
+static int table_supported(const TableLevel *t, const SimState *s)
+{
+    int cells[2][2] = { { s->x, s->z }, { s->x, s->z } };
+    if(s->orient == ORIENT_LONGZ)
+        cells[1][1]++;
+    else if(s->orient == ORIENT_LONGX)
+        cells[1][0]++;
+    for(int k = 0; k < 2; k++)
+    {
+        int x = cells[k][0], z = cells[k][1];
+        if(x < 0 || x >= 10 || z < 0 || z >= 10)
+            return 0;
+        if(t->normal[x][z] == 0 && t->goal[x][z] == 0)
+            return 0;
+        if(t->bridge[x][z] && !(s->switches & 1))
+            return 0;
+        if(s->orient == ORIENT_STAND && t->frag[x][z])
+            return 0;
+    }
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = argc > 1 ? argv[1] : "levels/2.txt";
+    Level lvl;
+    if(!level_load(path, &lvl) || lvl.size_x != 10 || lvl.size_z != 10)
+    {
+        fprintf(stderr, "usage: bench_grid [10x10 level file]\n");
+        return 1;
+    }
+    TableLevel tables;
+    to_tables(&lvl, &tables);
+    SimShape shape;
+    sim_shape(&shape, 1, 2, 1);
+    SimLevel sl;
+    sim_prepare(&sl, &lvl, &shape);
+
+    // Random states inside the playable area, like the ones the rules check after a move
+    vector<SimState> states(1 << 16);
+    unsigned r = 12345;
+    for(size_t i = 0; i < states.size(); i++)
+    {
+        r = r * 1103515245 + 12345;
+        memset(&states[i], 0, sizeof(states[i]));
+        states[i].x = (r >> 8) % 10;
+        states[i].z = (r >> 16) % 10;
+        states[i].orient = (r >> 24) % ORIENT_COUNT;
+        states[i].switches = (r >> 28) & 1;  // the level's one button, linked to every bridge
+    }
+
+    const int rounds = 500;
+    long supported[2] = { 0, 0 };
+    double seconds[2];
+    for(int variant = 0; variant < 2; variant++)
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(int round = 0; round < rounds; round++)
+            for(size_t i = 0; i < states.size(); i++)
+                supported[variant] += variant ? sim_supported(&sl, &states[i]) : table_supported(&tables, &states[i]);
+        seconds[variant] = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+
+    double checks = (double) rounds * states.size();
+    printf("tables: %.1f M checks/s\n", checks / seconds[0] / 1e6);
+    printf("planes: %.1f M checks/s (%.2fx)\n", checks / seconds[1] / 1e6, seconds[0] / seconds[1]);
+    if(supported[0] != supported[1])
+    {
+        printf("MISMATCH: %ld vs %ld supported\n", supported[0], supported[1]);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,73 @@
+// Move journal on a random walk: bytes per 1000 moves, and undo/redo back to
+// every recorded state
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <vector>
+
+#include "journal.h"
+
+using namespace std;
+
+static double seconds_since(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = argc > 1 ? argv[1] : "levels/2.txt";
+    int n = argc > 2 ? atoi(argv[2]) : 1000000;
+    Level lvl;
+    SimShape shape;
+    SimLevel sl;
+    if(n < 1 || !level_load(path, &lvl) || !sim_shape(&shape, 1, 2, 1) || !sim_prepare(&sl, &lvl, &shape))
+    {
+        fprintf(stderr, "usage: bench_journal [level file] [moves]\n");
+        return 1;
+    }
+
+    // Large enough to keep every move, so all of them can be undone
+    Journal j;
+    journal_init(&j, (size_t) n * 32);
+    vector<SimState> states(n + 1);
+    sim_start(&sl, &states[0]);
+    unsigned r = 1;
+    int falls = 0;
+    for(int i = 0; i < n; i++)
+    {
+        r = r * 1103515245 + 12345;
+        int move = (r >> 16) & 3;
+        int flags = sim_step(&sl, &states[i], move, &states[i + 1]);
+        falls += (flags & SIM_FELL) != 0;
+        if(flags & SIM_WON)
+            sim_start(&sl, &states[i + 1]);
+        journal_record(&j, &shape, &states[i], move, &states[i + 1]);
+    }
+    printf("journal: %d moves (%d falls) in %zu bytes, %.0f bytes per 1000 moves (a SimState is %zu bytes)\n",
+           n, falls, journal_bytes(&j), journal_bytes(&j) * 1000.0 / n, sizeof(SimState));
+
+    SimState s = states[n];
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(int i = n; i > 0; i--)
+    {
+        journal_undo(&j, &shape, &s);
+        if(memcmp(&s, &states[i - 1], sizeof(s)) != 0)
+        {
+            printf("MISMATCH: undo of move %d\n", i);
+            return 1;
+        }
+    }
+    double undo_seconds = seconds_since(start);
+
+    // A win restarts the level outside of sim_step(), so redo stops short of it
+    start = chrono::steady_clock::now();
+    int redone = 0;
+    while(journal_redo(&j, &sl, &s) && memcmp(&s, &states[redone + 1], sizeof(s)) == 0)
+        redone++;
+    double redo_seconds = seconds_since(start);
+    printf("undo: %.1f M moves/s, redo: %.1f M moves/s (%d redone)\n",
+           n / undo_seconds / 1e6, redone / redo_seconds / 1e6, redone);
+    return 0;
+}
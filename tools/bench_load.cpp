@@ -0,0 +1,85 @@
+// Load time of a large level: text parsing against mapping the binary file
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <string>
+
+#include "level.h"
+
+using namespace std;
+
+static double ms_since(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char **argv)
+{
+    int size = argc > 1 ? atoi(argv[1]) : 4096;
+    string txt = "/tmp/bench_load.txt", lvl_path = "/tmp/bench_load.lvl";
+
+    // Mostly floor with some holes, bridges and buttons, one goal
+    FILE *fp = fopen(txt.c_str(), "w");
+    if(fp == NULL || size < 2)
+    {
+        fprintf(stderr, "usage: bench_load [size]\n");
+        return 1;
+    }
+    unsigned r = 12345;
+    string row(size, 'o');
+    for(int x = 0; x < size; x++)
+    {
+        for(int z = 0; z < size; z++)
+        {
+            r = r * 1103515245 + 12345;
+            int k = (r >> 16) % 100;
+            row[z] = k < 10 ? '.' : (k < 12 ? '=' : (k < 13 ? 'f' : 'o'));
+            if(k == 99 && (r >> 8) % 64 == 0)
+                row[z] = 'b';
+        }
+        if(x == 0)
+            row[0] = 'S';
+        if(x == size - 1)
+            row[size - 1] = 'G';
+        fprintf(fp, "%s\n", row.c_str());
+    }
+    fclose(fp);
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    Level text;
+    if(!level_load(txt.c_str(), &text))
+        return 1;
+    double text_ms = ms_since(start);
+
+    if(!level_save(lvl_path.c_str(), &text))
+    {
+        perror(lvl_path.c_str());
+        return 1;
+    }
+
+    // The first map after writing is as warm as a level the game just prefetched
+    const int runs = 100;
+    double best = 1e9, total = 0;
+    for(int i = 0; i < runs; i++)
+    {
+        start = chrono::steady_clock::now();
+        Level mapped;
+        if(!level_map(lvl_path.c_str(), &mapped))
+            return 1;
+        double t = ms_since(start);
+        best = min(best, t);
+        total += t;
+        if(mapped.size_x != size || mapped.num_links != text.num_links || mapped.tiles[mapped.stride * 3 + 3] != text.tiles[text.stride * 3 + 3])
+        {
+            fprintf(stderr, "MISMATCH between the text and the binary level\n");
+            return 1;
+        }
+    }
+
+    printf("%dx%d level, %d switches, %d links\n", size, size, text.num_switches, text.num_links);
+    printf("text:   %.2f ms\n", text_ms);
+    printf("mapped: %.3f ms avg, %.3f ms best over %d runs\n", total / runs, best, runs);
+    remove(txt.c_str());
+    remove(lvl_path.c_str());
+    return 0;
+}
@@ -0,0 +1,230 @@
+// Example bot for `server --listen`: opens sessions on a level, sends batches
+// of random moves and reports round trips and moves per second. With --check
+// it loads the level itself and compares every state the server sends back
+// with sim_step() on its own copy.
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <vector>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "botproto.h"
+#include "level.h"
+#include "rng.h"
+#include "sim.h"
+
+using namespace std;
+
+static int send_all(int fd, const void *data, size_t size, int pass_fd)
+{
+    const char *p = (const char*) data;
+    while(size > 0)
+    {
+        iovec iov = { (void*) p, size };
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        char control[CMSG_SPACE(sizeof(int))];
+        if(pass_fd >= 0)
+        {
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+            cm->cmsg_level = SOL_SOCKET;
+            cm->cmsg_type = SCM_RIGHTS;
+            cm->cmsg_len = CMSG_LEN(sizeof(int));
+            memcpy(CMSG_DATA(cm), &pass_fd, sizeof(int));
+        }
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return 0;
+        p += n;
+        size -= n;
+        pass_fd = -1;
+    }
+    return 1;
+}
+
+static int recv_all(int fd, void *data, size_t size)
+{
+    char *p = (char*) data;
+    while(size > 0)
+    {
+        ssize_t n = recv(fd, p, size, 0);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return 0;
+        p += n;
+        size -= n;
+    }
+    return 1;
+}
+
+// One request and the header of its reply, which must be of the given type
+static int request(int fd, uint32_t type, uint32_t count, const void *items, size_t size, int pass_fd,
+                   uint32_t reply, BotHeader *got)
+{
+    vector<char> msg(sizeof(BotHeader) + size);
+    BotHeader hdr = { type, count };
+    memcpy(msg.data(), &hdr, sizeof(hdr));
+    if(size)
+        memcpy(msg.data() + sizeof(hdr), items, size);
+    if(!send_all(fd, msg.data(), msg.size(), pass_fd) || !recv_all(fd, got, sizeof(*got)))
+    {
+        fprintf(stderr, "bot: connection lost\n");
+        return 0;
+    }
+    if(got->type != reply)
+    {
+        fprintf(stderr, "bot: server replied %u to request %u\n", got->type, type);
+        return 0;
+    }
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = "/tmp/bloxorz.sock", *check = NULL;
+    int sessions = 1000, batches = 1000, per = 1, level = 0, use_shm = 0;
+    int block[3] = { 1, 2, 1 };
+    for(int i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "--socket") == 0 && i + 1 < argc)
+            path = argv[++i];
+        else if(strcmp(argv[i], "--sessions") == 0 && i + 1 < argc)
+            sessions = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--batches") == 0 && i + 1 < argc)
+            batches = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--per") == 0 && i + 1 < argc)
+            per = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--level") == 0 && i + 1 < argc)
+            level = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--shm") == 0)
+            use_shm = 1;
+        else if(strcmp(argv[i], "--check") == 0 && i + 1 < argc)
+            check = argv[++i];
+        else if(strcmp(argv[i], "--block") == 0 && i + 1 < argc &&
+                sscanf(argv[i + 1], "%dx%dx%d", &block[0], &block[1], &block[2]) == 3)
+            i++;
+        else
+            sessions = 0;
+    }
+    if(sessions < 1 || batches < 1 || per < 1 || (uint64_t) sessions * per > BOT_MAX_ITEMS)
+    {
+        fprintf(stderr, "usage: bot [--socket PATH] [--sessions N] [--batches N] [--per MOVES] [--level N] [--shm]\n"
+                        "           [--check level.txt --block XxYxZ]\n");
+        return 1;
+    }
+
+    // The level and block the server was started with, to step alongside it
+    Level lvl;
+    SimShape shape;
+    SimLevel sl;
+    if(check && (!level_load(check, &lvl) || !sim_shape(&shape, block[0], block[1], block[2]) ||
+                 !sim_prepare(&sl, &lvl, &shape)))
+    {
+        fprintf(stderr, "bot: cannot load %s\n", check);
+        return 1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if(fd < 0 || connect(fd, (sockaddr*) &addr, sizeof(addr)) < 0)
+    {
+        fprintf(stderr, "bot: cannot connect to %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    size_t n = (size_t) sessions * per;
+    BotState *states = NULL;
+    vector<BotState> inline_states(use_shm ? 0 : n);
+    BotHeader got;
+    if(use_shm)
+    {
+        // Sealed against shrinking, which the server requires
+        int mfd = memfd_create("bot-states", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        size_t size = n * sizeof(BotState);
+        void *mem = mfd < 0 || ftruncate(mfd, size) < 0 || fcntl(mfd, F_ADD_SEALS, F_SEAL_SHRINK) < 0 ? MAP_FAILED :
+                    mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, mfd, 0);
+        if(mem == MAP_FAILED || !request(fd, BOT_SHM, size, NULL, 0, mfd, BOT_SHM_OK, &got))
+        {
+            fprintf(stderr, "bot: cannot set up shared memory\n");
+            return 1;
+        }
+        close(mfd);
+        states = (BotState*) mem;
+    }
+    else
+        states = inline_states.data();
+
+    vector<uint32_t> levels(sessions, level);
+    vector<int32_t> ids(sessions);
+    if(!request(fd, BOT_OPEN, sessions, levels.data(), sessions * sizeof(uint32_t), -1, BOT_OPENED, &got) ||
+       !recv_all(fd, ids.data(), sessions * sizeof(int32_t)))
+        return 1;
+    for(int i = 0; i < sessions; i++)
+        if(ids[i] < 0)
+        {
+            fprintf(stderr, "bot: the server has no level %d\n", level);
+            return 1;
+        }
+    vector<SimState> local(check ? sessions : 0);
+    for(size_t i = 0; i < local.size(); i++)
+        sim_start(&sl, &local[i]);
+
+    // Each batch moves every session per times, the sessions one after the other
+    uint64_t r = 1, mismatches = 0, falls = 0, wins = 0;
+    vector<BotMove> moves(n);
+    double busy = 0;
+    for(int b = 0; b < batches; b++)
+    {
+        for(size_t i = 0; i < n; i++)
+        {
+            moves[i].session = ids[i % sessions];
+            moves[i].move = next_random(&r) & 3;
+        }
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        if(!request(fd, BOT_MOVES, n, moves.data(), n * sizeof(BotMove), -1, BOT_STATES, &got) ||
+           (!use_shm && !recv_all(fd, states, n * sizeof(BotState))))
+            return 1;
+        busy += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        for(size_t i = 0; i < n; i++)
+        {
+            falls += (states[i].flags & SIM_FELL) != 0;
+            wins += (states[i].flags & SIM_WON) != 0;
+            if(!check)
+                continue;
+            SimState *s = &local[i % sessions];
+            int flags = sim_step(&sl, s, moves[i].move, s);
+            if(flags & SIM_WON)
+                sim_start(&sl, s);
+            if(states[i].session != ids[i % sessions] || states[i].x != s->x || states[i].z != s->z ||
+               states[i].orient != s->orient || (int) states[i].flags != flags || (int) states[i].moves != s->moves)
+                mismatches++;
+        }
+    }
+
+    request(fd, BOT_CLOSE, sessions, ids.data(), sessions * sizeof(int32_t), -1, BOT_CLOSED, &got);
+    close(fd);
+    printf("bot: %d batches of %zu moves over %d sessions%s: %.0f round trips/s, %.2f M moves/s (%llu falls, %llu wins)\n",
+           batches, n, sessions, use_shm ? " with shared memory" : "", batches / busy, batches * (double) n / busy / 1e6,
+           (unsigned long long) falls, (unsigned long long) wins);
+    if(check)
+        printf("bot: %llu of %llu states differ from sim_step()\n", (unsigned long long) mismatches,
+               (unsigned long long) batches * n);
+    return mismatches != 0;
+}
@@ -0,0 +1,521 @@
+// Random-walk fuzzing of the game rules. Each task makes a random level with
+// every kind of tile and a random block, and walks many blocks over it from
+// random states, some at random and some choosing moves that keep them on the
+// level. Every move of sim_step() is checked for states that cannot be,
+// against the same walk on the level transposed (x and z swapped) and
+// mirrored, against rolling back, and against sim_step_batch() on every code
+// path the CPU has. Runs on every core and reports moves per second. Built
+// with -fsanitize=address,undefined, out of bounds reads are reported too.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "batch.h"
+#include "pool.h"
+#include "rng.h"
+
+using namespace std;
+
+#define MAX_REPORTS 5   // failures kept per task
+
+struct FuzzOptions {
+    int walkers, steps;     // per task
+    int size_max;           // level sides, from the block's up to this
+    int twins, batch;       // run those checks
+    vector<Level> levels;   // levels given instead of random ones
+};
+
+struct TaskResult {
+    uint64_t seed;
+    uint64_t moves;         // walker moves
+    uint64_t steps;         // rule steps, checks included
+    uint64_t failures;
+    uint64_t events[6];     // moves with each sim_step() flag, falls, wins, ...
+    vector<string> reports;
+};
+
+// A level of random tiles, with buttons switching random bridges, some of them
+// for a time, and teleporters to random tiles. The start has floor under the
+// block, the goal is anywhere else.
+static void generate(uint64_t *r, const SimShape *shape, int size_max, Level *lvl)
+{
+    int sx = shape->dims[0], sz = shape->dims[2];
+    level_init(lvl, sx + random_below(r, size_max - sx + 1), sz + random_below(r, size_max - sz + 1));
+    static const int weights[TILE_COUNT] = { 20, 41, 8, 3, 6, 3, 1, 5, 5 };
+    for(int x = 0; x < lvl->size_x; x++)
+        for(int z = 0; z < lvl->size_z; z++)
+        {
+            int w = random_below(r, 92), tile = 0;
+            while(w >= weights[tile])
+                w -= weights[tile++];
+            lvl->tiles[level_index(lvl, x, z)] = tile;
+        }
+    lvl->start_x = random_below(r, lvl->size_x - sx + 1);
+    lvl->start_z = random_below(r, lvl->size_z - sz + 1);
+    for(int x = 0; x < sx; x++)
+        for(int z = 0; z < sz; z++)
+            lvl->tiles[level_index(lvl, lvl->start_x + x, lvl->start_z + z)] = TILE_FLOOR;
+    int gx = random_below(r, lvl->size_x), gz = random_below(r, lvl->size_z);
+    if(gx < lvl->start_x || gx >= lvl->start_x + sx || gz < lvl->start_z || gz >= lvl->start_z + sz)
+    {
+        lvl->goal_x = gx;
+        lvl->goal_z = gz;
+        lvl->tiles[level_index(lvl, gx, gz)] = TILE_GOAL;
+    }
+
+    vector<uint32_t> bridges;
+    int crumbles = 0;
+    for(int x = 0; x < lvl->size_x; x++)
+        for(int z = 0; z < lvl->size_z; z++)
+        {
+            unsigned char *t = &lvl->tiles[level_index(lvl, x, z)];
+            if(*t == TILE_BRIDGE || *t == TILE_FRAGILE_BRIDGE)
+                bridges.push_back(level_index(lvl, x, z));
+            if(*t == TILE_CRUMBLE && ++crumbles > SIM_MAX_CRUMBLE)
+                *t = TILE_FLOOR;
+        }
+    vector<LevelSwitch> switches;
+    vector<uint32_t> links;
+    int timers = 0;
+    for(int x = 0; x < lvl->size_x; x++)
+        for(int z = 0; z < lvl->size_z; z++)
+        {
+            uint32_t index = level_index(lvl, x, z);
+            unsigned char *t = &lvl->tiles[index];
+            if(*t != TILE_BUTTON && *t != TILE_TELEPORT)
+                continue;
+            if(switches.size() == SIM_MAX_SWITCHES)
+            {
+                *t = TILE_FLOOR;
+                continue;
+            }
+            LevelSwitch sw = { index, (uint32_t) links.size(), 0, 0 };
+            if(*t == TILE_TELEPORT)
+                links.push_back(level_index(lvl, random_below(r, lvl->size_x), random_below(r, lvl->size_z)));
+            else
+            {
+                for(int k = random_below(r, 4); k > 0 && !bridges.empty(); k--)
+                    links.push_back(bridges[random_below(r, bridges.size())]);
+                if(timers < SIM_MAX_TIMERS && random_below(r, 3) == 0)
+                {
+                    sw.duration = 1 + random_below(r, 6);
+                    timers++;
+                }
+            }
+            sw.num_links = links.size() - sw.first_link;
+            switches.push_back(sw);
+        }
+    level_set_links(lvl, switches, links);
+}
+
+// Any state the block can rest in, with switches, crumbled tiles and timers at
+// random; the start if none turns up
+static void random_state(uint64_t *r, const SimLevel *sl, SimState *s)
+{
+    const Level *lvl = sl->level;
+    for(int tries = 0; tries < 100; tries++)
+    {
+        memset(s, 0, sizeof(*s));
+        s->orient = random_below(r, sl->shape->num_orients);
+        s->x = random_below(r, lvl->size_x);
+        s->z = random_below(r, lvl->size_z);
+        s->moves = random_below(r, 1000);
+        s->crumbled = next_random(r) & ((uint32_t) (1ull << sl->crumble_tiles.size()) - 1);
+        for(int i = 0; i < lvl->num_switches; i++)
+        {
+            int t = sl->timer_of[i];
+            if(t >= 0)
+                s->timers[t] = random_below(r, lvl->switches[i].duration + 1);
+            if(t >= 0 ? s->timers[t] > 0 : next_random(r) & 1)
+                s->switches |= 1u << i;
+        }
+        if(sim_supported(sl, s))
+            return;
+    }
+    sim_start(sl, s);
+}
+
+static int same_state(const SimState *a, const SimState *b)
+{
+    return a->x == b->x && a->z == b->z && a->orient == b->orient && a->moves == b->moves &&
+           a->switches == b->switches && a->crumbled == b->crumbled && memcmp(a->timers, b->timers, sizeof(a->timers)) == 0;
+}
+
+// What is wrong with the result of a step, NULL if nothing
+static const char *check_step(const SimLevel *sl, const SimState *in, int move, const SimState *out, int flags)
+{
+    const Level *lvl = sl->level;
+    const SimShape *shape = sl->shape;
+    if(out->orient < 0 || out->orient >= shape->num_orients)
+        return "orientation out of range";
+    if(flags & SIM_FELL)
+    {
+        SimState start;
+        sim_start(sl, &start);
+        if(flags != (SIM_MOVED | SIM_FELL))
+            return "a fall with other flags";
+        return same_state(out, &start) ? NULL : "a fall that is not back at the start";
+    }
+
+    const int *extent = shape->extent[out->orient];
+    if(out->x < 0 || out->z < 0 || out->x + extent[0] > lvl->size_x || out->z + extent[2] > lvl->size_z)
+        return "block outside the level";
+    for(int i = 0; i < extent[0]; i++)
+        for(int j = 0; j < extent[2]; j++)
+        {
+            int tile = sim_tile(sl, out, out->x + i, out->z + j);
+            if(tile == TILE_VOID)
+                return "block resting on void";
+            if(shape->heavy[out->orient] && (tile == TILE_FRAGILE || tile == TILE_FRAGILE_BRIDGE))
+                return "heavy block resting on a fragile tile";
+        }
+    if(out->moves != in->moves + 1)
+        return "move count not one more";
+    if(lvl->num_switches < 32 && out->switches >> lvl->num_switches)
+        return "switch bits past the level's switches";
+    if(sl->crumble_tiles.size() < 32 && out->crumbled >> sl->crumble_tiles.size())
+        return "crumbled bits past the level's crumbling tiles";
+    if((in->crumbled & ~out->crumbled) != 0)
+        return "a crumbled tile came back";
+    if(!(flags & SIM_CRUMBLED) != (in->crumbled == out->crumbled))
+        return "SIM_CRUMBLED does not match the crumbled tiles";
+    if(!(flags & SIM_TOGGLED) && in->switches != out->switches)
+        return "switches changed without SIM_TOGGLED";
+    for(int t = sl->num_timers; t < SIM_MAX_TIMERS; t++)
+        if(out->timers[t])
+            return "timer running in an unused slot";
+    for(int i = 0; i < lvl->num_switches; i++)
+    {
+        int t = sl->timer_of[i];
+        if(t >= 0 && (out->timers[t] > lvl->switches[i].duration || (out->timers[t] > 0) != ((out->switches >> i) & 1)))
+            return "timed button out of step with its timer";
+    }
+    if(flags & SIM_TELEPORTED)
+    {
+        if(!shape->single[out->orient])
+            return "teleported while lying on several tiles";
+    }
+    else
+    {
+        const int *t = shape->transitions[in->orient][move];
+        if(out->orient != t[0] || out->x != in->x + t[1] || out->z != in->z + t[2])
+            return "block did not roll as the move says";
+    }
+    // Any goal tile wins, not only the one the level names
+    int on_goal = shape->single[out->orient] && sim_tile(sl, out, out->x, out->z) == TILE_GOAL;
+    if(on_goal != !!(flags & SIM_WON))
+        return "SIM_WON does not match the block on the goal";
+    return NULL;
+}
+
+// The level seen with x and z swapped, or with x reversed. Moves, positions,
+// orientations and crumbling tile bits are mapped across; switches and timers
+// keep their order.
+enum { TWIN_TRANSPOSE, TWIN_MIRROR, TWIN_COUNT };
+
+struct Twin {
+    int kind;
+    Level lvl;
+    SimShape shape;
+    SimLevel sl;
+    int move_of[MOVE_COUNT];
+    int orient_of[SIM_MAX_ORIENTS];
+    int crumble_of[SIM_MAX_CRUMBLE];
+};
+
+// Anchor in the twin of an area ex tiles long along x; neither twin reverses z
+static void twin_point(const Twin *tw, const Level *lvl, int x, int z, int ex, int *tx, int *tz)
+{
+    if(tw->kind == TWIN_TRANSPOSE)
+    {
+        *tx = z;
+        *tz = x;
+    }
+    else
+    {
+        *tx = lvl->size_x - x - ex;
+        *tz = z;
+    }
+}
+
+static uint32_t twin_index(const Twin *tw, const Level *lvl, uint32_t index)
+{
+    int x, z, tx, tz;
+    level_coords(lvl, index, &x, &z);
+    twin_point(tw, lvl, x, z, 1, &tx, &tz);
+    return level_index(&tw->lvl, tx, tz);
+}
+
+static int twin_init(Twin *tw, int kind, const SimLevel *sl)
+{
+    const Level *lvl = sl->level;
+    const SimShape *shape = sl->shape;
+    int transpose = kind == TWIN_TRANSPOSE;
+    tw->kind = kind;
+    level_init(&tw->lvl, transpose ? lvl->size_z : lvl->size_x, transpose ? lvl->size_x : lvl->size_z);
+    for(int x = 0; x < lvl->size_x; x++)
+        for(int z = 0; z < lvl->size_z; z++)
+            tw->lvl.tiles[twin_index(tw, lvl, level_index(lvl, x, z))] = level_tile(lvl, x, z);
+    twin_point(tw, lvl, lvl->start_x, lvl->start_z, shape->extent[0][0], &tw->lvl.start_x, &tw->lvl.start_z);
+    if(lvl->goal_x >= 0)
+        twin_point(tw, lvl, lvl->goal_x, lvl->goal_z, 1, &tw->lvl.goal_x, &tw->lvl.goal_z);
+    vector<LevelSwitch> switches(lvl->switches, lvl->switches + lvl->num_switches);
+    vector<uint32_t> links(lvl->links, lvl->links + lvl->num_links);
+    for(size_t i = 0; i < switches.size(); i++)
+        switches[i].tile = twin_index(tw, lvl, switches[i].tile);
+    for(size_t i = 0; i < links.size(); i++)
+        links[i] = twin_index(tw, lvl, links[i]);
+    level_set_links(&tw->lvl, switches, links);
+
+    const int *d = shape->dims;
+    if(!sim_shape(&tw->shape, transpose ? d[2] : d[0], d[1], transpose ? d[0] : d[2]) ||
+       !sim_prepare(&tw->sl, &tw->lvl, &tw->shape))
+        return 0;
+    for(int m = 0; m < MOVE_COUNT; m++)
+    {
+        static const int transposed[MOVE_COUNT] = { MOVE_LEFT, MOVE_UP, MOVE_RIGHT, MOVE_DOWN };
+        static const int mirrored[MOVE_COUNT] = { MOVE_UP, MOVE_RIGHT, MOVE_DOWN, MOVE_LEFT };
+        tw->move_of[m] = transpose ? transposed[m] : mirrored[m];
+    }
+    for(int o = 0; o < shape->num_orients; o++)
+    {
+        const int *e = shape->extent[o];
+        tw->orient_of[o] = -1;
+        for(int k = 0; k < tw->shape.num_orients; k++)
+        {
+            const int *te = tw->shape.extent[k];
+            if(te[1] == e[1] && te[0] == (transpose ? e[2] : e[0]) && te[2] == (transpose ? e[0] : e[2]))
+                tw->orient_of[o] = k;
+        }
+    }
+    for(size_t i = 0; i < sl->crumble_tiles.size(); i++)
+    {
+        uint32_t index = twin_index(tw, lvl, sl->crumble_tiles[i]);
+        for(size_t k = 0; k < tw->sl.crumble_tiles.size(); k++)
+            if(tw->sl.crumble_tiles[k] == index)
+                tw->crumble_of[i] = k;
+    }
+    return 1;
+}
+
+static void twin_state(const Twin *tw, const SimLevel *sl, const SimState *s, SimState *t)
+{
+    const int *e = sl->shape->extent[s->orient];
+    *t = *s;
+    twin_point(tw, sl->level, s->x, s->z, e[0], &t->x, &t->z);
+    t->orient = tw->orient_of[s->orient];
+    t->crumbled = 0;
+    for(size_t i = 0; i < sl->crumble_tiles.size(); i++)
+        t->crumbled |= ((s->crumbled >> i) & 1) << tw->crumble_of[i];
+}
+
+static void report(TaskResult *res, int walker, int step, const SimState *s, int move, const char *what)
+{
+    res->failures++;
+    if(res->reports.size() >= MAX_REPORTS)
+        return;
+    char line[256];
+    snprintf(line, sizeof(line), "seed %llu walker %d step %d: %s (x %d z %d orient %d switches %x, move %d)",
+             (unsigned long long) res->seed, walker, step, what, s->x, s->z, s->orient, s->switches, move);
+    res->reports.push_back(line);
+}
+
+static void fuzz_task(const FuzzOptions *opt, uint64_t seed, TaskResult *res)
+{
+    uint64_t r = seed;
+    res->seed = seed;
+    res->moves = res->steps = res->failures = 0;
+    memset(res->events, 0, sizeof(res->events));
+
+    SimShape shape;
+    sim_shape(&shape, 1 + random_below(&r, 3), 1 + random_below(&r, 3), 1 + random_below(&r, 3));
+    Level lvl;
+    if(opt->levels.empty())
+        generate(&r, &shape, opt->size_max, &lvl);
+    else
+        lvl = opt->levels[random_below(&r, opt->levels.size())];
+    SimLevel sl;
+    if(!sim_prepare(&sl, &lvl, &shape))
+        return;
+    Twin twins[TWIN_COUNT];
+    int num_twins = 0;
+    for(int k = 0; k < TWIN_COUNT && opt->twins; k++, num_twins++)
+        if(!twin_init(&twins[k], k, &sl))
+        {
+            SimState start;
+            sim_start(&sl, &start);
+            report(res, -1, 0, &start, 0, "twin level refused");
+            return;
+        }
+
+    int w = opt->walkers;
+    vector<SimState> states(w), next(w), twin_states((size_t) w * num_twins);
+    for(int i = 0; i < w; i++)
+    {
+        random_state(&r, &sl, &states[i]);
+        for(int k = 0; k < num_twins; k++)
+            twin_state(&twins[k], &sl, &states[i], &twin_states[(size_t) k * w + i]);
+    }
+    int isas = opt->batch ? sim_batch_isa() + 1 : 0;
+    vector<SimBatch> batches(isas);
+    for(int k = 0; k < isas; k++)
+    {
+        sim_batch_resize(&batches[k], w);
+        for(int i = 0; i < w; i++)
+            sim_batch_set(&batches[k], i, &states[i]);
+    }
+    vector<unsigned char> moves(w), flags(w), batch_flags(w);
+
+    for(int step = 0; step < opt->steps; step++)
+    {
+        for(int i = 0; i < w; i++)
+        {
+            // Odd walkers stay on the level when some move lets them
+            int move = next_random(&r) & 3;
+            if(i & 1)
+                for(int k = 0; k < MOVE_COUNT; k++)
+                {
+                    SimState s;
+                    res->steps++;
+                    if(!(sim_step(&sl, &states[i], (move + k) & 3, &s) & SIM_FELL))
+                    {
+                        move = (move + k) & 3;
+                        break;
+                    }
+                }
+            moves[i] = move;
+            flags[i] = sim_step(&sl, &states[i], move, &next[i]);
+            for(int b = 0; b < 6; b++)
+                res->events[b] += (flags[i] >> b) & 1;
+            const char *what = check_step(&sl, &states[i], move, &next[i], flags[i]);
+            if(what)
+                report(res, i, step, &states[i], move, what);
+
+            // Rolling straight back undoes a move that touched nothing
+            SimState back;
+            if(flags[i] == SIM_MOVED && sim_step(&sl, &next[i], move ^ 2, &back) == SIM_MOVED &&
+               (back.x != states[i].x || back.z != states[i].z || back.orient != states[i].orient))
+                report(res, i, step, &states[i], move, "rolling back does not return");
+
+            for(int k = 0; k < num_twins; k++)
+            {
+                SimState *t = &twin_states[(size_t) k * w + i], expect;
+                int tflags = sim_step(&twins[k].sl, t, twins[k].move_of[move], t);
+                twin_state(&twins[k], &sl, &next[i], &expect);
+                if(tflags != flags[i] || !same_state(t, &expect))
+                {
+                    report(res, i, step, &states[i], move, k == TWIN_TRANSPOSE ? "transposed level differs" :
+                                                                                   "mirrored level differs");
+                    *t = expect;
+                }
+            }
+            res->steps += 2 + num_twins;
+        }
+
+        for(int k = 0; k < isas; k++)
+        {
+            sim_step_batch_isa(k, &sl, &batches[k], moves.data(), batch_flags.data());
+            res->steps += w;
+            for(int i = 0; i < w; i++)
+            {
+                SimState s;
+                sim_batch_get(&batches[k], i, &s);
+                if(batch_flags[i] != flags[i] || !same_state(&s, &next[i]))
+                {
+                    report(res, i, step, &states[i], moves[i], k == SIM_BATCH_AVX2 ? "AVX2 batch differs" :
+                                                                k == SIM_BATCH_SSE4 ? "SSE4.1 batch differs" :
+                                                                                      "scalar batch differs");
+                    sim_batch_set(&batches[k], i, &next[i]);
+                }
+            }
+        }
+        states.swap(next);
+        res->moves += w;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    FuzzOptions opt;
+    opt.walkers = 64;
+    opt.steps = 2000;
+    opt.size_max = 16;
+    opt.twins = opt.batch = 1;
+    int tasks = 256, threads = 0, replay = 0;
+    uint64_t seed = 1;
+    for(int i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            tasks = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--walkers") == 0 && i + 1 < argc)
+            opt.walkers = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--steps") == 0 && i + 1 < argc)
+            opt.steps = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+            opt.size_max = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+            seed = strtoull(argv[++i], NULL, 10);
+        else if(strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+        {
+            seed = strtoull(argv[++i], NULL, 10);
+            replay = 1;
+        }
+        else if(strcmp(argv[i], "--no-twins") == 0)
+            opt.twins = 0;
+        else if(strcmp(argv[i], "--no-batch") == 0)
+            opt.batch = 0;
+        else
+        {
+            Level lvl;
+            const char *ext = strrchr(argv[i], '.');
+            if(!(ext && strcmp(ext, ".lvl") == 0 ? level_map(argv[i], &lvl) : level_load(argv[i], &lvl)))
+            {
+                fprintf(stderr, "usage: fuzz [-n TASKS] [--walkers N] [--steps N] [--size MAX] [--threads N] [--seed N]\n"
+                                "            [--replay SEED] [--no-twins] [--no-batch] [level.txt|level.lvl]...\n");
+                return 1;
+            }
+            opt.levels.push_back(lvl);
+        }
+    }
+    if(tasks < 1 || opt.walkers < 1 || opt.steps < 1 || opt.size_max < 3)
+    {
+        fprintf(stderr, "fuzz: -n, --walkers and --steps want at least 1, --size at least 3\n");
+        return 1;
+    }
+    if(replay)
+        tasks = 1;
+
+    // Task t walks from its own seed, so a failure replays on its own
+    vector<TaskResult> results(tasks);
+    PoolStats stats;
+    pool_run(tasks, threads, [&](int t, int) {
+        fuzz_task(&opt, replay ? seed : seed * 1000003 + t, &results[t]);
+    }, &stats);
+
+    uint64_t moves = 0, steps = 0, failures = 0, events[6] = { 0 };
+    int shown = 0;
+    for(int t = 0; t < tasks; t++)
+    {
+        for(int b = 0; b < 6; b++)
+            events[b] += results[t].events[b];
+        moves += results[t].moves;
+        steps += results[t].steps;
+        failures += results[t].failures;
+        for(size_t k = 0; k < results[t].reports.size() && shown < 20; k++, shown++)
+            printf("fuzz: %s\n", results[t].reports[k].c_str());
+    }
+    printf("fuzz: %d tasks, %llu moves in %.2f s on %d threads: %.2f M moves/s, %.2f M rule steps/s, %llu failures\n",
+           tasks, (unsigned long long) moves, stats.seconds, stats.threads, moves / stats.seconds / 1e6,
+           steps / stats.seconds / 1e6, (unsigned long long) failures);
+    printf("fuzz: moves that toggled %llu, fell %llu, won %llu, teleported %llu, crumbled a tile %llu\n",
+           (unsigned long long) events[1], (unsigned long long) events[2], (unsigned long long) events[3],
+           (unsigned long long) events[4], (unsigned long long) events[5]);
+    if(failures)
+        printf("fuzz: rerun one with --replay SEED\n");
+    return failures != 0;
+}
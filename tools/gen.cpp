@@ -0,0 +1,295 @@
+// Random levels that pass the solver: layouts of a given size with a start, a
+// goal, fragile tiles and buttons with their bridges, kept if their par and
+// difficulty fall in the wanted bands. Generated and solved on every core.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "pack.h"
+#include "pool.h"
+#include "rng.h"
+#include "solver.h"
+
+using namespace std;
+
+#define BATCH 32    // candidates per pool task
+
+struct GenOptions {
+    int size_x, size_z;
+    double floor, fragile;      // share of tiles that are floor, share of floor that is fragile
+    int pairs;                  // buttons, each with its own bridge
+    int par_min, par_max;
+    uint64_t hard_min, hard_max;// states the BFS expands before it finds the goal
+};
+
+struct Candidate {
+    Level lvl;
+    int par;
+    uint64_t expanded;
+};
+
+static void generate(const GenOptions *opt, uint64_t *r, Level *lvl)
+{
+    level_init(lvl, opt->size_x, opt->size_z);
+    for(int x = 0; x < opt->size_x; x++)
+        for(int z = 0; z < opt->size_z; z++)
+            if(next_random(r) < opt->floor * (1u << 31))
+                lvl->tiles[level_index(lvl, x, z)] = next_random(r) < opt->fragile * (1u << 31) ? TILE_FRAGILE : TILE_FLOOR;
+
+    // A bridge is a straight run of one to three tiles somewhere else on the level
+    vector<LevelSwitch> switches;
+    vector<uint32_t> links;
+    for(int i = 0; i < opt->pairs; i++)
+    {
+        LevelSwitch sw = { (uint32_t) level_index(lvl, random_below(r, opt->size_x), random_below(r, opt->size_z)),
+                           (uint32_t) links.size(), 0, 0 };
+        if(lvl->tiles[sw.tile] == TILE_BUTTON)
+            continue;
+        lvl->tiles[sw.tile] = TILE_BUTTON;
+        int along_x = next_random(r) & 1, length = 1 + random_below(r, 3);
+        int bx = random_below(r, opt->size_x - (along_x ? length - 1 : 0));
+        int bz = random_below(r, opt->size_z - (along_x ? 0 : length - 1));
+        int type = next_random(r) & 1 ? TILE_BRIDGE : TILE_FRAGILE_BRIDGE;
+        for(int k = 0; k < length; k++)
+        {
+            uint32_t tile = level_index(lvl, bx + (along_x ? k : 0), bz + (along_x ? 0 : k));
+            if(lvl->tiles[tile] == TILE_BUTTON)
+                continue;
+            lvl->tiles[tile] = type;
+            links.push_back(tile);
+        }
+        sw.num_links = links.size() - sw.first_link;
+        switches.push_back(sw);
+    }
+
+    // Start and goal on two different tiles, over whatever was there
+    do
+    {
+        lvl->start_x = random_below(r, opt->size_x);
+        lvl->start_z = random_below(r, opt->size_z);
+        lvl->goal_x = random_below(r, opt->size_x);
+        lvl->goal_z = random_below(r, opt->size_z);
+    } while(lvl->start_x == lvl->goal_x && lvl->start_z == lvl->goal_z);
+    uint32_t start = level_index(lvl, lvl->start_x, lvl->start_z), goal = level_index(lvl, lvl->goal_x, lvl->goal_z);
+    for(size_t i = 0; i < switches.size(); i++)
+    {
+        // A button under the start or goal goes, and with it its bridge
+        if(switches[i].tile == start || switches[i].tile == goal)
+        {
+            for(uint32_t k = 0; k < switches[i].num_links; k++)
+                if(lvl->tiles[links[switches[i].first_link + k]] != TILE_BUTTON)
+                    lvl->tiles[links[switches[i].first_link + k]] = TILE_FLOOR;
+            switches.erase(switches.begin() + i--);
+        }
+    }
+    // A later button or bridge may have covered an earlier bridge tile, so
+    // links only keep the tiles that are still bridges; a button left with
+    // none is plain floor
+    for(size_t i = 0; i < switches.size(); i++)
+    {
+        uint32_t first = switches[i].first_link, kept = first;
+        for(uint32_t k = first; k < first + switches[i].num_links; k++)
+        {
+            int t = lvl->tiles[links[k]];
+            if((t == TILE_BRIDGE || t == TILE_FRAGILE_BRIDGE) && links[k] != start && links[k] != goal)
+                links[kept++] = links[k];
+        }
+        switches[i].num_links = kept - first;
+        if(kept == first)
+        {
+            lvl->tiles[switches[i].tile] = TILE_FLOOR;
+            switches.erase(switches.begin() + i--);
+        }
+    }
+    lvl->tiles[start] = TILE_FLOOR;
+    lvl->tiles[goal] = TILE_GOAL;
+    level_set_links(lvl, switches, links);
+}
+
+// Solve the candidate and say whether it is kept
+static int accept(const GenOptions *opt, const SimShape *shape, Candidate *c)
+{
+    SimLevel sl;
+    StateCodec codec;
+    SolveResult r;
+    if(!sim_prepare(&sl, &c->lvl, shape) || !codec_init(&codec, &sl) || !solve_bfs(&sl, &r))
+        return 0;
+    c->par = r.moves;
+    c->expanded = r.expanded;
+    return r.moves >= opt->par_min && r.moves <= opt->par_max && r.expanded >= opt->hard_min &&
+           r.expanded <= opt->hard_max;
+}
+
+static const char tile_chars[TILE_COUNT + 1] = ".ofb=xGct";
+
+// The text format, with a link line per button
+static int write_text(const char *path, const Candidate *c)
+{
+    FILE *f = fopen(path, "w");
+    if(f == NULL)
+        return 0;
+    const Level *lvl = &c->lvl;
+    fprintf(f, "# par %d, %llu states expanded\n", c->par, (unsigned long long) c->expanded);
+    for(int x = 0; x < lvl->size_x; x++)
+    {
+        for(int z = 0; z < lvl->size_z; z++)
+            fputc(x == lvl->start_x && z == lvl->start_z ? 'S' : tile_chars[level_tile(lvl, x, z)], f);
+        fputc('\n', f);
+    }
+    for(int i = 0; i < lvl->num_switches; i++)
+    {
+        int x, z;
+        level_coords(lvl, lvl->switches[i].tile, &x, &z);
+        fprintf(f, "link %d %d:", x, z);
+        for(uint32_t k = 0; k < lvl->switches[i].num_links; k++)
+        {
+            level_coords(lvl, lvl->links[lvl->switches[i].first_link + k], &x, &z);
+            fprintf(f, "%s %d %d", k ? "," : "", x, z);
+        }
+        fputc('\n', f);
+    }
+    return fclose(f) == 0;
+}
+
+// "a-b" or "a" into a range
+static int parse_range(const char *s, uint64_t *lo, uint64_t *hi)
+{
+    char *end;
+    *lo = *hi = strtoull(s, &end, 10);
+    if(*end == '-')
+        *hi = strtoull(end + 1, &end, 10);
+    return end != s && *end == 0 && *lo <= *hi;
+}
+
+int main(int argc, char **argv)
+{
+    GenOptions opt;
+    opt.size_x = opt.size_z = 10;
+    opt.floor = 0.7;
+    opt.fragile = 0.05;
+    opt.pairs = 2;
+    opt.par_min = 10;
+    opt.par_max = 40;
+    opt.hard_min = 0;
+    opt.hard_max = UINT64_MAX;
+    const char *out = NULL, *text_dir = NULL;
+    int count = 100, threads = 0;
+    uint64_t seed = 1;
+    SimShape shape;
+    sim_shape(&shape, 1, 2, 1);
+    for(int i = 1; i < argc; i++)
+    {
+        uint64_t lo, hi;
+        int ok = 1;
+        if(strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            ok = (count = atoi(argv[++i])) > 0;
+        else if(strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+            ok = sscanf(argv[++i], "%dx%d", &opt.size_x, &opt.size_z) == 2 && opt.size_x >= 2 && opt.size_z >= 2;
+        else if(strcmp(argv[i], "--floor") == 0 && i + 1 < argc)
+            opt.floor = atof(argv[++i]);
+        else if(strcmp(argv[i], "--fragile") == 0 && i + 1 < argc)
+            opt.fragile = atof(argv[++i]);
+        else if(strcmp(argv[i], "--pairs") == 0 && i + 1 < argc)
+            ok = (opt.pairs = atoi(argv[++i])) >= 0 && opt.pairs <= SIM_MAX_SWITCHES;
+        else if(strcmp(argv[i], "--par") == 0 && i + 1 < argc)
+        {
+            ok = parse_range(argv[++i], &lo, &hi);
+            opt.par_min = lo;
+            opt.par_max = hi;
+        }
+        else if(strcmp(argv[i], "--hard") == 0 && i + 1 < argc)
+            ok = parse_range(argv[++i], &opt.hard_min, &opt.hard_max);
+        else if(strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+            seed = strtoull(argv[++i], NULL, 10);
+        else if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--text") == 0 && i + 1 < argc)
+            text_dir = argv[++i];
+        else if(out == NULL && argv[i][0] != '-')
+            out = argv[i];
+        else
+            ok = 0;
+        if(!ok)
+        {
+            out = NULL;
+            break;
+        }
+    }
+    if(out == NULL)
+    {
+        fprintf(stderr, "usage: gen [-n COUNT] [--size XxZ] [--floor F] [--fragile F] [--pairs N] [--par MIN-MAX]\n"
+                        "           [--hard MIN-MAX] [--seed N] [--threads N] [--text DIR] out.pack\n");
+        return 1;
+    }
+    if(threads <= 0)
+        threads = pool_default_threads();
+
+    // Rounds of tasks, each task a batch of candidates from its own seed. The
+    // kept levels are taken in task order, so a seed gives the same levels on
+    // any number of threads.
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    vector<Candidate> kept;
+    uint64_t candidates = 0, steals = 0;
+    int round_tasks = threads * 8;
+    for(uint64_t first_task = 0; (int) kept.size() < count; first_task += round_tasks)
+    {
+        vector< vector<Candidate> > found(round_tasks);
+        PoolStats stats;
+        pool_run(round_tasks, threads, [&](int task, int) {
+            uint64_t r = (seed << 32) ^ (first_task + task);
+            for(int k = 0; k < 4; k++)
+                next_random(&r);
+            for(int i = 0; i < BATCH; i++)
+            {
+                Candidate c;
+                generate(&opt, &r, &c.lvl);
+                if(accept(&opt, &shape, &c))
+                    found[task].push_back(c);
+            }
+        }, &stats);
+        steals += stats.steals;
+        candidates += (uint64_t) round_tasks * BATCH;
+        for(int t = 0; t < round_tasks; t++)
+            for(size_t i = 0; i < found[t].size() && (int) kept.size() < count; i++)
+                kept.push_back(found[t][i]);
+        if(candidates >= 1000000 && kept.empty())
+        {
+            fprintf(stderr, "gen: nothing accepted in %llu candidates\n", (unsigned long long) candidates);
+            return 1;
+        }
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    vector<Level> levels;
+    vector<int> numbers;
+    int par_total = 0;
+    for(size_t i = 0; i < kept.size(); i++)
+    {
+        levels.push_back(kept[i].lvl);
+        numbers.push_back(i + 1);
+        par_total += kept[i].par;
+        if(text_dir)
+        {
+            string path = string(text_dir) + "/" + to_string(i + 1) + ".txt";
+            if(!write_text(path.c_str(), &kept[i]))
+            {
+                perror(path.c_str());
+                return 1;
+            }
+        }
+    }
+    if(!pack_save(out, levels, numbers))
+    {
+        fprintf(stderr, "gen: cannot write %s\n", out);
+        return 1;
+    }
+    printf("gen: %zu levels of %dx%d (average par %.1f) from %llu candidates (%.2f%% kept) in %.2f s on %d threads\n",
+           kept.size(), opt.size_x, opt.size_z, (double) par_total / kept.size(), (unsigned long long) candidates,
+           100.0 * kept.size() / candidates, seconds, threads);
+    printf("gen: %.0f candidates/s, %.1f accepted levels/s, %llu steals\n", candidates / seconds,
+           kept.size() / seconds, (unsigned long long) steals);
+    return 0;
+}
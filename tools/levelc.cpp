@@ -0,0 +1,27 @@
+// Compile a text level (format in level.h) into the binary format the game maps
+#include <cstdio>
+
+#include "level.h"
+
+int main(int argc, char **argv)
+{
+    if(argc != 3)
+    {
+        fprintf(stderr, "usage: levelc <level.txt> <level.lvl>\n");
+        return 2;
+    }
+    Level lvl;
+    if(!level_load(argv[1], &lvl))
+    {
+        fprintf(stderr, "levelc: cannot load %s\n", argv[1]);
+        return 1;
+    }
+    if(!level_save(argv[2], &lvl))
+    {
+        perror(argv[2]);
+        return 1;
+    }
+    printf("%s: %dx%d, start %d %d, goal %d %d, %d switches, %d links\n", argv[2], lvl.size_x, lvl.size_z,
+           lvl.start_x, lvl.start_z, lvl.goal_x, lvl.goal_z, lvl.num_switches, lvl.num_links);
+    return 0;
+}
@@ -0,0 +1,83 @@
+// Build a level pack from text or binary levels, or list one with load times
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "pack.h"
+
+using namespace std;
+
+// levels/12.txt is level 12; files without a number are numbered by position
+static int level_number(const char *path, int position)
+{
+    const char *name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+    char *end;
+    long n = strtol(name, &end, 10);
+    return end != name && *end == '.' && n > 0 ? n : position;
+}
+
+static int list(const char *path)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    LevelPack *pack = pack_open(path);
+    if(pack == NULL)
+        return 1;
+    double open_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    printf("%s: %d levels, opened in %.3f ms\n", path, pack_num_levels(pack), open_ms);
+
+    int bad = 0;
+    for(int i = 0; i < pack_num_levels(pack); i++)
+    {
+        int n = pack_level_number(pack, i);
+        Level lvl;
+        PackLoadStats stats;
+        if(!pack_load(pack, n, &lvl, &stats))
+        {
+            bad++;
+            continue;
+        }
+        printf("  %4d: %dx%d, %zu -> %zu bytes, lookup %.3f ms, decompress %.3f ms\n", n, lvl.size_x, lvl.size_z,
+               stats.compressed_size, stats.size, stats.lookup_ms, stats.decompress_ms);
+    }
+    pack_close(pack);
+    return bad ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    if(argc == 3 && strcmp(argv[1], "-l") == 0)
+        return list(argv[2]);
+    if(argc < 3)
+    {
+        fprintf(stderr, "usage: packc <out.pack> <level.txt|level.lvl>...\n"
+                        "       packc -l <pack>\n");
+        return 2;
+    }
+
+    vector<Level> levels;
+    vector<int> numbers;
+    for(int i = 2; i < argc; i++)
+    {
+        Level lvl;
+        size_t len = strlen(argv[i]);
+        int ok = len > 4 && strcmp(argv[i] + len - 4, ".lvl") == 0 ? level_map(argv[i], &lvl) : level_load(argv[i], &lvl);
+        if(!ok)
+        {
+            fprintf(stderr, "packc: cannot load %s\n", argv[i]);
+            return 1;
+        }
+        levels.push_back(lvl);
+        numbers.push_back(level_number(argv[i], i - 1));
+    }
+    if(!pack_save(argv[1], levels, numbers))
+    {
+        fprintf(stderr, "packc: cannot write %s\n", argv[1]);
+        return 1;
+    }
+    printf("%s: %d levels\n", argv[1], (int) levels.size());
+    return 0;
+}
@@ -0,0 +1,142 @@
+// Shortest solution of a level: breadth-first search over every state, or A*
+// with a memory budget for levels too large for that. With --cache the result
+// is looked up first and kept for the next run.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+
+#include "solcache.h"
+
+using namespace std;
+
+int main(int argc, char **argv)
+{
+    const char *path = NULL, *cache_path = NULL;
+    int mode = 0;   // 0 pick by size, 1 BFS, 2 A*
+    int distances = 0;
+    AStarOptions opt;
+    opt.memory_budget = (size_t) 1024 << 20;
+    opt.spill_dir = "/tmp";
+    SimShape shape;
+    sim_shape(&shape, 1, 2, 1);
+    for(int i = 1; i < argc; i++)
+    {
+        int sx, sy, sz;
+        if(strcmp(argv[i], "--block") == 0 && i + 1 < argc)
+        {
+            if(sscanf(argv[++i], "%dx%dx%d", &sx, &sy, &sz) != 3 || !sim_shape(&shape, sx, sy, sz))
+            {
+                fprintf(stderr, "--block wants XxYxZ, each side 1 to %d\n", SIM_MAX_DIM);
+                return 1;
+            }
+        }
+        else if(strcmp(argv[i], "--bfs") == 0)
+            mode = 1;
+        else if(strcmp(argv[i], "--astar") == 0)
+            mode = 2;
+        else if(strcmp(argv[i], "--dist") == 0)
+            distances = 1;
+        else if(strcmp(argv[i], "--budget") == 0 && i + 1 < argc)
+            opt.memory_budget = (size_t) atof(argv[++i]) * (1 << 20);
+        else if(strcmp(argv[i], "--spill") == 0 && i + 1 < argc)
+            opt.spill_dir = argv[++i];
+        else if(strcmp(argv[i], "--cache") == 0 && i + 1 < argc)
+            cache_path = argv[++i];
+        else
+            path = argv[i];
+    }
+    if(path == NULL)
+    {
+        fprintf(stderr, "usage: solve [--block XxYxZ] [--bfs | --astar] [--budget MB] [--spill DIR] [--dist] [--cache FILE]\n"
+                        "             level.txt|level.lvl\n");
+        return 1;
+    }
+
+    Level lvl;
+    const char *ext = strrchr(path, '.');
+    if(!(ext && strcmp(ext, ".lvl") == 0 ? level_map(path, &lvl) : level_load(path, &lvl)))
+        return 1;
+    SimLevel sl;
+    StateCodec codec;
+    if(!sim_prepare(&sl, &lvl, &shape) || !codec_init(&codec, &sl))
+        return 1;
+
+    // BFS while the keys fit 32 bits and its visited bits and a queue of every
+    // state fit the budget
+    if(mode == 0)
+        mode = codec.num_states <= (1ull << 32) && codec.num_states / 8 + codec.num_states * 4 <= opt.memory_budget ? 1 : 2;
+    printf("%s: %dx%d, %.3g states, %s\n", path, lvl.size_x, lvl.size_z, (double) codec.num_states,
+           mode == 1 ? "BFS" : "A*");
+
+    SolCache *cache = NULL;
+    uint64_t key = solcache_key(&lvl, &shape);
+    SolveResult r;
+    if(cache_path && (cache = solcache_open(cache_path)) == NULL)
+        return 1;
+    // An entry without the path the BFS would print (A* keeps none) is solved again
+    chrono::steady_clock::time_point lookup = chrono::steady_clock::now();
+    if(cache && solcache_find(cache, key, &r) &&
+       !(mode == 1 && r.path.empty() && r.moves > 0 && r.moves <= SOLCACHE_MAX_PATH))
+    {
+        double us = chrono::duration<double>(chrono::steady_clock::now() - lookup).count() * 1e6;
+        if(r.moves < 0)
+            printf("no solution\n");
+        else if(!r.path.empty())
+            printf("%d moves: %s\n", r.moves, solve_path_string(r.path).c_str());
+        else
+            printf("%d moves\n", r.moves);
+        if(r.expanded)
+            printf("from the cache in %.1f us (solved in %.1f us, %llu states expanded)\n", us, r.seconds * 1e6,
+                   (unsigned long long) r.expanded);
+        else
+            printf("from the cache in %.1f us\n", us);
+        solcache_close(cache);
+        return r.moves < 0 ? 2 : 0;
+    }
+
+    // Small levels solve in microseconds, so repeat them for a steady time
+    double seconds = 0;
+    int runs = 0;
+    do
+    {
+        if(!(mode == 1 ? solve_bfs(&sl, &r) : solve_astar(&sl, &opt, &r)))
+        {
+            fprintf(stderr, "%s: too many states for %s\n", path, mode == 1 ? "the BFS, try --astar" : "A*");
+            return 1;
+        }
+        seconds += r.seconds;
+        runs++;
+    } while(seconds < 0.1 && runs < 100000);
+
+    if(r.moves < 0)
+        printf("no solution\n");
+    else if(mode == 1)
+        printf("%d moves: %s\n", r.moves, solve_path_string(r.path).c_str());
+    else
+        printf("%d moves\n", r.moves);
+    printf("%llu states reached, %llu expanded, %.1f us per solve (%d runs), %.1f M states/s\n",
+           (unsigned long long) r.visited, (unsigned long long) r.expanded, seconds / runs * 1e6, runs,
+           r.expanded * runs / seconds / 1e6);
+    printf("peak memory %zu bytes, spilled %llu bytes\n", r.memory, (unsigned long long) r.spilled);
+    if(cache)
+    {
+        r.seconds = seconds / runs;
+        solcache_store(cache, key, &r);
+        solcache_close(cache);
+    }
+
+    // The table the game builds for hints
+    if(distances)
+    {
+        DistanceTable table;
+        atomic<bool> cancel(false);
+        if(!solve_distances(&sl, &table, &cancel))
+            printf("distance table: more than %u states\n", DIST_MAX_STATES);
+        else
+            printf("distance table: %llu states (%llu dead), %zu bytes, built in %.2f ms\n",
+                   (unsigned long long) table.supported, (unsigned long long) table.dead,
+                   table.dist.size() * sizeof(uint16_t), table.seconds * 1e3);
+    }
+    return r.moves < 0 ? 2 : 0;
+}
@@ -0,0 +1,247 @@
+// Check every level of a pack before release: solvable, par moves and tiles the
+// block can never reach, solved in parallel, with a JSON report. With --cache
+// levels solved in an earlier run take their par from the solution cache.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "pack.h"
+#include "pool.h"
+#include "solcache.h"
+
+using namespace std;
+
+#define MAX_LISTED_TILES 100    // unreachable tiles written out per level, the count is always full
+
+struct LevelReport {
+    int number;
+    int size_x, size_z;
+    uint64_t num_states;
+    const char *mode;           // "bfs", "astar", "cache", or NULL if the level could not be checked
+    string error;
+    int par;                    // -1 if there is no solution
+    uint64_t expanded;
+    int reachable_checked;      // 0 for levels too large to walk every state
+    uint64_t reachable_states;
+    vector<int> unreachable;    // level_index() of tiles the block never rests on
+    int worker;
+    double load_ms, solve_ms, reach_ms, total_ms;
+};
+
+static double ms_since(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+static void check_level(const LevelPack *pack, const SimShape *shape, const AStarOptions *opt, SolCache *cache,
+                        LevelReport *rep)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    Level lvl;
+    if(!pack_load(pack, rep->number, &lvl, NULL))
+    {
+        rep->error = "cannot load";
+        return;
+    }
+    rep->size_x = lvl.size_x;
+    rep->size_z = lvl.size_z;
+    rep->load_ms = ms_since(start);
+
+    SimLevel sl;
+    StateCodec codec;
+    if(!sim_prepare(&sl, &lvl, shape) || !codec_init(&codec, &sl))
+    {
+        rep->error = "too many switches, timers or states";
+        return;
+    }
+    rep->num_states = codec.num_states;
+
+    // The same choice as tools/solve, with this worker's share of the budget
+    chrono::steady_clock::time_point solve_start = chrono::steady_clock::now();
+    SolveResult r;
+    int bfs = codec.num_states <= (1ull << 32) && codec.num_states / 8 + codec.num_states * 4 <= opt->memory_budget;
+    uint64_t key = solcache_key(&lvl, shape);
+    if(cache && solcache_find(cache, key, &r))
+        rep->mode = "cache";
+    else
+    {
+        if(!(bfs ? solve_bfs(&sl, &r) : solve_astar(&sl, opt, &r)))
+        {
+            rep->error = "too many states";
+            return;
+        }
+        rep->mode = bfs ? "bfs" : "astar";
+        if(cache)
+            solcache_store(cache, key, &r);
+    }
+    rep->par = r.moves;
+    rep->expanded = r.expanded;
+    rep->solve_ms = ms_since(solve_start);
+
+    // Walking every state costs what the BFS does, so only where it could run
+    if(bfs)
+    {
+        chrono::steady_clock::time_point reach_start = chrono::steady_clock::now();
+        vector<unsigned char> touched;
+        rep->reachable_checked = solve_reachable(&sl, &touched, &rep->reachable_states);
+        for(int x = 0; x < lvl.size_x && rep->reachable_checked; x++)
+            for(int z = 0; z < lvl.size_z; z++)
+            {
+                int i = level_index(&lvl, x, z);
+                if(lvl.tiles[i] != TILE_VOID && !touched[i])
+                    rep->unreachable.push_back(i);
+            }
+        rep->reach_ms = ms_since(reach_start);
+    }
+    rep->total_ms = ms_since(start);
+}
+
+static void write_report(FILE *f, const char *path, const vector<LevelReport> &reports, const PoolStats *stats,
+                         double cpu_ms)
+{
+    int solvable = 0, failed = 0;
+    for(size_t i = 0; i < reports.size(); i++)
+    {
+        solvable += reports[i].par >= 0;
+        failed += reports[i].mode == NULL;
+    }
+    fprintf(f, "{\n  \"pack\": \"");
+    for(const char *p = path; *p; p++)
+        fprintf(f, *p == '"' || *p == '\\' ? "\\%c" : "%c", *p);
+    fprintf(f, "\",\n  \"levels\": %zu,\n  \"solvable\": %d,\n  \"unsolvable\": %zu,\n  \"errors\": %d,\n",
+            reports.size(), solvable, reports.size() - solvable - failed, failed);
+    fprintf(f, "  \"threads\": %d,\n  \"steals\": %llu,\n  \"wall_ms\": %.3f,\n  \"cpu_ms\": %.3f,\n",
+            stats->threads, (unsigned long long) stats->steals, stats->seconds * 1e3, cpu_ms);
+    fprintf(f, "  \"results\": [");
+    for(size_t i = 0; i < reports.size(); i++)
+    {
+        const LevelReport &r = reports[i];
+        fprintf(f, "%s\n    {\"level\": %d", i ? "," : "", r.number);
+        if(r.mode == NULL)
+        {
+            fprintf(f, ", \"error\": \"%s\"}", r.error.c_str());
+            continue;
+        }
+        fprintf(f, ", \"size\": [%d, %d], \"states\": %llu, \"solver\": \"%s\", \"solvable\": %s",
+                r.size_x, r.size_z, (unsigned long long) r.num_states, r.mode, r.par >= 0 ? "true" : "false");
+        if(r.par >= 0)
+            fprintf(f, ", \"par\": %d", r.par);
+        fprintf(f, ", \"expanded\": %llu", (unsigned long long) r.expanded);
+        if(r.reachable_checked)
+        {
+            fprintf(f, ", \"reachable_states\": %llu, \"unreachable_tiles\": %zu, \"unreachable\": [",
+                    (unsigned long long) r.reachable_states, r.unreachable.size());
+            Level dims;
+            dims.stride = r.size_z + 2*LEVEL_BORDER;
+            for(size_t t = 0; t < r.unreachable.size() && t < MAX_LISTED_TILES; t++)
+            {
+                int x, z;
+                level_coords(&dims, r.unreachable[t], &x, &z);
+                fprintf(f, "%s[%d, %d]", t ? ", " : "", x, z);
+            }
+            fprintf(f, "]");
+        }
+        fprintf(f, ", \"worker\": %d, \"load_ms\": %.3f, \"solve_ms\": %.3f, \"reach_ms\": %.3f, \"total_ms\": %.3f}",
+                r.worker, r.load_ms, r.solve_ms, r.reach_ms, r.total_ms);
+    }
+    fprintf(f, "\n  ]\n}\n");
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = NULL, *out = NULL, *cache_path = NULL;
+    int threads = 0;
+    size_t budget = (size_t) 4096 << 20;
+    SimShape shape;
+    sim_shape(&shape, 1, 2, 1);
+    for(int i = 1; i < argc; i++)
+    {
+        int sx, sy, sz;
+        if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--budget") == 0 && i + 1 < argc)
+            budget = (size_t) atof(argv[++i]) * (1 << 20);
+        else if(strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            out = argv[++i];
+        else if(strcmp(argv[i], "--cache") == 0 && i + 1 < argc)
+            cache_path = argv[++i];
+        else if(strcmp(argv[i], "--block") == 0 && i + 1 < argc)
+        {
+            if(sscanf(argv[++i], "%dx%dx%d", &sx, &sy, &sz) != 3 || !sim_shape(&shape, sx, sy, sz))
+            {
+                fprintf(stderr, "--block wants XxYxZ, each side 1 to %d\n", SIM_MAX_DIM);
+                return 1;
+            }
+        }
+        else
+            path = argv[i];
+    }
+    if(path == NULL)
+    {
+        fprintf(stderr, "usage: validate [--threads N] [--budget MB] [--block XxYxZ] [-o report.json] [--cache FILE]\n"
+                        "                level.pack\n");
+        return 1;
+    }
+    LevelPack *pack = pack_open(path);
+    SolCache *cache = NULL;
+    if(pack == NULL || (cache_path && (cache = solcache_open(cache_path)) == NULL))
+        return 1;
+    if(threads <= 0)
+        threads = pool_default_threads();
+
+    vector<LevelReport> reports;
+    for(int i = 0; i < pack_num_levels(pack); i++)
+    {
+        LevelReport r = LevelReport();
+        r.number = pack_level_number(pack, i);
+        r.par = -1;
+        reports.push_back(r);
+    }
+
+    // Big levels first, so the last tasks left to steal are small ones. The
+    // size of a level image, which grows with its area, is the guess.
+    vector<int> order(reports.size());
+    for(size_t i = 0; i < reports.size(); i++)
+        order[i] = i;
+    stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        return pack_level_size(pack, reports[a].number) > pack_level_size(pack, reports[b].number);
+    });
+
+    AStarOptions opt;
+    opt.memory_budget = budget / threads;
+    opt.spill_dir = "/tmp";
+    PoolStats stats;
+    pool_run(order.size(), threads, [&](int task, int worker) {
+        LevelReport *rep = &reports[order[task]];
+        rep->worker = worker;
+        check_level(pack, &shape, &opt, cache, rep);
+    }, &stats);
+
+    double cpu_ms = 0;
+    int bad = 0, failed = 0;
+    for(size_t i = 0; i < reports.size(); i++)
+    {
+        cpu_ms += reports[i].total_ms;
+        bad += reports[i].par < 0;
+        failed += reports[i].mode == NULL;
+    }
+    FILE *f = out ? fopen(out, "w") : stdout;
+    if(f == NULL)
+    {
+        perror(out);
+        return 1;
+    }
+    write_report(f, path, reports, &stats, cpu_ms);
+    if(out)
+        fclose(f);
+    fprintf(stderr, "validate: %zu levels on %d threads in %.1f ms (%.1f ms of work, %.2fx), %llu steals, %d unsolvable\n",
+            reports.size(), stats.threads, stats.seconds * 1e3, cpu_ms, cpu_ms / (stats.seconds * 1e3),
+            (unsigned long long) stats.steals, bad - failed);
+    solcache_close(cache);
+    pack_close(pack);
+    return failed ? 1 : bad ? 2 : 0;
+}